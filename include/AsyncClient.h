@@ -0,0 +1,223 @@
+#ifndef ASYNCCLIENT_H
+#define ASYNCCLIENT_H
+
+#include "Common.h"
+#include "BufferPool.h"
+#include <deque>
+#include <functional>
+#include <future>
+#include <limits>
+
+// Event-driven client runtime: one thread multiplexes every outgoing peer
+// connection over epoll, so a node can talk to many peers at once without
+// a thread per transfer. Requests are pipelined on one connection per
+// peer and answered through callbacks or futures. Range requests can pick
+// another stream to the same peer, which gets its own connection, so one
+// transfer isn't held to a single TCP window. Callbacks run on the event
+// thread and must not block.
+//
+// Headers and small frames are read a few KB at a time; the body of a
+// large frame such as a FILE_CHUNK is then received straight into a
+// BufferPool buffer and handed on as the message, without another copy.
+//
+// Client keeps its blocking interface on top of this: it owns a dedicated
+// connection whose messages are queued for a reader thread instead.
+class AsyncClient {
+public:
+    static constexpr int CONNECT_TIMEOUT_MS = 5000;           // Default, see setConnectTimeout()
+    static constexpr int RACE_GRACE_MS = 200;                 // At least, for the rest once one peer answered
+    static constexpr int REQUEST_TIMEOUT_MS = 10000;          // Without a byte from the peer
+    static constexpr int IDLE_TIMEOUT_SECONDS = 60;           // Per-peer connections without requests
+    static constexpr size_t MAX_MESSAGE_SIZE = 10 * 1024 * 1024;
+    static constexpr size_t INBOX_HIGH_WATER = 4 * 1024 * 1024;  // Reading pauses until drained to half
+    static constexpr size_t READ_BURST = 256 * 1024;          // Per connection per wakeup
+    static constexpr size_t READ_AHEAD = 4 * 1024;            // Headers and small frames per recv
+    static constexpr size_t DIRECT_FRAME_MIN = 16 * 1024;     // Larger bodies are read into their own buffer
+    static constexpr int TICK_MS = 100;                       // Timeout sweeps
+
+    using Message = std::vector<uint8_t>;  // Type byte, then payload
+    using ResponseCallback = std::function<void(const std::string& error, Message response)>;  // Empty error on success
+    using ChunkCallback = std::function<void(size_t offset, const uint8_t* data, size_t length)>;
+    using PingCallback = std::function<void(bool alive, std::chrono::microseconds rtt)>;
+
+    static constexpr size_t PING_STREAM = std::numeric_limits<size_t>::max();   // Never a transfer's
+
+    struct RangeResult {
+        bool ok = false;
+        size_t bytes = 0;
+        std::vector<uint8_t> data;    // Filled when there is no chunk callback
+        std::string error;
+        bool cancelled = false;
+        std::chrono::steady_clock::time_point first_byte;   // First chunk, or the end without one
+        std::chrono::steady_clock::time_point finished;
+    };
+    using RangeCallback = std::function<void(RangeResult result)>;
+
+    struct PendingRequest;
+
+    // One socket. Shared ones carry pipelined requests; a dedicated one
+    // queues whatever arrives for receive().
+    class Connection : public std::enable_shared_from_this<Connection> {
+    private:
+        friend class AsyncClient;
+
+        AsyncClient& engine;
+        std::string address;
+        int port;
+        bool shared;
+        size_t stream;                     // Which of the shared connections to the peer
+
+        // Event thread only
+        uint64_t id;                       // Never reused, so stale events miss
+        int fd;
+        bool connecting;
+        bool closed;
+        bool reading;
+        uint32_t interest;                 // Registered epoll events
+        std::string error;
+        std::chrono::steady_clock::time_point connect_deadline;
+        std::chrono::steady_clock::time_point last_activity;
+        std::vector<uint8_t> read_buffer;
+        size_t read_bytes;
+        Message body;                      // Large frame being read in place, from the BufferPool
+        size_t body_filled;
+        std::deque<std::vector<uint8_t>> write_queue;
+        size_t write_offset;               // Into write_queue.front()
+        std::deque<std::unique_ptr<PendingRequest>> requests;
+        std::vector<std::function<void(bool)>> connect_waiters;
+
+        // Shared with the thread calling receive()
+        mutable std::mutex inbox_mutex;
+        std::condition_variable inbox_cv;
+        std::deque<Message> inbox;
+        size_t inbox_bytes;
+        bool paused;
+        std::atomic<bool> open;
+
+    public:
+        Connection(AsyncClient& engine, const std::string& address, int port, bool shared);
+
+        Connection(const Connection&) = delete;
+        Connection& operator=(const Connection&) = delete;
+
+        // Safe from any thread; the frame goes out from the event thread
+        void send(MessageType type, const std::vector<uint8_t>& payload);
+
+        // Next queued message; false on timeout or once closed and drained
+        bool receive(Message& message, std::chrono::milliseconds timeout);
+
+        bool isOpen() const { return open.load(); }
+        bool hasPendingInput() const;
+        void close();
+
+        // Valid once connected
+        int socketFd() const { return fd; }
+        const std::string& getAddress() const { return address; }
+        int getPort() const { return port; }
+    };
+
+private:
+    int epoll_fd;
+    int wake_fd;                       // eventfd, pokes the loop for posted work
+    std::atomic<bool> running;
+    std::thread event_thread;
+
+    std::mutex command_mutex;
+    std::vector<std::function<void()>> commands;
+
+    // Event thread only
+    uint64_t next_id;
+    std::chrono::steady_clock::time_point last_sweep;
+    std::unordered_map<uint64_t, std::shared_ptr<Connection>> connections;     // By id
+    std::unordered_map<std::string, std::shared_ptr<Connection>> peer_connections;  // Shared, by peerKey()
+
+    std::atomic<uint64_t> next_request_id{1};
+    std::atomic<size_t> requests_started{0};
+    std::atomic<size_t> requests_failed{0};
+    std::atomic<size_t> open_connections{0};
+    std::atomic<int> connect_timeout_ms{CONNECT_TIMEOUT_MS};
+
+    void post(std::function<void()> command);
+    void eventLoop();
+    void runCommands();
+
+    void startConnect(const std::shared_ptr<Connection>& conn, std::chrono::milliseconds timeout);
+    void finishConnect(const std::shared_ptr<Connection>& conn);
+    std::chrono::milliseconds connectTimeout(std::chrono::milliseconds timeout) const;   // 0 for the default
+    static std::string peerKey(const std::string& address, int port, size_t stream);
+    std::shared_ptr<Connection> peerConnection(const std::string& address, int port, size_t stream,
+                                               std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
+    void enqueue(const std::string& address, int port, std::unique_ptr<PendingRequest> request,
+                 MessageType type, const std::vector<uint8_t>& payload, size_t stream = 0);
+
+    void handleRead(const std::shared_ptr<Connection>& conn);
+    void handleWrite(const std::shared_ptr<Connection>& conn);
+    void deliver(const std::shared_ptr<Connection>& conn, Message message);
+    void queueFrame(const std::shared_ptr<Connection>& conn, std::vector<uint8_t> frame);
+    void updateInterest(Connection& conn);
+    void resumeReading(const std::shared_ptr<Connection>& conn);
+    void closeConnection(const std::shared_ptr<Connection>& conn, const std::string& error);
+    void checkTimeouts();
+
+    static std::vector<uint8_t> frame(MessageType type, const std::vector<uint8_t>& payload);
+
+public:
+    AsyncClient();
+    ~AsyncClient();
+
+    AsyncClient(const AsyncClient&) = delete;
+    AsyncClient& operator=(const AsyncClient&) = delete;
+
+    // A dedicated connection for a blocking user; nullptr if it can't be made
+    // within the timeout, 0 for the default. Its reads pause while
+    // INBOX_HIGH_WATER bytes wait for receive().
+    std::future<std::shared_ptr<Connection>> connect(const std::string& address, int port,
+                                                     std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
+
+    // Connects to every peer at once and gives the indices of the first
+    // `wanted` to answer, in the order they did. Once one has answered the
+    // rest get twice as long as it took, or RACE_GRACE_MS, rather than the
+    // whole timeout; those still trying at the end are dropped. Winners
+    // keep their connection for the requests that follow.
+    std::future<std::vector<size_t>> race(const std::vector<std::pair<std::string, int>>& peers, size_t wanted,
+                                          std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
+
+    // One request, one response message
+    void request(const std::string& address, int port, MessageType type,
+                 std::vector<uint8_t> payload, ResponseCallback on_done);
+    std::future<Message> request(const std::string& address, int port, MessageType type,
+                                 std::vector<uint8_t> payload);
+
+    // PING on a connection of the peer's kept for pings, so it doesn't wait
+    // behind piece transfers. The RTT runs from when it goes out on the open
+    // connection to the PONG, a connect first not counted.
+    void ping(const std::string& address, int port, PingCallback on_done);
+
+    // A byte range of a file by name (FILE_REQUEST) or content hash
+    // (FILE_BY_HASH_REQUEST). Chunks go to on_chunk as they arrive, or are
+    // collected into the result without one. Stream 0 is the connection
+    // every other request shares; others each open one more to the peer.
+    // Returns an id for cancel().
+    uint64_t fetchRange(const std::string& address, int port, MessageType type, const std::string& key,
+                        size_t offset, size_t length, ChunkCallback on_chunk, RangeCallback on_done,
+                        size_t stream = 0);
+    std::future<RangeResult> fetchRange(const std::string& address, int port, MessageType type,
+                                        const std::string& key, size_t offset, size_t length);
+
+    // Stops delivering the range and asks the peer to drop it; on_done still
+    // runs once, with cancelled set unless the range had already finished
+    void cancel(uint64_t request);
+
+    // For every connect made from now on without a timeout of its own
+    void setConnectTimeout(std::chrono::milliseconds timeout);
+    std::chrono::milliseconds getConnectTimeout() const { return std::chrono::milliseconds(connect_timeout_ms.load()); }
+
+    size_t getOpenConnections() const { return open_connections.load(); }
+    size_t getRequestsStarted() const { return requests_started.load(); }
+    size_t getRequestsFailed() const { return requests_failed.load(); }
+
+    // The runtime Client, the connection pool and the swarm downloader share
+    static AsyncClient& shared();
+};
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef BOUNDEDQUEUE_H
+#define BOUNDEDQUEUE_H
+
+#include "Common.h"
+#include <deque>
+
+// Blocking multi-producer/multi-consumer queue with a fixed capacity, used
+// to connect pipeline stages without letting a fast producer run away.
+// close() wakes everyone; pop() keeps draining until the queue is empty.
+template<typename T>
+class BoundedQueue {
+private:
+    std::deque<T> items;
+    size_t capacity;
+    bool closed;
+    size_t waiting_consumers;
+    size_t waiting_producers;
+    mutable std::mutex queue_mutex;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+
+public:
+    explicit BoundedQueue(size_t cap) : capacity(std::max<size_t>(cap, 1)), closed(false),
+        waiting_consumers(0), waiting_producers(0) {}
+
+    // Blocks while full; returns false if the queue was closed
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        if (!closed && items.size() >= capacity) {
+            ++waiting_producers;
+            not_full.wait(lock, [this]() { return closed || items.size() < capacity; });
+            --waiting_producers;
+        }
+        if (closed) {
+            return false;
+        }
+        items.push_back(std::move(item));
+        // Only pay for a wakeup when someone is actually asleep
+        bool wake = waiting_consumers > 0;
+        lock.unlock();
+        if (wake) {
+            not_empty.notify_one();
+        }
+        return true;
+    }
+
+    // Blocks while empty; returns false once closed and drained
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        if (!closed && items.empty()) {
+            ++waiting_consumers;
+            not_empty.wait(lock, [this]() { return closed || !items.empty(); });
+            --waiting_consumers;
+        }
+        if (items.empty()) {
+            return false;
+        }
+        item = std::move(items.front());
+        items.pop_front();
+        bool wake = waiting_producers > 0;
+        lock.unlock();
+        if (wake) {
+            not_full.notify_one();
+        }
+        return true;
+    }
+
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            closed = true;
+        }
+        not_empty.notify_all();
+        not_full.notify_all();
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        return items.size();
+    }
+};
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include "Common.h"
+
+// Recycles the buffers received chunks travel in: AsyncClient reads a
+// frame body straight into one, the verifier hashes it in place and the
+// writer hands it to pwritev, then it comes back here. In steady state a
+// download allocates nothing per chunk. Buffers are plain vectors, so one
+// that is never released is simply freed.
+class BufferPool {
+public:
+    static constexpr size_t MAX_BUFFERS = 256;
+    static constexpr size_t MIN_CAPACITY = 4 * 1024;        // Smaller ones aren't worth keeping
+    static constexpr size_t MAX_CAPACITY = 1024 * 1024;     // Nor are rare large frames
+
+private:
+    std::vector<std::vector<uint8_t>> free_buffers;
+    mutable std::mutex pool_mutex;
+    std::atomic<size_t> allocations{0};
+    std::atomic<size_t> reuses{0};
+
+public:
+    // A buffer of size bytes; contents unspecified
+    std::vector<uint8_t> acquire(size_t size);
+    void release(std::vector<uint8_t> buffer);
+
+    size_t getAllocations() const { return allocations.load(); }
+    size_t getReuses() const { return reuses.load(); }
+    size_t getPooled() const;
+
+    // The pool AsyncClient, DownloadVerifier and DownloadWriter share
+    static BufferPool& shared();
+};
+
+#endif
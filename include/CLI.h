@@ -14,12 +14,13 @@ private:
     std::unique_ptr<HighPerformanceServer> server;
     std::unique_ptr<Client> client;
     std::unique_ptr<PeerManager> peer_manager;
-    std::unique_ptr<FileManager> file_manager;
     
     bool running;
     int local_port;
     std::string shared_directory;
     
+    static constexpr const char* DOWNLOAD_DIRECTORY = "./downloads/";
+    
     // Command handlers
     void handlePeersCommand(const std::vector<std::string>& args);
     void handleFilesCommand(const std::vector<std::string>& args);
@@ -28,6 +29,8 @@ private:
     void handleConnectCommand(const std::vector<std::string>& args);
     void handleStatusCommand(const std::vector<std::string>& args);
     void handleDownloadsCommand(const std::vector<std::string>& args);
+    void handleDownloadControlCommand(const std::vector<std::string>& args);
+    void handlePriorityCommand(const std::vector<std::string>& args);
     void handleHelpCommand(const std::vector<std::string>& args);
     void handleExitCommand(const std::vector<std::string>& args);
     
@@ -38,11 +41,29 @@ private:
     void printDownloadProgress();
     void displayWelcome();
     void displayPrompt();
+    static bool isContentHash(const std::string& text);
+    static bool parsePriority(const std::string& text, DownloadPriority& priority);
+    
+    // Pick up downloads that were interrupted by the last exit
+    void resumePendingDownloads();
 
 public:
     CLI(int port = DEFAULT_PORT, const std::string& share_dir = "./shared/");
     ~CLI();
     
+    // Files at least this large are streamed without polluting the page cache
+    void setStreamingThreshold(size_t bytes);
+    
+    // Memory for hot chunks shared by all uploads
+    void setChunkCacheBudget(size_t bytes);
+    
+    // Downloads running at once, and the bandwidth they share (0 for unlimited)
+    void setMaxActiveDownloads(size_t downloads);
+    void setDownloadLimit(double bytes_per_second);
+    
+    // How long a connect to a peer may take before it counts as down
+    void setConnectTimeout(std::chrono::milliseconds timeout);
+    
     bool initialize();
     void run();
     void shutdown();
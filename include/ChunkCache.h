@@ -0,0 +1,101 @@
+#ifndef CHUNKCACHE_H
+#define CHUNKCACHE_H
+
+#include "Common.h"
+#include "FileAccess.h"
+#include <functional>
+#include <future>
+#include <list>
+#include <array>
+
+// Point-in-time copy of the chunk cache counters
+struct ChunkCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;          // Loads from disk
+    uint64_t coalesced = 0;       // Waited on a load another request started
+    uint64_t evictions = 0;
+    uint64_t bypassed = 0;        // Streaming chunks served without being cached
+    size_t bytes_cached = 0;
+    size_t entries = 0;
+
+    double hitRate() const {
+        uint64_t lookups = hits + misses + coalesced;
+        return lookups > 0 ? static_cast<double>(hits + coalesced) / lookups : 0.0;
+    }
+};
+
+// Memory-budgeted cache of fixed-size file chunks for the serving path.
+// Sharded by key so connections rarely contend on one lock; each shard is
+// an LRU with its slice of the budget. Concurrent misses on the same chunk
+// share one disk read. Chunks of streaming-size files are only admitted on
+// a second miss (tracked with a small ghost list), so one cold pass over a
+// huge file can't flush the hot set.
+class ChunkCache {
+public:
+    static constexpr size_t CHUNK_SIZE = PIECE_SIZE;
+    static constexpr size_t DEFAULT_BUDGET = 256 * 1024 * 1024;
+    static constexpr size_t SHARD_COUNT = 16;
+    static constexpr size_t GHOST_ENTRIES_PER_SHARD = 1024;
+
+    using Chunk = std::shared_ptr<const std::vector<uint8_t>>;
+    using Loader = std::function<void(std::vector<uint8_t>& data)>;
+
+    struct Key {
+        FileAccess::Identity file;
+        size_t index;
+
+        bool operator==(const Key& other) const { return index == other.index && file == other.file; }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key& key) const {
+            return FileAccess::IdentityHash()(key.file) * 31 + std::hash<size_t>()(key.index);
+        }
+    };
+
+private:
+    struct Entry {
+        Chunk chunk;
+        std::list<Key>::iterator lru_position;
+    };
+
+    struct Shard {
+        mutable std::mutex mutex;
+        std::list<Key> lru;                                            // Front is most recent
+        std::unordered_map<Key, Entry, KeyHash> entries;
+        std::unordered_map<Key, std::shared_future<Chunk>, KeyHash> inflight;
+        std::list<Key> ghosts;                                         // Recently bypassed keys
+        std::unordered_map<Key, std::list<Key>::iterator, KeyHash> ghost_index;
+        size_t bytes = 0;
+    };
+
+    std::array<Shard, SHARD_COUNT> shards;
+    std::atomic<size_t> budget;
+
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+    std::atomic<uint64_t> coalesced{0};
+    std::atomic<uint64_t> evictions{0};
+    std::atomic<uint64_t> bypassed{0};
+
+    Shard& shardFor(const Key& key);
+    void insertLocked(Shard& shard, const Key& key, const Chunk& chunk);
+    void evictLocked(Shard& shard);
+    bool takeGhostLocked(Shard& shard, const Key& key);
+    void addGhostLocked(Shard& shard, const Key& key);
+
+public:
+    explicit ChunkCache(size_t budget_bytes = DEFAULT_BUDGET);
+
+    // Chunk for key, calling loader to read it on a miss. With admit set the
+    // chunk is cached right away, otherwise only once it's missed twice.
+    Chunk getChunk(const Key& key, const Loader& loader, bool admit = true);
+
+    void setBudget(size_t budget_bytes);
+    size_t getBudget() const { return budget.load(); }
+    void clear();
+
+    ChunkCacheStats getStats() const;
+};
+
+#endif
@@ -3,21 +3,39 @@
 
 #include "Common.h"
 #include "Peer.h"
+#include "MerkleTree.h"
+#include "DownloadWriter.h"
+#include "DownloadJournal.h"
+#include "DownloadVerifier.h"
+#include "AsyncClient.h"
+#include "DownloadScheduler.h"
 
 struct DownloadProgress {
     std::string filename;
     size_t total_size;
     size_t downloaded_size;
-    double speed_mbps;
+    double speed_mbps;              // Across all sources
+    size_t active_sources;
     std::chrono::steady_clock::time_point start_time;
     std::atomic<bool> completed;
     std::atomic<bool> failed;
     std::string error_message;
 };
 
+// How one peer did as a source in a download, for PeerManager's statistics
+struct SourceReport {
+    std::string address;
+    int port;
+    size_t bytes;
+    std::chrono::microseconds busy;          // Spent delivering those bytes
+    std::chrono::microseconds rtt;           // Lowest seen, 0 if not measured
+    size_t pieces;
+    size_t failures;                         // Failed or bad requests
+};
+
 class Client {
 private:
-    int socket_fd;
+    std::shared_ptr<AsyncClient::Connection> connection;   // Driven by AsyncClient::shared()
     std::string remote_address;
     int remote_port;
     bool connected;
@@ -25,71 +43,155 @@ private:
     // Download management
     std::unordered_map<std::string, std::shared_ptr<DownloadProgress>> active_downloads;
     std::mutex downloads_mutex;
-    std::thread_pool download_pool;
+    
+    // Told how every source did once a download finishes
+    std::function<void(const SourceReport&)> source_observer;
+    void reportSource(const SourceReport& report);
     
     // Connection management
-    bool createSocket();
+    static constexpr int RECEIVE_TIMEOUT_MS = 10000;
     void closeSocket();
     
     // Protocol communication
     void sendMessage(MessageType type, const std::vector<uint8_t>& payload);
     std::vector<uint8_t> receiveMessage();
+    void sendFileRequest(MessageType type, const std::string& key, size_t offset = 0, size_t length = 0);
+    
+    // Transfers keyed by filename (FILE_REQUEST) or content hash (FILE_BY_HASH_REQUEST)
+    std::shared_ptr<DownloadProgress> trackDownload(const std::string& key, DownloadControl* control = nullptr);
+    bool downloadContent(MessageType request_type, const std::string& key,
+                         const std::string& destination_path, const std::string& expected_root,
+                         DownloadControl* control = nullptr);
+    
+    // One download across reconnects and resumes
+    struct DownloadSession {
+        MessageType request_type;
+        std::string key;
+        std::shared_ptr<const PieceLayout> layout;
+        std::unique_ptr<DownloadWriter> writer;
+        std::unique_ptr<DownloadVerifier> verifier;   // Hashes and writes off the network thread
+        DownloadJournal journal;
+        std::shared_ptr<DownloadProgress> progress;
+        DownloadControl* control = nullptr;           // Set when run from the scheduler
+        size_t resumed_pieces = 0;
+        size_t bytes_since_save = 0;
+        std::chrono::steady_clock::time_point last_update;
+    };
+    
+    // Resume support: the journal is rewritten every JOURNAL_SAVE_INTERVAL pieces received
+    static constexpr size_t JOURNAL_SAVE_INTERVAL = 64;
+    static constexpr int MAX_RESUME_ATTEMPTS = 3;
+    static constexpr int RECONNECT_DELAY_MS = 500;
+    static constexpr int THROTTLE_WAIT_MS = 10;       // Between budget checks while over it
+    void resumeFromJournal(DownloadSession& session, const std::string& destination_path);
+    void saveJournal(DownloadSession& session);
+    bool transferMissing(DownloadSession& session);
+    bool receiveRange(DownloadSession& session, size_t offset, size_t length);
+    bool reconnect(const std::string& address, int port);
+    bool abandonDownload(DownloadSession& session, const std::string& error);
+    // Paused or cancelled through the scheduler; a cancelled one leaves nothing behind
+    bool stopDownload(DownloadSession& session, const std::string& destination_path, bool cancelled);
+    bool fetchRange(MessageType type, const std::string& key, size_t offset, size_t length,
+                    std::vector<uint8_t>& data);
+    bool fetchPiece(MessageType type, const std::string& key, const PieceLayout& layout,
+                    size_t index, std::vector<uint8_t>& data);
+    
+    // Piece verification
+    static constexpr int MAX_PIECE_RETRIES = 3;
+    bool refetchPiece(MessageType request_type, const std::string& key,
+                      const PieceLayout& layout, size_t index, DownloadWriter& writer);
     
     // Multi-source download
-    void downloadFromMultipleSources(const std::string& filename, 
-                                   const std::vector<std::shared_ptr<Peer>>& sources,
-                                   const std::string& destination_path);
+    bool downloadFromMultipleSources(MessageType request_type, const std::string& key,
+                                     const std::vector<std::shared_ptr<Peer>>& sources,
+                                     const std::string& destination_path,
+                                     const std::string& expected_root, DownloadControl* control);
+    
+    // Last, so downloads it runs stop before the rest of the client goes
+    DownloadScheduler scheduler;
 
 public:
     Client();
     ~Client();
     
-    // Connection management
-    bool connect(const std::string& address, int port);
+    // Connection management; a timeout of 0 is AsyncClient's default
+    bool connect(const std::string& address, int port,
+                 std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
     void disconnect();
     bool isConnected() const { return connected; }
     
+    // Pooled connections: idle ones must have nothing to read
+    bool isHealthy() const;
+    void enableKeepAlive(int idle_seconds);
+    
     // Protocol operations
     std::vector<std::string> requestPeerList();
     std::vector<FileInfo> requestFileList(const std::string& peer_id = "");
-    bool downloadFile(const std::string& filename, const std::string& destination_path);
+    bool downloadFile(const std::string& filename, const std::string& destination_path,
+                      const std::string& expected_root = "");
+    bool downloadFileByHash(const std::string& hash, const std::string& destination_path,
+                            const std::string& expected_root = "");
+    
+    // Piece-level transfers, usable against any peer holding the same root.
+    // The layout can be requested by filename or by content hash.
+    std::shared_ptr<const PieceLayout> requestPieceLayout(const std::string& filename,
+                                                          const std::string& expected_root = "");
+    bool downloadRange(const std::string& filename, size_t offset, size_t length,
+                       std::vector<uint8_t>& data);
+    bool downloadRangeByHash(const std::string& hash, size_t offset, size_t length,
+                             std::vector<uint8_t>& data);
+    bool downloadPiece(const std::string& filename, const PieceLayout& layout,
+                       size_t index, std::vector<uint8_t>& data);
+    bool downloadPieceByHash(const std::string& hash, const PieceLayout& layout,
+                             size_t index, std::vector<uint8_t>& data);
     bool downloadFileFromPeer(const std::string& filename, 
                              const std::string& peer_address, 
                              int peer_port,
                              const std::string& destination_path);
+    bool downloadFileByHashFromPeer(const std::string& hash,
+                                    const std::string& peer_address,
+                                    int peer_port,
+                                    const std::string& destination_path,
+                                    const std::string& expected_root = "");
     
-    // Multi-source downloads
+    // Multi-source downloads: pieces are spread over all sources at once.
+    // Without piece hashes this falls back to one source at a time, in the
+    // order given, so the best ones go first. Run from the scheduler, they
+    // stop when control says so and stay within its bandwidth share.
     bool downloadFileMultiSource(const std::string& filename, 
                                 const std::vector<std::shared_ptr<Peer>>& sources,
-                                const std::string& destination_path);
+                                const std::string& destination_path,
+                                DownloadControl* control = nullptr);
+    bool downloadFileMultiSourceByHash(const std::string& hash,
+                                       const std::vector<std::shared_ptr<Peer>>& sources,
+                                       const std::string& destination_path,
+                                       const std::string& expected_root = "",
+                                       DownloadControl* control = nullptr);
+    
+    // Connects to all candidates at once and keeps the first max_sources
+    // to answer, in the order given, so stale entries in a peer list cost
+    // one connect timeout at most rather than one each
+    static std::vector<std::shared_ptr<Peer>> raceSources(const std::vector<std::shared_ptr<Peer>>& candidates,
+                                                          size_t max_sources,
+                                                          std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
+    
+    // Downloads queued to run a few at a time, by the name they were submitted under
+    DownloadScheduler& getScheduler() { return scheduler; }
+    bool pauseDownload(const std::string& name) { return scheduler.pause(name); }
+    bool resumeDownload(const std::string& name) { return scheduler.resume(name); }
+    bool cancelDownload(const std::string& name) { return scheduler.cancel(name); }
+    // The part file and journal of a download that won't be resumed
+    static void discardDownload(const std::string& destination_path);
     
     // Utility
     void sendPing();
+    bool ping();    // PING and wait for the PONG
     bool sendPong();
     
     // Progress monitoring
     std::shared_ptr<DownloadProgress> getDownloadProgress(const std::string& filename);
     std::vector<std::shared_ptr<DownloadProgress>> getAllDownloads();
-    void cancelDownload(const std::string& filename);
-};
-
-// Thread pool for concurrent downloads
-class ThreadPool {
-private:
-    std::vector<std::thread> workers;
-    std::queue<std::function<void()>> tasks;
-    std::mutex queue_mutex;
-    std::condition_variable condition;
-    bool stop;
-
-public:
-    ThreadPool(size_t threads = std::thread::hardware_concurrency());
-    ~ThreadPool();
-    
-    template<class F, class... Args>
-    auto enqueue(F&& f, Args&&... args) -> std::future<typename std::result_of<F(Args...)>::type>;
-    
-    void shutdown();
+    void setSourceObserver(std::function<void(const SourceReport&)> observer) { source_observer = std::move(observer); }
 };
 
 #endif
\ No newline at end of file
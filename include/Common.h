@@ -33,6 +33,7 @@ constexpr int DEFAULT_PORT = 8888;
 constexpr int BUFFER_SIZE = 8192;
 constexpr int MAX_CONNECTIONS = 1024;
 constexpr int MAX_EVENTS = 100;
+constexpr size_t PIECE_SIZE = 256 * 1024;  // Unit of per-piece hashing and verification
 
 // Protocol message types
 enum class MessageType : uint8_t {
@@ -45,7 +46,11 @@ enum class MessageType : uint8_t {
     FILE_COMPLETE = 7,
     ERROR_MESSAGE = 8,
     PING = 9,
-    PONG = 10
+    PONG = 10,
+    PIECE_HASHES_REQUEST = 11,
+    PIECE_HASHES_RESPONSE = 12,
+    FILE_BY_HASH_REQUEST = 13,
+    CANCEL_REQUEST = 14        // Payload: the pipelined request to drop, type byte included
 };
 
 // Error codes
@@ -0,0 +1,94 @@
+#ifndef CONNECTIONPOOL_H
+#define CONNECTIONPOOL_H
+
+#include "Common.h"
+#include "Client.h"
+
+struct ConnectionPoolStats {
+    size_t hits;             // Served from an idle connection
+    size_t misses;           // Needed a new connect
+    size_t evicted;          // Idle past the timeout or over the per-peer limit
+    size_t failed_checks;    // Closed or out of step while idle
+    size_t idle;             // Parked right now
+};
+
+// Keep-alive connections to peers, reused across operations so a small
+// request costs one round trip instead of a handshake and teardown.
+// Connections are leased to one user at a time and parked again when the
+// lease ends. Before reuse, a parked connection must have nothing to read;
+// one idle for a while must also answer a PING. Connections past the idle
+// timeout are closed.
+class ConnectionPool {
+public:
+    static constexpr size_t MAX_IDLE_PER_PEER = 4;
+    static constexpr int IDLE_TIMEOUT_SECONDS = 60;
+    static constexpr int PING_AFTER_IDLE_SECONDS = 15;
+    static constexpr int KEEPALIVE_IDLE_SECONDS = 30;
+
+    // Exclusive use of a connection. Goes back to the pool when destroyed,
+    // unless invalidated or destroyed by an exception.
+    class Lease {
+    private:
+        ConnectionPool* pool;
+        std::string key;
+        std::unique_ptr<Client> client;
+        int uncaught;
+
+    public:
+        Lease() : pool(nullptr), uncaught(0) {}
+        Lease(ConnectionPool* owner, std::string peer_key, std::unique_ptr<Client> connection);
+        ~Lease();
+
+        Lease(Lease&& other) noexcept;
+        Lease& operator=(Lease&& other) noexcept;
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+
+        explicit operator bool() const { return client != nullptr; }
+        Client* operator->() const { return client.get(); }
+        Client& operator*() const { return *client; }
+
+        // The stream is in an unknown state; close instead of parking it
+        void invalidate();
+        // Park it now
+        void release();
+    };
+
+private:
+    struct IdleConnection {
+        std::unique_ptr<Client> client;
+        std::chrono::steady_clock::time_point since;
+    };
+
+    // Keyed by "address:port", most recently parked last
+    std::unordered_map<std::string, std::vector<IdleConnection>> idle;
+    mutable std::mutex pool_mutex;
+
+    std::atomic<size_t> hits{0};
+    std::atomic<size_t> misses{0};
+    std::atomic<size_t> evicted{0};
+    std::atomic<size_t> failed_checks{0};
+
+    void park(const std::string& key, std::unique_ptr<Client> client);
+    static std::string keyFor(const std::string& address, int port);
+
+public:
+    ConnectionPool() = default;
+    ConnectionPool(const ConnectionPool&) = delete;
+    ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+    // Empty lease if the peer can't be reached
+    Lease acquire(const std::string& address, int port);
+
+    // Close parked connections past IDLE_TIMEOUT_SECONDS
+    void evictIdle();
+    void closePeer(const std::string& address, int port);
+    void clear();
+
+    ConnectionPoolStats getStats() const;
+
+    // The pool PeerManager and Client share
+    static ConnectionPool& shared();
+};
+
+#endif
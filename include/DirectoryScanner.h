@@ -0,0 +1,62 @@
+#ifndef DIRECTORYSCANNER_H
+#define DIRECTORYSCANNER_H
+
+#include "Common.h"
+#include "BoundedQueue.h"
+#include <deque>
+#include <functional>
+#include <sys/stat.h>
+
+struct ScanEntry {
+    std::string path;
+    struct stat st;
+};
+
+// Parallel tree walk for large shares. Directories are read with raw
+// getdents64 into a large buffer and each entry costs a single fstatat
+// relative to the open directory fd, instead of the several path-based
+// stats std::filesystem does per entry. Worker threads pull directories
+// from a shared queue, so wide and deep trees both spread across cores.
+// Symlinks to files are followed, symlinks to directories are not.
+class DirectoryScanner {
+public:
+    static constexpr size_t DIRENT_BUFFER_SIZE = 64 * 1024;    // Bytes per getdents64 call
+    static constexpr size_t SCAN_QUEUE_CAPACITY = 4096;        // Entries waiting for the consumer
+
+    // Called with the entry name; return false to skip the file
+    using Filter = std::function<bool(const std::string& name)>;
+
+private:
+    size_t num_threads;
+
+    // Directories waiting to be read, plus how many are being read right now
+    std::deque<std::string> pending_dirs;
+    size_t active_dirs;
+    std::mutex dirs_mutex;
+    std::condition_variable dirs_cv;
+
+    std::atomic<uint64_t> directories_scanned{0};
+    std::atomic<uint64_t> files_found{0};
+    std::atomic<uint64_t> errors{0};
+
+    void worker(BoundedQueue<ScanEntry>& out, const Filter& filter);
+    void readDirectory(const std::string& directory, BoundedQueue<ScanEntry>& out,
+                       const Filter& filter, std::vector<std::string>& subdirs);
+
+public:
+    explicit DirectoryScanner(size_t threads = 0);  // 0 = one per core
+
+    // Walk root and push every regular file into out, then close out.
+    // Blocks until the walk is done; run it on its own thread to overlap
+    // with whatever consumes the queue.
+    void scan(const std::string& root, BoundedQueue<ScanEntry>& out, const Filter& filter = nullptr);
+
+    // Convenience wrapper that collects everything
+    std::vector<ScanEntry> scanAll(const std::string& root, const Filter& filter = nullptr);
+
+    uint64_t getDirectoriesScanned() const { return directories_scanned.load(); }
+    uint64_t getFilesFound() const { return files_found.load(); }
+    uint64_t getErrors() const { return errors.load(); }
+};
+
+#endif
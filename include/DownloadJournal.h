@@ -0,0 +1,40 @@
+#ifndef DOWNLOADJOURNAL_H
+#define DOWNLOADJOURNAL_H
+
+#include "Common.h"
+
+// On-disk state of an unfinished download, kept next to its part file as
+// "<destination>.journal". Small enough to rewrite every few pieces: one
+// bit per piece plus what is needed to ask for the rest again. Pieces the
+// journal calls done are re-verified from disk before they are trusted,
+// so it never has to be synced together with the data.
+struct DownloadJournal {
+    static constexpr const char* JOURNAL_SUFFIX = ".journal";
+    static constexpr const char* FORMAT_TAG = "p2p-journal 1";
+
+    std::string destination_path;
+    std::string key;                      // Filename or content hash it was requested by
+    bool by_hash = false;
+    std::string merkle_root;              // Identifies the exact content
+    size_t file_size = 0;
+    size_t piece_size = 0;
+    std::vector<std::string> sources;     // "address:port" of peers that served it
+    std::vector<uint8_t> bitmap;          // Bit i set: piece i was written
+
+    bool hasPiece(size_t index) const;
+    void addSource(const std::string& address, int port);
+
+    std::string serialize() const;
+    static bool deserialize(const std::string& data, DownloadJournal& journal);
+
+    // Replaced atomically, a crash mid-save leaves the previous journal
+    bool save() const;
+    static bool load(const std::string& destination_path, DownloadJournal& journal);
+    static void remove(const std::string& destination_path);
+    static std::string pathFor(const std::string& destination_path);
+
+    // Unfinished downloads below directory
+    static std::vector<DownloadJournal> findAll(const std::string& directory);
+};
+
+#endif
@@ -0,0 +1,146 @@
+#ifndef DOWNLOADSCHEDULER_H
+#define DOWNLOADSCHEDULER_H
+
+#include "Common.h"
+#include <functional>
+#include <list>
+
+struct DownloadProgress;
+
+enum class DownloadPriority : uint8_t { LOW, NORMAL, HIGH };
+
+enum class DownloadState : uint8_t { QUEUED, RUNNING, PAUSED, COMPLETED, FAILED, CANCELLED };
+
+const char* toString(DownloadPriority priority);
+const char* toString(DownloadState state);
+
+// What a running download checks as it goes: whether to stop, and how many
+// bytes it may ask its sources for. The budget is a token bucket filled at
+// the download's share of the scheduler's bandwidth limit; a request may
+// overdraw it, the next one then waits until it is paid back.
+class DownloadControl {
+public:
+    static constexpr double BURST_SECONDS = 0.5;      // Budget saved up while idle
+
+private:
+    std::atomic<bool> cancelled{false};
+    std::atomic<bool> paused{false};
+
+    mutable std::mutex rate_mutex;
+    double rate = 0.0;                                // Bytes per second, 0 for unlimited
+    double tokens = 0.0;
+    std::chrono::steady_clock::time_point refilled;
+
+    std::shared_ptr<DownloadProgress> progress;       // Set once the download is tracked
+
+    void refillLocked(std::chrono::steady_clock::time_point now);
+
+public:
+    bool isCancelled() const { return cancelled.load(); }
+    bool isPaused() const { return paused.load(); }
+    // Cancelled or paused: issue nothing more, keep what is on disk
+    bool isStopping() const { return cancelled.load() || paused.load(); }
+
+    void cancel() { cancelled.store(true); }
+    void pause() { paused.store(true); }
+
+    void setRate(double bytes_per_second);
+    double getRate() const;
+
+    // False while the budget is overdrawn; consume() what was then requested
+    bool hasBudget();
+    void consume(size_t bytes);
+
+    void setProgress(std::shared_ptr<DownloadProgress> download_progress);
+    std::shared_ptr<DownloadProgress> getProgress() const;
+};
+
+// Runs a bounded number of downloads at once, DEFAULT_MAX_ACTIVE unless
+// set otherwise. Waiting ones start highest priority first, then in the
+// order they were queued. Pausing a running download stops it where it
+// is, its part file and journal kept; resuming queues it again and it
+// picks up from the journal. With a bandwidth limit set, every running
+// download gets an equal share, re-split whenever one starts or stops.
+// Worker threads start with the first download submitted.
+class DownloadScheduler {
+public:
+    static constexpr size_t DEFAULT_MAX_ACTIVE = 3;
+
+    // True once the download is complete; it should return soon after its
+    // control starts stopping
+    using Job = std::function<bool(DownloadControl& control)>;
+    // Drops what a download left on disk when it is cancelled while not running
+    using Discard = std::function<void()>;
+
+    struct DownloadInfo {
+        std::string name;
+        DownloadPriority priority;
+        DownloadState state;
+        std::shared_ptr<DownloadProgress> progress;   // nullptr until it first runs
+    };
+
+private:
+    struct Entry {
+        std::string name;
+        DownloadPriority priority;
+        DownloadState state;
+        uint64_t sequence;                            // Queue order within a priority
+        Job job;
+        Discard discard;
+        std::shared_ptr<DownloadControl> control;     // Of the current or last run
+        bool requeue = false;                         // Resumed before its pause took hold
+    };
+
+    std::list<std::shared_ptr<Entry>> entries;
+    size_t max_active;
+    size_t running;
+    double bandwidth_limit;                           // Bytes per second, 0 for unlimited
+    uint64_t next_sequence;
+    bool stopping;
+
+    std::vector<std::thread> workers;
+    mutable std::mutex scheduler_mutex;
+    std::condition_variable work_cv;
+    std::condition_variable idle_cv;
+
+    void workerLoop();
+    std::shared_ptr<Entry> nextLocked();
+    std::shared_ptr<Entry> findLocked(const std::string& name) const;
+    void rebalanceLocked();
+    void addWorkersLocked();
+
+public:
+    explicit DownloadScheduler(size_t max_active = DEFAULT_MAX_ACTIVE);
+    ~DownloadScheduler();
+
+    DownloadScheduler(const DownloadScheduler&) = delete;
+    DownloadScheduler& operator=(const DownloadScheduler&) = delete;
+
+    // False if a download by that name is already queued, running or paused
+    bool submit(const std::string& name, Job job, DownloadPriority priority = DownloadPriority::NORMAL,
+                Discard discard = nullptr);
+
+    // Each false if there is no such download or it is past that point
+    bool pause(const std::string& name);
+    bool resume(const std::string& name);
+    bool cancel(const std::string& name);
+    bool setPriority(const std::string& name, DownloadPriority priority);
+
+    // Lowering it lets running downloads finish rather than pausing them
+    void setMaxActive(size_t downloads);
+    size_t getMaxActive() const;
+    void setBandwidthLimit(double bytes_per_second);
+    double getBandwidthLimit() const;
+
+    DownloadState getState(const std::string& name) const;   // CANCELLED if unknown
+    std::vector<DownloadInfo> list() const;
+    size_t getRunning() const;
+    size_t getQueued() const;
+
+    // Until nothing is queued or running
+    void waitIdle();
+    // Stops everything running, keeping it for a resume, and ends the workers
+    void shutdown();
+};
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef DOWNLOADVERIFIER_H
+#define DOWNLOADVERIFIER_H
+
+#include "Common.h"
+#include "BoundedQueue.h"
+#include "DownloadWriter.h"
+#include "HashEngine.h"
+#include "MerkleTree.h"
+#include <functional>
+#include <map>
+
+// Pipeline stage between the socket and the part file. The network thread
+// only hands blocks over; a worker hashes each one and writes it, so a
+// download is verified the moment its last byte lands, without reading
+// the file back. Pieces are checked against the layout as they fill up,
+// in whatever order they arrive. While data arrives in order from the
+// start, the whole-file hash is computed on the side as well.
+class DownloadVerifier {
+public:
+    static constexpr size_t QUEUE_DEPTH = 64;  // Blocks in flight before the network waits
+    
+    // Told about each piece once it is checked and handed to the writer
+    using PieceCallback = std::function<void(size_t index, bool valid)>;
+
+private:
+    struct Block {
+        size_t offset = 0;
+        std::vector<uint8_t> data;
+        size_t skip = 0;                 // Bytes before the payload
+    };
+
+    // Hash state of a piece that is partly in; early holds blocks that
+    // arrived ahead of the ones before them
+    struct PieceState {
+        Sha256 ctx;
+        size_t filled = 0;
+        std::map<size_t, std::vector<uint8_t>> early;
+    };
+
+    DownloadWriter& writer;
+    std::shared_ptr<const PieceLayout> layout;
+
+    BoundedQueue<Block> queue;
+    std::thread worker_thread;
+
+    // Counters shared with the network thread
+    std::mutex state_mutex;
+    std::condition_variable drained_cv;
+    size_t pushed;
+    size_t processed;
+    std::exception_ptr error;
+    PieceCallback piece_callback;
+
+    // Worker-only state
+    std::unordered_map<size_t, PieceState> pieces;
+    std::vector<size_t> failed_pieces;
+    std::vector<std::pair<size_t, bool>> checked_pieces;
+    Sha256 file_ctx;
+    size_t file_offset;                 // Bytes hashed in order from the start
+    bool sequential;
+    std::atomic<size_t> verified_pieces{0};
+    std::atomic<size_t> bad_pieces{0};
+
+    void run();
+    void process(Block& block);
+    void hashPiece(size_t index, size_t offset_in_piece, const uint8_t* data, size_t length);
+    void feedPiece(size_t index, PieceState& state, const uint8_t* data, size_t length);
+    void checkPiece(size_t index, PieceState& state);
+    void rethrowError();
+
+public:
+    // Without a layout only the whole-file hash is available
+    DownloadVerifier(DownloadWriter& writer, std::shared_ptr<const PieceLayout> layout);
+    ~DownloadVerifier();
+
+    DownloadVerifier(const DownloadVerifier&) = delete;
+    DownloadVerifier& operator=(const DownloadVerifier&) = delete;
+
+    // Blocks while the stage is QUEUE_DEPTH behind. Rethrows a failed
+    // write from the worker as std::runtime_error. The payload starts skip
+    // bytes into data, so a received frame goes in as it is.
+    void push(size_t offset, std::vector<uint8_t> data, size_t skip = 0);
+
+    // Called on the worker thread; set to nullptr before the receiver goes away
+    void setPieceCallback(PieceCallback callback);
+    
+    // Wait until everything pushed so far is hashed and on disk
+    void drain();
+
+    // SHA-256 of the whole file, or empty if data didn't arrive in order
+    // from the first byte to the last. Drains first.
+    std::string fileHash();
+
+    size_t getVerifiedPieces() const { return verified_pieces.load(); }
+    size_t getBadPieces() const { return bad_pieces.load(); }
+};
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef DOWNLOADWRITER_H
+#define DOWNLOADWRITER_H
+
+#include "Common.h"
+#include "BufferPool.h"
+#include <sys/uio.h>
+
+// Destination of a download. Data goes to "<destination>.part", which is
+// preallocated to the full size up front so the file doesn't fragment and
+// pieces can land in any order from any number of sources. Contiguous
+// writes are coalesced and issued as one pwritev, straight from the
+// buffers they arrived in, which then go back to the BufferPool. A piece counts as
+// complete once all of its bytes are on disk; commit() syncs and renames
+// the part file over the destination, so readers never see a partial file.
+// All methods are thread-safe.
+class DownloadWriter {
+public:
+    static constexpr size_t MAX_BATCH_BUFFERS = 64;               // iovecs per pwritev
+    static constexpr size_t MAX_BATCH_BYTES = 4 * 1024 * 1024;
+    static constexpr const char* PART_SUFFIX = ".part";
+
+private:
+    std::string destination_path;
+    std::string part_path;
+    int fd;
+    size_t file_size;                  // 0 when the size isn't known in advance
+    size_t piece_size;
+
+    // One bit per piece, plus bytes written so far for pieces still filling up
+    std::vector<uint8_t> bitmap;
+    std::vector<uint32_t> piece_bytes;
+    size_t completed_pieces;
+
+    // Contiguous run of buffers waiting for the next pwritev; data starts skip bytes in
+    struct Buffer {
+        std::vector<uint8_t> data;
+        size_t skip;
+    };
+    size_t batch_offset;
+    size_t batch_bytes;
+    std::vector<Buffer> batch;
+
+    bool committed;
+    mutable std::mutex writer_mutex;
+
+    void flushLocked();
+    void pwriteAll(size_t offset, std::vector<struct iovec>& iov);
+    void accountLocked(size_t offset, size_t length);
+    void setPieceLocked(size_t index, bool complete);
+    bool pieceCompleteLocked(size_t index) const;
+
+public:
+    // Creates or reopens the part file and preallocates file_size bytes.
+    // Throws std::runtime_error if it can't be created.
+    DownloadWriter(const std::string& destination_path, size_t file_size,
+                   size_t piece_size = PIECE_SIZE);
+    ~DownloadWriter();
+
+    DownloadWriter(const DownloadWriter&) = delete;
+    DownloadWriter& operator=(const DownloadWriter&) = delete;
+
+    // Queue data for offset, its first skip bytes left out (e.g. a frame's
+    // type byte); flushed when the run breaks or grows too large. Anything
+    // past file_size is dropped.
+    void write(size_t offset, std::vector<uint8_t> data, size_t skip = 0);
+    void write(size_t offset, const uint8_t* data, size_t length);
+    void flush();
+
+    // Written straight through and marked complete, e.g. a re-fetched piece
+    void writePiece(size_t index, const uint8_t* data, size_t length);
+
+    // Forget a piece that failed verification so it gets written again
+    void invalidatePiece(size_t index);
+
+    // Resuming: a piece already in the part file that passed verification
+    void markPieceComplete(size_t index);
+    bool readPiece(size_t index, std::vector<uint8_t>& data);
+
+    bool isPieceComplete(size_t index) const;
+    size_t completedPieces() const;
+    size_t pieceCount() const;
+    bool isComplete() const;
+    std::vector<uint8_t> getBitmap() const;
+
+    // Sync and atomically move the part file into place. Fails if any piece
+    // is still missing; throws std::runtime_error if the sync or rename fails.
+    bool commit();
+
+    // Close and delete the part file
+    void discard();
+
+    size_t getFileSize() const { return file_size; }
+    size_t getPieceSize() const { return piece_size; }
+    const std::string& getPartPath() const { return part_path; }
+};
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef FDCACHE_H
+#define FDCACHE_H
+
+#include "Common.h"
+#include "FileAccess.h"
+#include <list>
+
+// Point-in-time copy of the descriptor cache counters
+struct FdCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t stale = 0;         // Reopened because the file changed on disk
+    uint64_t evictions = 0;
+    size_t open = 0;
+};
+
+// Bounded LRU of open files for the serving path, shared by all connections.
+// Handles are only read with pread or through their mapping, neither of
+// which moves a file position, so one handle serves any number of
+// concurrent requests. Every lookup is checked against a fresh stat, and
+// the file watcher drops entries as soon as a file changes or goes away so
+// deleted files don't keep their space pinned. Evicted handles stay open
+// until the last request using them finishes.
+class FdCache {
+public:
+    static constexpr size_t DEFAULT_CAPACITY = 256;
+
+    using Handle = std::shared_ptr<const FileAccess>;
+
+private:
+    struct Entry {
+        Handle file;
+        FileAccess::Mode requested;
+        std::list<std::string>::iterator lru_position;
+    };
+
+    size_t capacity;
+    std::list<std::string> lru;                        // Front is most recent
+    std::unordered_map<std::string, Entry> entries;
+    mutable std::mutex cache_mutex;
+
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+    std::atomic<uint64_t> stale{0};
+    std::atomic<uint64_t> evictions{0};
+
+    void eraseLocked(std::unordered_map<std::string, Entry>::iterator it);
+
+public:
+    explicit FdCache(size_t capacity = DEFAULT_CAPACITY);
+
+    // Open path or reuse a handle to the same, unchanged file.
+    // Throws std::runtime_error like FileAccess when the file can't be opened.
+    Handle open(const std::string& path, FileAccess::Mode mode = FileAccess::Mode::AUTO);
+
+    void invalidate(const std::string& path);
+    void invalidateUnder(const std::string& directory);
+    void clear();
+
+    void setCapacity(size_t capacity);
+    FdCacheStats getStats() const;
+};
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef FILEACCESS_H
+#define FILEACCESS_H
+
+#include "Common.h"
+#include <functional>
+#include <sys/stat.h>
+
+// Read-only access to a shared file, either through a private mmap or
+// through pread. AUTO maps regular files on local filesystems and falls
+// back to pread for small files and network/FUSE filesystems, where page
+// faults are expensive or mappings can fault with SIGBUS under us.
+//
+// Touching a mapping past the end of a file truncated since it was opened
+// raises SIGBUS too, and shared files get edited while they are read. No
+// size check beforehand closes that window, so read() and forEachBlock()
+// always use pread; the mapping serves page cache hints and residency.
+class FileAccess {
+public:
+    enum class Mode { AUTO, MMAP, PREAD };
+
+    static constexpr size_t MMAP_MIN_SIZE = 64 * 1024;              // Below this pread wins
+    static constexpr size_t HUGE_PAGE_MIN_SIZE = 32 * 1024 * 1024;  // Worth asking for THP
+    static constexpr size_t READ_BLOCK_SIZE = 1024 * 1024;          // pread block for scans
+
+    using BlockVisitor = std::function<void(const uint8_t* data, size_t length)>;
+
+    // Which file and which version of it: a rewrite changes size or mtime
+    struct Identity {
+        dev_t dev = 0;
+        ino_t ino = 0;
+        size_t size = 0;
+        int64_t mtime_ns = 0;
+
+        bool operator==(const Identity& other) const {
+            return dev == other.dev && ino == other.ino &&
+                   size == other.size && mtime_ns == other.mtime_ns;
+        }
+    };
+
+    struct IdentityHash {
+        size_t operator()(const Identity& id) const {
+            size_t h = std::hash<uint64_t>()(static_cast<uint64_t>(id.ino));
+            h ^= std::hash<uint64_t>()(static_cast<uint64_t>(id.dev)) + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+            h ^= std::hash<int64_t>()(id.mtime_ns) + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+            return h;
+        }
+    };
+
+private:
+    std::string filepath;
+    int fd;
+    size_t file_size;
+    Mode access_mode;
+    uint8_t* mapping;
+    Identity file_identity;
+
+    bool mapFile();
+    static bool isMmapFriendly(int fd);
+
+public:
+    explicit FileAccess(const std::string& path, Mode requested = Mode::AUTO);
+    ~FileAccess();
+
+    FileAccess(const FileAccess&) = delete;
+    FileAccess& operator=(const FileAccess&) = delete;
+
+    size_t size() const { return file_size; }
+    Mode mode() const { return access_mode; }
+    int getFd() const { return fd; }
+    const std::string& getPath() const { return filepath; }
+    const Identity& identity() const { return file_identity; }
+    static Identity identityOf(const struct stat& st);
+
+    // Mapped view of the whole file, nullptr in pread mode
+    const uint8_t* data() const { return mapping; }
+
+    // Copy up to length bytes at offset into buffer with pread, returns bytes copied
+    size_t read(size_t offset, size_t length, uint8_t* buffer) const;
+
+    // Visit the file front to back in READ_BLOCK_SIZE blocks
+    void forEachBlock(const BlockVisitor& visitor) const;
+
+    // Prefetch hint for a range that is about to be read
+    void willNeed(size_t offset, size_t length) const;
+
+    // Drop a range we are done with from the page cache
+    void dropCache(size_t offset, size_t length) const;
+
+    // Bytes of the range currently in the page cache (mincore)
+    size_t residentBytes(size_t offset, size_t length) const;
+};
+
+#endif
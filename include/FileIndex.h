@@ -0,0 +1,66 @@
+#ifndef FILEINDEX_H
+#define FILEINDEX_H
+
+#include "Common.h"
+
+struct PieceLayout;
+
+struct FileInfo {
+    std::string filename;
+    std::string filepath;
+    size_t size;
+    std::string hash;
+    time_t last_modified;
+    std::string merkle_root;                     // Root over the piece hashes, empty if unknown
+    std::shared_ptr<const PieceLayout> pieces;   // Local files only, shared between snapshots
+
+    FileInfo(const std::string& name, const std::string& path,
+            size_t sz, const std::string& h, time_t mod)
+        : filename(name), filepath(path), size(sz), hash(h), last_modified(mod) {}
+};
+
+// Vector of FileInfo with hash indices by filename, filepath and content hash.
+// Lookups are O(1); removal swaps the last entry into the hole, so the order
+// of entries is not preserved. Not thread-safe, owners provide locking.
+class FileIndex {
+private:
+    std::vector<FileInfo> files;
+    std::unordered_multimap<std::string, size_t> by_name;
+    std::unordered_map<std::string, size_t> by_path;      // Only entries with a filepath
+    std::unordered_multimap<std::string, size_t> by_hash;
+
+    void indexEntry(size_t pos);
+    void unindexEntry(size_t pos);
+    void removeAt(size_t pos);
+
+    static void eraseIndex(std::unordered_multimap<std::string, size_t>& index,
+                           const std::string& key, size_t pos);
+    static void moveIndex(std::unordered_multimap<std::string, size_t>& index,
+                          const std::string& key, size_t from, size_t to);
+
+public:
+    FileIndex() = default;
+    explicit FileIndex(std::vector<FileInfo> entries);
+
+    // Modification
+    void add(const FileInfo& file);
+    void upsertByName(const FileInfo& file);
+    void upsertByPath(const FileInfo& file);
+    size_t removeByName(const std::string& filename);
+    size_t removeByPath(const std::string& filepath);
+    size_t removeUnderPath(const std::string& directory);
+    void assign(std::vector<FileInfo> entries);
+    void clear();
+
+    // Lookup (nullptr when missing)
+    const FileInfo* findByName(const std::string& filename) const;
+    const FileInfo* findByPath(const std::string& filepath) const;
+    const FileInfo* findByHash(const std::string& hash) const;
+    std::vector<FileInfo> findAllByHash(const std::string& hash) const;
+
+    const std::vector<FileInfo>& entries() const { return files; }
+    size_t size() const { return files.size(); }
+    bool empty() const { return files.empty(); }
+};
+
+#endif
@@ -3,21 +3,92 @@
 
 #include "Common.h"
 #include "Peer.h"
+#include "FileWatcher.h"
+#include "FileAccess.h"
+#include "MerkleTree.h"
+#include "HashEngine.h"
+#include "ReadPolicy.h"
+#include "ChunkCache.h"
+#include "FdCache.h"
+#include "DirectoryScanner.h"
+#include <unordered_set>
+#include <sys/stat.h>
+
+// Immutable view of the shared files. A new snapshot is published on every
+// change, readers hold on to the one they loaded for as long as they need it.
+struct FileSnapshot {
+    uint64_t version = 0;
+    FileIndex files;
+};
+
+using FileSnapshotPtr = std::shared_ptr<const FileSnapshot>;
 
 class FileManager {
 private:
     std::string shared_directory;
-    std::vector<FileInfo> local_files;
-    std::mutex files_mutex;
+    
+    // Current snapshot, swapped with std::atomic_store; files_mutex only
+    // serializes writers, readers never take it
+    std::shared_ptr<const FileSnapshot> snapshot;
+    mutable std::mutex files_mutex;
+    
+    // Incremental updates from the filesystem
+    std::unique_ptr<FileWatcher> watcher;
+    
+    // Full scans: the walker feeds the HashEngine through a bounded queue,
+    // so hashing starts with the first batch and memory stays flat
+    static constexpr size_t SCAN_HASH_BATCH = 1024;                      // Files per hashFiles() call,
+    static constexpr size_t SCAN_HASH_BATCH_BYTES = 256 * 1024 * 1024;   // or fewer once this large
+    DirectoryScanner scanner;
+    HashEngine hash_engine;
+    
+    // Content hashes by inode, so unchanged files and hard links aren't
+    // read again; an entry is valid while size and mtime still match
+    struct FileIdentity {
+        dev_t dev;
+        ino_t ino;
+        bool operator==(const FileIdentity& other) const { return dev == other.dev && ino == other.ino; }
+    };
+    struct FileIdentityHash {
+        size_t operator()(const FileIdentity& id) const {
+            return std::hash<uint64_t>()(static_cast<uint64_t>(id.ino) * 31 + static_cast<uint64_t>(id.dev));
+        }
+    };
+    struct CachedHash {
+        size_t size;
+        int64_t mtime_ns;
+        std::string hash;
+        std::shared_ptr<const PieceLayout> pieces;
+    };
+    std::unordered_map<FileIdentity, CachedHash, FileIdentityHash> hash_cache;
+    mutable std::mutex hash_cache_mutex;
+    
+    // Page-cache treatment of files opened for serving
+    ReadPolicy read_policy;
+    
+    // Hot chunks and open files shared by every connection
+    ChunkCache chunk_cache;
+    FdCache fd_cache;
     
     // Helper functions
-    std::string calculateFileHash(const std::string& filepath);
+    std::string calculateFileHash(const std::string& filepath,
+                                  std::shared_ptr<const PieceLayout>* pieces = nullptr);
+    FileInfo makeFileInfo(const std::filesystem::path& path, const struct stat& st,
+                          const FileSnapshot& current);
+    bool lookupCachedHash(const struct stat& st, HashResult& result) const;
+    void storeCachedHash(const struct stat& st, const HashResult& result);
     void scanDirectory();
     bool isValidFile(const std::filesystem::path& filepath);
+    void handleWatchEvents(const std::vector<FileWatcher::Event>& events);
+    void publishSnapshot(FileIndex files);
+    void collectFileChange(const std::string& filepath, const FileSnapshot& current,
+                           std::vector<FileInfo>& updated, std::vector<std::string>& removed);
+    void applyFileChanges(const std::vector<FileInfo>& updated,
+                          const std::vector<std::string>& removed);
 
 public:
     FileManager();
-    ~FileManager() = default;
+    ~FileManager();
     
     // Directory management
     void setSharedDirectory(const std::string& directory);
@@ -25,9 +96,26 @@ public:
     
     // File operations
     void refreshFileList();
+    FileSnapshotPtr getSnapshot() const;
     std::vector<FileInfo> getFileList() const;
+    size_t getFileCount() const;
     bool hasFile(const std::string& filename) const;
     FileInfo getFileInfo(const std::string& filename) const;
+    bool hasFileWithHash(const std::string& hash) const;
+    FileInfo getFileInfoByHash(const std::string& hash) const;
+    
+    // Content-addressed view: every path holding a hash, one entry per hash
+    std::vector<FileInfo> getFilesByHash(const std::string& hash) const;
+    std::vector<FileInfo> getUniqueFiles() const;
+    
+    // Incremental updates (rehash only what changed)
+    void updateFile(const std::string& filepath);
+    void removeFile(const std::string& filepath);
+    
+    // Directory watching
+    bool startWatching();
+    void stopWatching();
+    bool isWatching() const { return watcher && watcher->isRunning(); }
     
     // Download management
     bool downloadFile(const std::string& filename, const std::string& peer_address, 
@@ -35,6 +123,14 @@ public:
     
     // Upload management
     void serveFile(int client_socket, const std::string& filename);
+    FdCache::Handle openFile(const std::string& filename);
+    FdCache::Handle openFileByHash(const std::string& hash);
+    ReadPolicy& getReadPolicy() { return read_policy; }
+    const ReadPolicy& getReadPolicy() const { return read_policy; }
+    ChunkCache& getChunkCache() { return chunk_cache; }
+    const ChunkCache& getChunkCache() const { return chunk_cache; }
+    FdCache& getFdCache() { return fd_cache; }
+    const FdCache& getFdCache() const { return fd_cache; }
     
     // Utility
     bool validateFileIntegrity(const std::string& filepath, const std::string& expected_hash);
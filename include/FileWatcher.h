@@ -0,0 +1,65 @@
+#ifndef FILEWATCHER_H
+#define FILEWATCHER_H
+
+#include "Common.h"
+#include <functional>
+
+// Watches a directory tree with inotify and reports settled file changes.
+// Files that are still being written are held back until they have been
+// closed or have stopped changing for the settle period.
+class FileWatcher {
+public:
+    enum class EventType {
+        CHANGED,   // File created, modified or moved into the tree
+        REMOVED,   // File or directory deleted or moved out of the tree
+        RESCAN     // Kernel queue overflowed, caller should rescan everything
+    };
+
+    struct Event {
+        EventType type;
+        std::string path;
+    };
+
+    using Callback = std::function<void(const std::vector<Event>&)>;
+
+    static constexpr std::chrono::milliseconds DEFAULT_SETTLE_TIME{500};
+
+private:
+    std::string root_directory;
+    Callback callback;
+    std::chrono::milliseconds settle_time;
+
+    int inotify_fd;
+    int wakeup_fd;
+    std::atomic<bool> running;
+    std::thread watch_thread;
+
+    // Watch descriptor -> directory path
+    std::unordered_map<int, std::string> watch_dirs;
+
+    // Files with pending changes -> time at which they are considered settled
+    std::unordered_map<std::string, std::chrono::steady_clock::time_point> pending_changes;
+    std::vector<Event> ready_events;
+
+    // Event loop
+    void watchLoop();
+    void processEvents();
+    void handleEvent(const struct inotify_event* event);
+    void flushSettled();
+    int nextTimeoutMs() const;
+
+    // Watch management
+    void addWatchRecursive(const std::string& directory, bool report_files);
+    void removeWatchesUnder(const std::string& directory);
+
+public:
+    FileWatcher(const std::string& directory, Callback cb,
+                std::chrono::milliseconds settle = DEFAULT_SETTLE_TIME);
+    ~FileWatcher();
+
+    bool start();
+    void stop();
+    bool isRunning() const { return running.load(); }
+};
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef HASHENGINE_H
+#define HASHENGINE_H
+
+#include "Common.h"
+#include <openssl/evp.h>
+
+struct PieceLayout;
+
+// SHA-256 through the EVP interface, which dispatches to the SHA-NI /
+// AVX2 implementations at runtime. The context is reused across reset().
+class Sha256 {
+private:
+    EVP_MD_CTX* ctx;
+
+public:
+    static constexpr size_t DIGEST_LENGTH = 32;
+
+    Sha256();
+    ~Sha256();
+
+    Sha256(const Sha256&) = delete;
+    Sha256& operator=(const Sha256&) = delete;
+
+    void reset();
+    void update(const uint8_t* data, size_t length);
+    void finish(unsigned char* digest);  // Leaves the context reset
+    std::string finishHex();
+
+    // One-shot helpers
+    static void digest(const uint8_t* data, size_t length, unsigned char* out);
+    static std::string hashHex(const uint8_t* data, size_t length);
+};
+
+struct HashResult {
+    std::string filepath;
+    std::string hash;                            // Empty on failure
+    std::shared_ptr<const PieceLayout> pieces;
+    std::string error;
+
+    bool ok() const { return !hash.empty(); }
+};
+
+// Hashes files with large page-aligned read buffers and one worker per core.
+// Small files are handed out in batches so a directory of many tiny files
+// isn't dominated by per-file scheduling; large files are handed out one at
+// a time, biggest first, so the tail of a scan isn't one thread on one file.
+class HashEngine {
+public:
+    static constexpr size_t HASH_BUFFER_SIZE = 4 * 1024 * 1024;  // Per-worker pread buffer
+    static constexpr size_t BUFFER_ALIGNMENT = 4096;
+    static constexpr size_t SMALL_FILE_SIZE = 256 * 1024;         // Batched below this
+    static constexpr size_t SMALL_FILE_BATCH = 64;
+
+private:
+    size_t num_threads;
+
+    struct AlignedBuffer {
+        uint8_t* data;
+        size_t size;
+
+        explicit AlignedBuffer(size_t sz);
+        ~AlignedBuffer();
+        AlignedBuffer(const AlignedBuffer&) = delete;
+        AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+    };
+
+    static AlignedBuffer& threadBuffer();
+    static void hashInto(const std::string& filepath, bool with_pieces, HashResult& result);
+
+public:
+    explicit HashEngine(size_t threads = 0);  // 0 = one per core
+
+    // Whole-file hash, plus the piece hashes from the same pass when asked for.
+    // Throws std::runtime_error if the file can't be read.
+    static std::string hashFile(const std::string& filepath,
+                                std::shared_ptr<const PieceLayout>* pieces = nullptr);
+
+    // Hash many files in parallel; results are in the order of filepaths
+    std::vector<HashResult> hashFiles(const std::vector<std::string>& filepaths,
+                                      bool with_pieces = true) const;
+
+    size_t threadCount() const { return num_threads; }
+};
+
+#endif
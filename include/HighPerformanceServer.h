@@ -6,27 +6,51 @@
 #include "FileManager.h"
 #include <sys/epoll.h>
 #include <unordered_map>
+#include <deque>
+
+// File range being streamed to a connection, refilled as the socket drains
+struct Transfer {
+    FdCache::Handle file;
+    std::unique_ptr<ReadPolicy::Stream> stream;
+    size_t offset;
+    size_t end;
+    std::chrono::steady_clock::time_point started;
+    std::vector<uint8_t> request;          // As received, matched by CANCEL_REQUEST
+};
 
 struct Connection {
     int socket_fd;
     std::string peer_address;
-    std::vector<uint8_t> read_buffer;
-    std::vector<uint8_t> write_buffer;
+    std::vector<uint8_t> read_buffer;      // Received bytes not yet forming a whole message
+    std::vector<uint8_t> write_buffer;     // Framed responses not yet sent
     size_t bytes_read;
-    size_t bytes_written;
+    size_t bytes_written;                  // Sent prefix of write_buffer
     std::chrono::steady_clock::time_point last_activity;
     enum State { READING_HEADER, READING_BODY, WRITING_RESPONSE } state;
     uint32_t expected_message_size;
     
+    // One transfer at a time; requests pipelined behind it wait here
+    std::unique_ptr<Transfer> transfer;
+    std::deque<std::vector<uint8_t>> pending_requests;
+    bool watching_writes;
+    
     Connection(int fd, const std::string& addr) 
         : socket_fd(fd), peer_address(addr), bytes_read(0), bytes_written(0),
           last_activity(std::chrono::steady_clock::now()), 
-          state(READING_HEADER), expected_message_size(0) {
+          state(READING_HEADER), expected_message_size(0), watching_writes(false) {
         read_buffer.resize(BUFFER_SIZE);
     }
 };
 
 class HighPerformanceServer {
+public:
+    static constexpr size_t MAX_MESSAGE_SIZE = 1024 * 1024;         // Requests are small
+    static constexpr size_t CHUNK_MESSAGE_SIZE = 64 * 1024;         // FILE_CHUNK payload
+    static constexpr size_t WRITE_HIGH_WATER = 2 * ChunkCache::CHUNK_SIZE;  // Stop refilling above this
+    static constexpr size_t WRITE_TURN_BYTES = 4 * 1024 * 1024;     // Sent per connection before the next gets a turn
+    static constexpr size_t MAX_PENDING_REQUESTS = 1024;
+    static constexpr int STALE_CONNECTION_SECONDS = 300;
+
 private:
     int server_socket;
     int epoll_fd;
@@ -35,26 +59,42 @@ private:
     
     // Connection management
     std::unordered_map<int, std::unique_ptr<Connection>> connections;
-    std::mutex connections_mutex;
+    mutable std::mutex connections_mutex;
     
     // Event processing
     std::array<epoll_event, MAX_EVENTS> events;
     std::thread event_thread;
+    std::vector<int> ready_writers;        // Still writable after using up their turn
     
     // Managers
     std::unique_ptr<PeerManager> peer_manager;
     std::unique_ptr<FileManager> file_manager;
     
+    // Statistics
+    std::atomic<size_t> bytes_transferred{0};
+    std::atomic<size_t> requests_served{0};
+    std::atomic<uint64_t> total_response_us{0};
+    
     // Core operations
     void eventLoop();
     void handleNewConnection();
     void handleClientData(int client_fd);
     void handleClientWrite(int client_fd);
     void closeConnection(int client_fd);
+    Connection* findConnection(int client_fd);
     
     // Message processing
     void processCompleteMessage(Connection* conn, const std::vector<uint8_t>& message);
+    void dispatchRequest(Connection* conn, const std::vector<uint8_t>& message);
+    void startPendingRequests(Connection* conn);
+    void cancelRequest(Connection* conn, const std::vector<uint8_t>& request);
     void queueResponse(Connection* conn, MessageType type, const std::vector<uint8_t>& payload);
+    void queueError(Connection* conn, const std::string& message);
+    void startTransfer(Connection* conn, FdCache::Handle file, size_t offset, size_t length);
+    void fillTransfer(Connection* conn);
+    bool flushWrites(Connection* conn);
+    void watchWrites(Connection* conn, bool enable);
+    void recordResponse(std::chrono::steady_clock::time_point started);
     
     // Optimization
     void configureSocket(int socket_fd);
@@ -67,10 +107,21 @@ public:
     bool start();
     void stop();
     
+    // Serving configuration
+    void setSharedDirectory(const std::string& directory);
+    void setStreamingThreshold(size_t bytes);
+    void setChunkCacheBudget(size_t bytes);
+    
+    // The served file table, for callers that list or add to it
+    FileManager& getFileManager() { return *file_manager; }
+    
     // Statistics
     size_t getActiveConnectionCount() const;
+    ReadStats getReadStats() const;
+    ChunkCacheStats getChunkCacheStats() const;
+    FdCacheStats getFdCacheStats() const;
     double getAverageResponseTime() const;
     size_t getBytesTransferred() const;
 };
 
-#endif
\ No newline at end of file
+#endif
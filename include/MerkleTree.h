@@ -0,0 +1,66 @@
+#ifndef MERKLETREE_H
+#define MERKLETREE_H
+
+#include "Common.h"
+#include "HashEngine.h"
+
+// Per-piece SHA-256 hashes of a file plus the Merkle root over them.
+// The root is advertised in file lists; the piece hashes are fetched on
+// demand and checked against it, after which every piece can be verified
+// on its own no matter which peer it came from.
+struct PieceLayout {
+    size_t piece_size = PIECE_SIZE;
+    size_t file_size = 0;
+    std::vector<std::string> piece_hashes;  // Hex SHA-256 of each piece
+    std::string root;                       // Hex Merkle root over piece_hashes
+
+    size_t pieceCount() const { return piece_hashes.size(); }
+    size_t pieceOffset(size_t index) const { return index * piece_size; }
+    size_t pieceLength(size_t index) const;
+
+    bool verifyPiece(size_t index, const uint8_t* data, size_t length) const;
+
+    // Piece count matches the file size and the hashes reproduce the root
+    bool isConsistent() const;
+
+    // Text form used on the wire: "piece_size|file_size|root" then one hash per line
+    std::string serialize() const;
+    static bool deserialize(const std::string& data, PieceLayout& layout);
+
+    static size_t pieceCountFor(size_t file_size, size_t piece_size);
+};
+
+class MerkleTree {
+public:
+    // Root over hex leaf hashes: pairs are hashed as SHA-256(left || right)
+    // over the raw digests, an odd node is carried up unchanged
+    static std::string computeRoot(const std::vector<std::string>& leaf_hashes);
+
+    static std::string hashData(const uint8_t* data, size_t length);
+    static std::string toHex(const unsigned char* digest, size_t length);
+    static bool fromHex(const std::string& hex, std::vector<unsigned char>& digest);
+};
+
+// Splits a byte stream into pieces and hashes each one, so the whole-file
+// hash and the piece hashes can be produced in a single pass over the data
+class PieceHasher {
+private:
+    size_t piece_size;
+    size_t total_size;
+    size_t piece_fill;
+    Sha256 piece_ctx;
+    std::vector<std::string> piece_hashes;
+
+    void finishPiece();
+
+public:
+    explicit PieceHasher(size_t piece_size = PIECE_SIZE);
+
+    void update(const uint8_t* data, size_t length);
+    std::shared_ptr<const PieceLayout> finish();
+
+    // Hashes of the pieces completed so far, in order
+    const std::vector<std::string>& completedHashes() const { return piece_hashes; }
+};
+
+#endif
@@ -2,26 +2,15 @@
 #define PEER_H
 
 #include "Common.h"
-
-struct FileInfo {
-    std::string filename;
-    std::string filepath;
-    size_t size;
-    std::string hash;
-    time_t last_modified;
-    
-    FileInfo(const std::string& name, const std::string& path, 
-            size_t sz, const std::string& h, time_t mod)
-        : filename(name), filepath(path), size(sz), hash(h), last_modified(mod) {}
-};
+#include "FileIndex.h"
 
 class Peer {
 private:
     std::string peer_id;
     std::string ip_address;
     int port;
-    std::vector<FileInfo> shared_files;
-    std::mutex files_mutex;
+    FileIndex shared_files;
+    mutable std::mutex files_mutex;
     std::atomic<bool> is_active;
     std::chrono::system_clock::time_point last_seen;
 
@@ -38,9 +27,13 @@ public:
     // File management
     void addFile(const FileInfo& file);
     void removeFile(const std::string& filename);
+    void setFiles(const std::vector<FileInfo>& files);
     std::vector<FileInfo> getFiles() const;
+    size_t getFileCount() const;
     bool hasFile(const std::string& filename) const;
+    bool hasFileWithHash(const std::string& hash) const;
     FileInfo getFileInfo(const std::string& filename) const;
+    FileInfo getFileInfoByHash(const std::string& hash) const;
     
     // Status management
     void setActive(bool active);
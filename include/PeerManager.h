@@ -3,13 +3,57 @@
 
 #include "Common.h"
 #include "Peer.h"
+#include "Client.h"
+#include <random>
+
+// How one peer has served us, smoothed so recent transfers weigh most.
+// Each download or heartbeat is one sample.
+class PeerStats {
+public:
+    static constexpr double ALPHA = 0.3;                   // Weight of the newest sample
+    static constexpr size_t MIN_THROUGHPUT_BYTES = 64 * 1024;  // Smaller transfers only tell the RTT
+    static constexpr double MIN_SUCCESS_RATE = 0.05;       // Keeps the cost of a failing peer finite
+
+private:
+    double throughput = 0.0;                 // Bytes per second, 0 until a transfer says
+    double rtt_ms = 0.0;
+    double failure_rate = 0.0;
+    size_t samples = 0;
+
+    static double smooth(double average, double sample, bool first);
+
+public:
+    void addTransfer(size_t bytes, std::chrono::microseconds busy, size_t requests, size_t failures);
+    void addRtt(std::chrono::microseconds rtt);
+    void addFailure();
+
+    double getThroughput() const { return throughput; }
+    double getRttMs() const { return rtt_ms; }
+    double getFailureRate() const { return failure_rate; }
+    bool isMeasured() const { return throughput > 0.0; }
+
+    // Expected seconds to fetch one piece, failed attempts included; lower is better
+    double pieceCost() const;
+};
 
 class PeerManager {
+public:
+    static constexpr int BOOTSTRAP_DELAY_SECONDS = 2;
+    static constexpr int HEARTBEAT_INTERVAL_SECONDS = 30;
+    static constexpr size_t MAX_PINGS_IN_FLIGHT = 256;     // Bounds the connects a round starts at once
+
 private:
     std::unordered_map<std::string, std::shared_ptr<Peer>> peers;
     mutable std::shared_mutex peers_mutex;
     std::thread heartbeat_thread;
     std::atomic<bool> running;
+    std::mutex heartbeat_mutex;
+    std::condition_variable heartbeat_cv;                  // Wakes the heartbeat thread to stop
+    
+    // Source statistics by address, kept across peer list refreshes
+    std::unordered_map<std::string, PeerStats> stats;
+    mutable std::mutex stats_mutex;
+    std::mt19937 probe_rng;
     
     // Bootstrap and discovery
     std::vector<std::pair<std::string, int>> bootstrap_nodes;
@@ -20,7 +64,6 @@ private:
     
     // Network discovery
     void connectToBootstrapNodes();
-    void broadcastPeerDiscovery();
     
 public:
     PeerManager();
@@ -39,8 +82,31 @@ public:
     
     // Search and discovery
     std::vector<std::shared_ptr<Peer>> findPeersWithFile(const std::string& filename) const;
+    
+    // Content-addressed discovery: any peer holding the hash is a source,
+    // whatever it calls the file
+    std::vector<std::shared_ptr<Peer>> findPeersWithHash(const std::string& hash) const;
+    std::string findHashForFile(const std::string& filename) const;
     void updatePeerFileList(const std::string& peer_id, const std::vector<FileInfo>& files);
     
+    // Source selection: active peers, cheapest expected piece first, at most
+    // max_sources of them. Now and then the last place goes to a peer that
+    // wouldn't have made the cut, unmeasured ones first, so the statistics
+    // of the others don't go stale.
+    static constexpr size_t MAX_DOWNLOAD_SOURCES = 8;
+    static constexpr size_t RACE_CANDIDATES = 2 * MAX_DOWNLOAD_SOURCES;   // Connected to at once, see Client::raceSources()
+    static constexpr double PROBE_CHANCE = 0.1;
+    std::vector<std::shared_ptr<Peer>> selectSources(const std::vector<std::shared_ptr<Peer>>& candidates,
+                                                     size_t max_sources = MAX_DOWNLOAD_SOURCES);
+    void recordTransfer(const SourceReport& report);
+    PeerStats getPeerStats(const std::string& address) const;   // "ip:port"
+    
+    // One heartbeat round: every active peer pinged at once through
+    // AsyncClient, so a round takes about as long as the slowest answer
+    // rather than the sum. Answers update each peer's RTT and last seen,
+    // misses mark it inactive. Returns how many answered.
+    size_t broadcastPeerDiscovery();
+    
     // Statistics
     size_t getActivePeerCount() const;
     size_t getTotalPeerCount() const;
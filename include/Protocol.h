@@ -2,6 +2,7 @@
 #define PROTOCOL_H
 
 #include "Common.h"
+#include "FileIndex.h"
 
 // Protocol message structure
 struct MessageHeader {
@@ -44,6 +45,12 @@ public:
     static bool parseFileChunk(const std::vector<uint8_t>& payload, std::vector<uint8_t>& chunk_data, size_t& offset);
     static bool parseErrorMessage(const std::vector<uint8_t>& payload, ErrorCode& code, std::string& message);
     
+    // FILE_REQUEST and FILE_BY_HASH_REQUEST payloads as the servers take them:
+    // "key" for the whole file, "key\0offset\0length" for a byte range, where
+    // key is a filename or content hash
+    static std::vector<uint8_t> serializeRangeRequest(const std::string& key, size_t offset = 0, size_t length = 0);
+    static bool parseRangeRequest(const std::vector<uint8_t>& payload, std::string& key, size_t& offset, size_t& length);
+    
     // Utility functions
     static uint32_t calculateCRC32(const std::vector<uint8_t>& data);
     static void serializeString(std::vector<uint8_t>& buffer, const std::string& str);
@@ -0,0 +1,80 @@
+#ifndef READPOLICY_H
+#define READPOLICY_H
+
+#include "Common.h"
+#include "FileAccess.h"
+
+// Point-in-time copy of the serving read counters
+struct ReadStats {
+    uint64_t bytes_read = 0;
+    uint64_t cache_hit_bytes = 0;     // Already in the page cache when sampled
+    uint64_t cache_miss_bytes = 0;
+    uint64_t dropped_bytes = 0;       // Released behind streaming reads
+    uint64_t streaming_requests = 0;
+    uint64_t cached_requests = 0;
+
+    double hitRate() const {
+        uint64_t sampled = cache_hit_bytes + cache_miss_bytes;
+        return sampled > 0 ? static_cast<double>(cache_hit_bytes) / sampled : 0.0;
+    }
+};
+
+// Decides how the serving path treats the page cache. Files below the
+// streaming threshold are read normally so popular small files stay hot;
+// larger ones are read sequentially and dropped from the cache right behind
+// the cursor, so a few big cold transfers can't evict everything else.
+class ReadPolicy {
+public:
+    static constexpr size_t DEFAULT_STREAMING_THRESHOLD = 64 * 1024 * 1024;
+    static constexpr size_t DROP_BEHIND_WINDOW = 8 * 1024 * 1024;
+
+    // One request's front-to-back reads over a file; not shared between threads
+    class Stream {
+    private:
+        const FileAccess& file;
+        ReadPolicy& policy;
+        bool streaming;
+        size_t end;
+        size_t drop_from;     // Start of the range read but not yet dropped
+        size_t read_to;       // Read cursor
+        size_t sampled_to;    // Residency has been sampled up to here
+
+        void sampleResidency(size_t offset);
+
+    public:
+        Stream(ReadPolicy& policy, const FileAccess& file, size_t offset, size_t length);
+        ~Stream();
+
+        Stream(const Stream&) = delete;
+        Stream& operator=(const Stream&) = delete;
+
+        size_t read(size_t offset, size_t length, uint8_t* buffer);
+        bool isStreaming() const { return streaming; }
+    };
+
+private:
+    std::atomic<size_t> streaming_threshold;
+
+    std::atomic<uint64_t> bytes_read{0};
+    std::atomic<uint64_t> cache_hit_bytes{0};
+    std::atomic<uint64_t> cache_miss_bytes{0};
+    std::atomic<uint64_t> dropped_bytes{0};
+    std::atomic<uint64_t> streaming_requests{0};
+    std::atomic<uint64_t> cached_requests{0};
+
+public:
+    explicit ReadPolicy(size_t threshold = DEFAULT_STREAMING_THRESHOLD);
+
+    void setStreamingThreshold(size_t threshold) { streaming_threshold.store(threshold); }
+    size_t getStreamingThreshold() const { return streaming_threshold.load(); }
+    bool isStreaming(size_t file_size) const { return file_size >= streaming_threshold.load(); }
+
+    // Streaming files are read with pread: a mapping would keep the pages
+    // we just dropped referenced
+    FileAccess::Mode accessMode(size_t file_size) const;
+
+    ReadStats getStats() const;
+    void resetStats();
+};
+
+#endif
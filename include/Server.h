@@ -28,7 +28,12 @@ private:
     // Message handlers
     void handlePeerListRequest(int client_socket);
     void handleFileListRequest(int client_socket, const std::string& peer_id);
-    void handleFileRequest(int client_socket, const std::string& filename);
+    void handleFileRequest(int client_socket, const std::string& filename,
+                           size_t offset = 0, size_t length = 0);
+    void handleFileByHashRequest(int client_socket, const std::string& hash,
+                                 size_t offset = 0, size_t length = 0);
+    void handlePieceHashesRequest(int client_socket, const std::string& filename);
+    void streamFile(int client_socket, const FileAccess& file, size_t offset, size_t length);
     
     // Utility
     void sendMessage(int socket, MessageType type, const std::vector<uint8_t>& payload);
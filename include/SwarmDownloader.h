@@ -0,0 +1,267 @@
+#ifndef SWARMDOWNLOADER_H
+#define SWARMDOWNLOADER_H
+
+#include "Common.h"
+#include "Client.h"
+#include "DownloadVerifier.h"
+#include "AsyncClient.h"
+#include "DownloadScheduler.h"
+#include <deque>
+
+// Hands out pieces rarest first: the fewer live sources hold a piece, the
+// sooner it is fetched, so losing a source late costs as little as possible.
+// Pieces equally rare go in file order, which keeps reads on the serving
+// side close to sequential. For the endgame, pieces already requested can
+// be handed to more sources, least duplicated and longest waiting first.
+class PiecePicker {
+public:
+    static constexpr size_t NONE = SIZE_MAX;
+    static constexpr size_t MAX_REQUESTERS = 3;    // Per piece, in the endgame
+
+private:
+    // ARRIVED: one copy is in and being verified; it still counts as in flight
+    enum class State : uint8_t { MISSING, REQUESTED, ARRIVED, DONE };
+
+    std::vector<State> states;
+    std::vector<uint32_t> availability;      // Live sources holding each piece
+    std::vector<std::vector<size_t>> requesters;   // Sources a requested piece went to
+    std::vector<std::chrono::steady_clock::time_point> requested_at;
+    std::vector<std::vector<bool>> have;     // Per source, empty when it has everything
+    std::vector<bool> source_active;
+
+    // Pieces rarest first; everything before cursor is requested or done
+    std::vector<size_t> order;
+    std::vector<size_t> rank;                // Position of each piece in order
+    size_t cursor;
+    bool order_dirty;
+
+    size_t done_count;
+    size_t requested_count;
+
+    mutable std::mutex picker_mutex;
+
+    void rebuildOrderLocked();
+    bool sourceHasLocked(size_t source, size_t piece) const;
+    void toMissingLocked(size_t piece);
+
+public:
+    explicit PiecePicker(size_t piece_count);
+
+    // Pieces the source holds, or empty for all of them; returns its id
+    size_t addSource(std::vector<bool> pieces = {});
+    // Its pieces count as less available and its requests are dropped;
+    // pieces nobody else requested go back to missing
+    void removeSource(size_t source);
+
+    // Already on disk, never handed out
+    void markDone(size_t piece);
+
+    // Rarest missing piece the source has, now requested by it; NONE if there is none
+    size_t pick(size_t source);
+    // A piece already requested elsewhere, for the source to fetch as well
+    size_t pickDuplicate(size_t source);
+    // The first copy is in; false if one already was, or the piece is done
+    bool arrived(size_t piece);
+    void complete(size_t piece);
+    // Back to missing after a failed verification; returns its first requester
+    size_t release(size_t piece);
+    // One source's request failed; missing again if nobody else has it requested
+    void release(size_t piece, size_t source);
+
+    bool isDone() const;
+    size_t remaining() const;
+    size_t inFlight() const;
+};
+
+// How many range requests to keep outstanding on one connection: enough
+// to cover its bandwidth-delay product, so the peer has the next request
+// queued before it finishes the current one and the link never idles for
+// a round trip. Bandwidth is the best recent delivery rate, delay the
+// lowest recent wait for a first byte on an otherwise idle connection.
+class RequestWindow {
+public:
+    static constexpr size_t MIN_REQUESTS = 2;
+    static constexpr size_t MAX_REQUESTS = 32;
+    static constexpr double GAIN = 1.5;                 // Headroom over the estimate
+    static constexpr size_t RATE_SAMPLES = 8;
+    static constexpr int RTT_WINDOW_SECONDS = 10;       // Older round trips expire
+
+private:
+    struct RttSample {
+        std::chrono::steady_clock::time_point taken;
+        std::chrono::microseconds rtt;
+    };
+
+    std::deque<double> rates;                 // Bytes per microsecond
+    std::deque<RttSample> round_trips;
+
+public:
+    // From a request sent while nothing else was outstanding
+    void addRttSample(std::chrono::microseconds rtt);
+    // Bytes of one response over the time the connection spent delivering it
+    void addDeliverySample(size_t bytes, std::chrono::microseconds elapsed);
+
+    double bandwidth() const;                 // Bytes per second, 0 before any sample
+    std::chrono::microseconds rtt() const;    // 0 before any sample
+
+    // Requests of request_bytes each to keep in flight
+    size_t limit(size_t request_bytes) const;
+};
+
+// Fetches one file from several peers at once. Every source is driven
+// from the thread calling run() through AsyncClient: each keeps its
+// RequestWindow of piece requests in flight and asks the picker for more
+// as they land, so fast sources simply come back for more. Received
+// pieces go through the verifier; a piece that fails a fetch or its hash
+// returns to the picker for any source to take. Sources that keep
+// failing, or that run far slower than the best one, are dropped and
+// their share moves to the others.
+//
+// Once ENDGAME_PIECES or fewer remain and a source has nothing new to
+// fetch, it asks for pieces still in flight elsewhere. The first copy of
+// a piece to arrive wins and the other requests for it are cancelled, so
+// the last pieces don't wait on the slowest source.
+//
+// A single TCP stream can be held back by its window long before the path
+// is full, and often only one or two peers hold a file. So each source
+// starts on one connection and is given another, up to MAX_STRIPES, for as
+// long as the last one added raised its throughput by STRIPE_GAIN; each
+// connection keeps its own request window. The serving side reads all of
+// them through the same open file and cached chunks.
+//
+// Under a DownloadControl, run() stops issuing once it is paused or
+// cancelled, and requests pieces only as fast as its bandwidth budget allows.
+class SwarmDownloader {
+public:
+    static constexpr int MAX_SOURCE_FAILURES = 3;
+    static constexpr size_t MIN_PIECES_FOR_RATE = 4;    // Before a source is judged slow
+    static constexpr double SLOW_SOURCE_FACTOR = 4.0;   // Dropped below best rate / this
+    static constexpr int PROGRESS_INTERVAL_MS = 1000;
+    static constexpr size_t ENDGAME_PIECES = 16;
+    static constexpr int THROTTLE_WAIT_MS = 10;         // Between budget checks while over it
+    static constexpr size_t MAX_STRIPES = 8;            // Connections per source
+    static constexpr size_t STRIPE_PROBE_PIECES = 4;    // Per connection, before a stripe count is judged
+    static constexpr double STRIPE_GAIN = 1.2;          // Needed from one more connection to keep it
+
+    using Checkpoint = std::function<void()>;
+
+private:
+    // One connection to a source, on its own AsyncClient stream
+    struct Stripe {
+        RequestWindow window;
+        size_t in_flight = 0;
+        std::chrono::steady_clock::time_point last_finished;   // Previous response done
+    };
+
+    struct Source {
+        std::string address;
+        int port;
+        size_t picker_id;
+        std::vector<Stripe> stripes;         // Index is the stream
+        size_t stripe_count = 1;             // In use; any past it only drain
+        size_t in_flight = 0;                // Across stripes
+        std::chrono::steady_clock::time_point last_finished;   // On any stripe
+        std::chrono::steady_clock::time_point last_failure;
+
+        // Throughput with the current stripes, against that before the last was added
+        bool stripes_settled = false;
+        double rate_before = 0.0;
+        size_t probe_bytes = 0;
+        size_t probe_pieces = 0;
+        std::chrono::steady_clock::time_point probe_started;
+
+        std::atomic<bool> active{false};
+        std::atomic<int> failures{0};
+        std::atomic<size_t> pieces{0};
+        std::atomic<size_t> bytes{0};
+        std::atomic<uint64_t> busy_us{0};    // Time spent delivering its pieces
+    };
+
+    MessageType request_type;
+    std::string key;
+    std::shared_ptr<const PieceLayout> layout;
+    DownloadWriter& writer;
+    DownloadVerifier& verifier;
+    std::shared_ptr<DownloadProgress> progress;
+    DownloadControl* control = nullptr;
+
+    PiecePicker picker;
+    std::vector<std::unique_ptr<Source>> sources;
+    std::atomic<size_t> active_sources{0};
+    std::atomic<size_t> bytes_received{0};
+    std::mutex progress_mutex;
+
+    // Endgame: requests out per piece, so duplicates can be cancelled
+    bool endgame_enabled = true;
+    bool striping_enabled = true;
+    std::unordered_map<size_t, std::vector<std::pair<Source*, uint64_t>>> piece_requests;
+    std::vector<size_t> delivered_by;        // Source whose copy went to the verifier
+    size_t duplicate_requests = 0;
+    size_t cancelled_requests = 0;
+    size_t wasted_bytes = 0;                 // Received for pieces already in
+    std::chrono::steady_clock::time_point tail_started;
+    double tail_ms = 0.0;
+
+    // Finished fetches and verifier results, handed to the run() thread.
+    // Fetch callbacks hold their own reference, so cancelled copies still
+    // draining from a slow peer don't keep run() from returning.
+    struct Fetched {
+        Source* source;                      // Only followed while run() is going
+        size_t stripe;
+        size_t index;
+        std::chrono::steady_clock::time_point issued;
+        bool idle_at_issue;                  // Nothing else outstanding: a clean round trip
+        AsyncClient::RangeResult result;
+    };
+    struct Events {
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::deque<Fetched> fetched;
+        bool pieces_changed = false;
+    };
+    std::shared_ptr<Events> events;
+
+    void requestPiece(Source& source, size_t stripe, size_t index);
+    void onFetched(Fetched& done);
+    void adjustStripes(Source& source, size_t bytes, std::chrono::steady_clock::time_point finished);
+    bool isSlow(const Source& source) const;
+    void retire(Source& source, const std::string& reason);
+    void onPieceChecked(size_t index, bool valid);
+
+public:
+    SwarmDownloader(MessageType request_type, const std::string& key,
+                    std::shared_ptr<const PieceLayout> layout, DownloadWriter& writer,
+                    DownloadVerifier& verifier, std::shared_ptr<DownloadProgress> progress);
+    ~SwarmDownloader();
+
+    SwarmDownloader(const SwarmDownloader&) = delete;
+    SwarmDownloader& operator=(const SwarmDownloader&) = delete;
+
+    void addSource(const std::string& address, int port);
+
+    // Fetches every piece the writer doesn't have yet. checkpoint runs on
+    // the calling thread after every checkpoint_interval verified pieces.
+    // True once every piece is verified and handed to the writer.
+    bool run(size_t checkpoint_interval = 0, const Checkpoint& checkpoint = nullptr);
+
+    size_t getSourceCount() const { return sources.size(); }
+    size_t getActiveSources() const { return active_sources.load(); }
+    size_t getBytesReceived() const { return bytes_received.load(); }
+    size_t getPiecesFrom(size_t source) const { return sources[source]->pieces.load(); }
+    size_t getStripes(size_t source) const { return sources[source]->stripe_count; }
+    SourceReport getSourceReport(size_t source) const;
+
+    // Checked for stopping and bandwidth budget; must outlive run()
+    void setControl(DownloadControl* download_control) { control = download_control; }
+
+    // On by default; off only to measure what it buys
+    void setEndgame(bool enabled) { endgame_enabled = enabled; }
+    void setStriping(bool enabled) { striping_enabled = enabled; }
+    size_t getDuplicateRequests() const { return duplicate_requests; }
+    size_t getCancelledRequests() const { return cancelled_requests; }
+    size_t getWastedBytes() const { return wasted_bytes; }
+    // From ENDGAME_PIECES left to done, endgame or not; 0 if never reached
+    double getTailMs() const { return tail_ms; }
+};
+
+#endif
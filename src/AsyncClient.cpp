@@ -0,0 +1,901 @@
+#include "AsyncClient.h"
+#include "Protocol.h"
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <netinet/tcp.h>
+#include <climits>
+#include <cstring>
+
+// What a shared connection owes its callers, in request order
+struct AsyncClient::PendingRequest {
+    uint64_t id = 0;
+    Message request;                  // As sent, for CANCEL_REQUEST
+    bool cancelled = false;
+
+    virtual ~PendingRequest() = default;
+    // True once the response is complete
+    virtual bool onMessage(Message& message) = 0;
+    virtual void fail(const std::string& error) = 0;
+};
+
+namespace {
+
+class ResponseRequest : public AsyncClient::PendingRequest {
+private:
+    AsyncClient::ResponseCallback on_done;
+
+public:
+    explicit ResponseRequest(AsyncClient::ResponseCallback callback) : on_done(std::move(callback)) {}
+
+    bool onMessage(AsyncClient::Message& message) override {
+        on_done("", std::move(message));
+        return true;
+    }
+
+    void fail(const std::string& error) override {
+        on_done(error, {});
+    }
+};
+
+// FILE_CHUNKs until FILE_COMPLETE or ERROR_MESSAGE
+class RangeRequest : public AsyncClient::PendingRequest {
+private:
+    size_t offset;
+    size_t length;
+    AsyncClient::ChunkCallback on_chunk;
+    AsyncClient::RangeCallback on_done;
+    AsyncClient::RangeResult result;
+
+public:
+    RangeRequest(size_t range_offset, size_t range_length, AsyncClient::ChunkCallback chunk_callback,
+                 AsyncClient::RangeCallback done_callback)
+        : offset(range_offset), length(range_length), on_chunk(std::move(chunk_callback)),
+          on_done(std::move(done_callback)) {
+        if (!on_chunk) {
+            // Usually a piece, on its way to the verifier and the writer, which recycles it
+            result.data = BufferPool::shared().acquire(length);
+            result.data.clear();
+        }
+    }
+
+    bool onMessage(AsyncClient::Message& message) override {
+        switch (static_cast<MessageType>(message[0])) {
+            case MessageType::FILE_CHUNK: {
+                if (result.bytes == 0) {
+                    result.first_byte = std::chrono::steady_clock::now();
+                }
+
+                // Anything past the requested length is dropped; the range fails at FILE_COMPLETE
+                size_t size = message.size() - 1;
+                if (length > 0) {
+                    size = std::min(size, length - std::min(length, result.bytes));
+                }
+                if (cancelled) {
+                    // Drained and dropped
+                } else if (on_chunk) {
+                    if (size > 0) {
+                        on_chunk(offset + result.bytes, message.data() + 1, size);
+                    }
+                } else {
+                    result.data.insert(result.data.end(), message.begin() + 1, message.begin() + 1 + size);
+                }
+                result.bytes += message.size() - 1;
+                return false;
+            }
+
+            case MessageType::FILE_COMPLETE:
+                result.ok = length == 0 || result.bytes == length;
+                if (!result.ok) {
+                    result.error = "Range returned " + std::to_string(result.bytes) + " of " +
+                                   std::to_string(length) + " bytes";
+                }
+                break;
+
+            case MessageType::ERROR_MESSAGE:
+                result.error = std::string(message.begin() + 1, message.end());
+                break;
+
+            default:
+                result.error = "Unexpected message in range response";
+                break;
+        }
+
+        finish();
+        return true;
+    }
+
+    void fail(const std::string& error) override {
+        result.ok = false;
+        result.error = error;
+        finish();
+    }
+
+private:
+    void finish() {
+        if (cancelled) {
+            result.ok = false;
+            result.cancelled = true;
+            result.error = "Cancelled";
+            result.data.clear();
+        }
+        result.finished = std::chrono::steady_clock::now();
+        if (result.bytes == 0) {
+            result.first_byte = result.finished;
+        }
+        on_done(std::move(result));
+    }
+};
+
+}
+
+AsyncClient::Connection::Connection(AsyncClient& owner, const std::string& peer_address, int peer_port,
+                                    bool is_shared)
+    : engine(owner), address(peer_address), port(peer_port), shared(is_shared), stream(0), id(0), fd(-1),
+      connecting(false), closed(false), reading(true), interest(0), read_bytes(0), body_filled(0), write_offset(0),
+      inbox_bytes(0), paused(false), open(false) {}
+
+void AsyncClient::Connection::send(MessageType type, const std::vector<uint8_t>& payload) {
+    auto self = shared_from_this();
+    engine.post([self, message = AsyncClient::frame(type, payload)]() mutable {
+        self->engine.queueFrame(self, std::move(message));
+    });
+}
+
+bool AsyncClient::Connection::receive(Message& message, std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(inbox_mutex);
+    inbox_cv.wait_for(lock, timeout, [this]() { return !inbox.empty() || !open.load(); });
+    if (inbox.empty()) {
+        return false;
+    }
+
+    message = std::move(inbox.front());
+    inbox.pop_front();
+    inbox_bytes -= message.size();
+
+    bool resume = paused && inbox_bytes <= INBOX_HIGH_WATER / 2;
+    if (resume) {
+        paused = false;
+    }
+    lock.unlock();
+
+    if (resume) {
+        auto self = shared_from_this();
+        engine.post([self]() { self->engine.resumeReading(self); });
+    }
+    return true;
+}
+
+bool AsyncClient::Connection::hasPendingInput() const {
+    std::lock_guard<std::mutex> lock(inbox_mutex);
+    return !inbox.empty();
+}
+
+void AsyncClient::Connection::close() {
+    {
+        std::lock_guard<std::mutex> lock(inbox_mutex);
+        open.store(false);
+    }
+    inbox_cv.notify_all();
+
+    // A stopped engine closes whatever is left itself
+    if (!engine.running) {
+        return;
+    }
+    auto self = shared_from_this();
+    engine.post([self]() { self->engine.closeConnection(self, "Closed"); });
+}
+
+AsyncClient::AsyncClient() : epoll_fd(-1), wake_fd(-1), running(false), next_id(1),
+                             last_sweep(std::chrono::steady_clock::now()) {
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_fd < 0 || wake_fd < 0) {
+        throw std::runtime_error("Failed to create client event loop");
+    }
+
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.u64 = 0;  // Connection ids start at 1
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event);
+
+    running = true;
+    event_thread = std::thread(&AsyncClient::eventLoop, this);
+}
+
+AsyncClient::~AsyncClient() {
+    running = false;
+    uint64_t one = 1;
+    ssize_t written = write(wake_fd, &one, sizeof(one));
+    (void)written;
+    if (event_thread.joinable()) {
+        event_thread.join();
+    }
+
+    // Nobody is left to wait on these
+    std::vector<std::shared_ptr<Connection>> remaining;
+    for (auto& [id, conn] : connections) {
+        remaining.push_back(conn);
+    }
+    for (auto& conn : remaining) {
+        closeConnection(conn, "Client shutting down");
+    }
+
+    close(wake_fd);
+    close(epoll_fd);
+}
+
+void AsyncClient::post(std::function<void()> command) {
+    {
+        std::lock_guard<std::mutex> lock(command_mutex);
+        commands.push_back(std::move(command));
+    }
+    uint64_t one = 1;
+    ssize_t written = write(wake_fd, &one, sizeof(one));
+    (void)written;
+}
+
+void AsyncClient::runCommands() {
+    std::vector<std::function<void()>> batch;
+    {
+        std::lock_guard<std::mutex> lock(command_mutex);
+        batch.swap(commands);
+    }
+    for (auto& command : batch) {
+        command();
+    }
+}
+
+void AsyncClient::eventLoop() {
+    struct epoll_event events[MAX_EVENTS];
+
+    while (running) {
+        int count = epoll_wait(epoll_fd, events, MAX_EVENTS, TICK_MS);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "Client event loop failed: " << strerror(errno) << std::endl;
+            break;
+        }
+
+        for (int i = 0; i < count; ++i) {
+            if (events[i].data.u64 == 0) {
+                uint64_t value;
+                ssize_t drained = read(wake_fd, &value, sizeof(value));
+                (void)drained;
+                runCommands();
+                continue;
+            }
+
+            auto it = connections.find(events[i].data.u64);
+            if (it == connections.end()) {
+                continue;  // Closed earlier in this batch
+            }
+            auto conn = it->second;
+            uint32_t flags = events[i].events;
+
+            if (conn->connecting) {
+                finishConnect(conn);
+                continue;
+            }
+            if (flags & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                if (!conn->reading && (flags & (EPOLLHUP | EPOLLERR))) {
+                    closeConnection(conn, "Connection reset");  // Reported even while paused
+                    continue;
+                }
+                handleRead(conn);
+            }
+            if (!conn->closed && (flags & EPOLLOUT)) {
+                handleWrite(conn);
+            }
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_sweep >= std::chrono::milliseconds(TICK_MS)) {
+            last_sweep = now;
+            checkTimeouts();
+        }
+    }
+}
+
+std::vector<uint8_t> AsyncClient::frame(MessageType type, const std::vector<uint8_t>& payload) {
+    uint32_t length = htonl(static_cast<uint32_t>(payload.size() + 1));
+    std::vector<uint8_t> message(sizeof(length) + 1 + payload.size());
+    memcpy(message.data(), &length, sizeof(length));
+    message[sizeof(length)] = static_cast<uint8_t>(type);
+    if (!payload.empty()) {
+        memcpy(message.data() + sizeof(length) + 1, payload.data(), payload.size());
+    }
+    return message;
+}
+
+std::chrono::milliseconds AsyncClient::connectTimeout(std::chrono::milliseconds timeout) const {
+    return timeout.count() > 0 ? timeout : getConnectTimeout();
+}
+
+void AsyncClient::setConnectTimeout(std::chrono::milliseconds timeout) {
+    connect_timeout_ms.store(timeout.count() > 0 ? static_cast<int>(timeout.count()) : CONNECT_TIMEOUT_MS);
+}
+
+void AsyncClient::startConnect(const std::shared_ptr<Connection>& conn, std::chrono::milliseconds timeout) {
+    conn->id = next_id++;
+    conn->connecting = true;
+    conn->connect_deadline = std::chrono::steady_clock::now() + connectTimeout(timeout);
+    connections[conn->id] = conn;
+
+    struct sockaddr_in server_addr = {};
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(conn->port);
+    if (inet_pton(AF_INET, conn->address.c_str(), &server_addr.sin_addr) <= 0) {
+        closeConnection(conn, "Invalid address: " + conn->address);
+        return;
+    }
+
+    conn->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (conn->fd < 0) {
+        closeConnection(conn, "Failed to create socket");
+        return;
+    }
+    ++open_connections;
+
+    // Frames are already whole when written
+    int nodelay = 1;
+    setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+    if (::connect(conn->fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0 && errno != EINPROGRESS) {
+        closeConnection(conn, std::string("Failed to connect: ") + strerror(errno));
+        return;
+    }
+
+    // Writable once the handshake is done, either way
+    struct epoll_event event = {};
+    event.events = EPOLLOUT;
+    event.data.u64 = conn->id;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, conn->fd, &event);
+    conn->interest = EPOLLOUT;
+}
+
+void AsyncClient::finishConnect(const std::shared_ptr<Connection>& conn) {
+    int error = 0;
+    socklen_t length = sizeof(error);
+    getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &error, &length);
+    if (error != 0) {
+        closeConnection(conn, std::string("Failed to connect: ") + strerror(error));
+        return;
+    }
+
+    conn->connecting = false;
+    conn->last_activity = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lock(conn->inbox_mutex);
+        conn->open.store(true);
+    }
+
+    auto waiters = std::move(conn->connect_waiters);
+    conn->connect_waiters.clear();
+    for (auto& waiter : waiters) {
+        waiter(true);
+    }
+
+    updateInterest(*conn);
+    if (!conn->write_queue.empty()) {
+        handleWrite(conn);
+    }
+}
+
+std::string AsyncClient::peerKey(const std::string& address, int port, size_t stream) {
+    std::string key = address + ":" + std::to_string(port);
+    return stream == 0 ? key : key + "#" + std::to_string(stream);
+}
+
+std::shared_ptr<AsyncClient::Connection> AsyncClient::peerConnection(const std::string& address, int port,
+                                                                     size_t stream, std::chrono::milliseconds timeout) {
+    std::string key = peerKey(address, port, stream);
+    auto it = peer_connections.find(key);
+    if (it != peer_connections.end() && !it->second->closed) {
+        return it->second;
+    }
+
+    auto conn = std::make_shared<Connection>(*this, address, port, true);
+    conn->stream = stream;
+    peer_connections[key] = conn;
+    startConnect(conn, timeout);
+    return conn;
+}
+
+void AsyncClient::enqueue(const std::string& address, int port, std::unique_ptr<PendingRequest> request,
+                          MessageType type, const std::vector<uint8_t>& payload, size_t stream) {
+    request->request.reserve(payload.size() + 1);
+    request->request.push_back(static_cast<uint8_t>(type));
+    request->request.insert(request->request.end(), payload.begin(), payload.end());
+
+    auto conn = peerConnection(address, port, stream);
+    if (conn->closed) {
+        ++requests_failed;
+        request->fail(conn->error);
+        return;
+    }
+
+    // The timeout runs from the last byte received, or from now on an idle connection
+    if (conn->requests.empty()) {
+        conn->last_activity = std::chrono::steady_clock::now();
+    }
+    conn->requests.push_back(std::move(request));
+    queueFrame(conn, frame(type, payload));
+}
+
+void AsyncClient::queueFrame(const std::shared_ptr<Connection>& conn, std::vector<uint8_t> message) {
+    if (conn->closed) {
+        return;
+    }
+    conn->write_queue.push_back(std::move(message));
+    if (!conn->connecting) {
+        handleWrite(conn);
+    }
+}
+
+void AsyncClient::handleRead(const std::shared_ptr<Connection>& conn) {
+    size_t burst = 0;
+
+    while (conn->reading && burst < READ_BURST) {
+        // The rest of a large frame goes straight into its buffer
+        bool in_body = !conn->body.empty();
+        uint8_t* target;
+        size_t room;
+        if (in_body) {
+            target = conn->body.data() + conn->body_filled;
+            room = conn->body.size() - conn->body_filled;
+        } else {
+            // Headers and small frames, or the small frame already announced
+            size_t wanted = conn->read_bytes + READ_AHEAD;
+            if (conn->read_bytes >= sizeof(uint32_t)) {
+                uint32_t length;
+                memcpy(&length, conn->read_buffer.data(), sizeof(length));
+                wanted = std::max(wanted, sizeof(length) + ntohl(length));
+            }
+            if (conn->read_buffer.size() < wanted) {
+                conn->read_buffer.resize(std::min(wanted, sizeof(uint32_t) + MAX_MESSAGE_SIZE));
+            }
+            target = conn->read_buffer.data() + conn->read_bytes;
+            room = conn->read_buffer.size() - conn->read_bytes;
+        }
+
+        ssize_t received = recv(conn->fd, target, room, 0);
+        if (received == 0) {
+            closeConnection(conn, "Connection closed by peer");
+            return;
+        }
+        if (received < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                closeConnection(conn, std::string("Receive failed: ") + strerror(errno));
+            }
+            return;
+        }
+
+        burst += received;
+        conn->last_activity = std::chrono::steady_clock::now();
+
+        if (in_body) {
+            conn->body_filled += received;
+            if (conn->body_filled == conn->body.size()) {
+                Message message = std::move(conn->body);
+                conn->body.clear();
+                conn->body_filled = 0;
+                deliver(conn, std::move(message));
+                if (conn->closed) {
+                    return;
+                }
+            }
+            continue;
+        }
+        conn->read_bytes += received;
+
+        // Whole frames out, the partial one moves to the front
+        size_t position = 0;
+        while (conn->read_bytes - position >= sizeof(uint32_t)) {
+            uint32_t length;
+            memcpy(&length, conn->read_buffer.data() + position, sizeof(length));
+            length = ntohl(length);
+            if (length == 0 || length > MAX_MESSAGE_SIZE) {
+                closeConnection(conn, "Message too large");
+                return;
+            }
+            if (conn->read_bytes - position - sizeof(length) < length) {
+                break;
+            }
+
+            auto start = conn->read_buffer.begin() + position + sizeof(length);
+            Message message(start, start + length);
+            position += sizeof(length) + length;
+
+            deliver(conn, std::move(message));
+            if (conn->closed) {
+                return;
+            }
+        }
+
+        // A large frame under way moves to a buffer of its own for the rest
+        if (conn->read_bytes - position >= sizeof(uint32_t)) {
+            uint32_t length;
+            memcpy(&length, conn->read_buffer.data() + position, sizeof(length));
+            length = ntohl(length);
+            if (length >= DIRECT_FRAME_MIN) {
+                size_t have = conn->read_bytes - position - sizeof(length);
+                conn->body = BufferPool::shared().acquire(length);
+                memcpy(conn->body.data(), conn->read_buffer.data() + position + sizeof(length), have);
+                conn->body_filled = have;
+                position = conn->read_bytes;
+            }
+        }
+        if (position > 0) {
+            memmove(conn->read_buffer.data(), conn->read_buffer.data() + position, conn->read_bytes - position);
+            conn->read_bytes -= position;
+        }
+    }
+}
+
+void AsyncClient::deliver(const std::shared_ptr<Connection>& conn, Message message) {
+    if (!conn->requests.empty()) {
+        bool finished = false;
+        try {
+            finished = conn->requests.front()->onMessage(message);
+        } catch (const std::exception& e) {
+            std::cerr << "Request callback failed: " << e.what() << std::endl;
+            finished = true;
+        }
+        if (finished) {
+            conn->requests.pop_front();
+        }
+        BufferPool::shared().release(std::move(message));  // Unless the request kept it
+        return;
+    }
+
+    if (conn->shared) {
+        BufferPool::shared().release(std::move(message));  // Nobody asked; nothing to do with it
+        return;
+    }
+
+    size_t size = message.size();
+    bool pause;
+    {
+        std::lock_guard<std::mutex> lock(conn->inbox_mutex);
+        conn->inbox.push_back(std::move(message));
+        conn->inbox_bytes += size;
+        pause = conn->inbox_bytes > INBOX_HIGH_WATER;
+        conn->paused = conn->paused || pause;
+    }
+    conn->inbox_cv.notify_one();
+
+    // The reader is behind; the socket buffer fills and the peer backs off
+    if (pause) {
+        conn->reading = false;
+        updateInterest(*conn);
+    }
+}
+
+void AsyncClient::resumeReading(const std::shared_ptr<Connection>& conn) {
+    if (conn->closed || conn->reading) {
+        return;
+    }
+    conn->reading = true;
+    updateInterest(*conn);
+}
+
+void AsyncClient::handleWrite(const std::shared_ptr<Connection>& conn) {
+    while (!conn->write_queue.empty()) {
+        struct iovec iov[IOV_MAX];
+        int count = 0;
+        for (auto it = conn->write_queue.begin(); it != conn->write_queue.end() && count < IOV_MAX; ++it) {
+            size_t skip = count == 0 ? conn->write_offset : 0;
+            iov[count].iov_base = it->data() + skip;
+            iov[count].iov_len = it->size() - skip;
+            ++count;
+        }
+
+        ssize_t written = writev(conn->fd, iov, count);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                closeConnection(conn, std::string("Send failed: ") + strerror(errno));
+                return;
+            }
+            break;
+        }
+
+        size_t remaining = written;
+        while (remaining > 0) {
+            size_t left = conn->write_queue.front().size() - conn->write_offset;
+            if (remaining < left) {
+                conn->write_offset += remaining;
+                break;
+            }
+            remaining -= left;
+            conn->write_queue.pop_front();
+            conn->write_offset = 0;
+        }
+    }
+    updateInterest(*conn);
+}
+
+void AsyncClient::updateInterest(Connection& conn) {
+    if (conn.fd < 0 || conn.closed) {
+        return;
+    }
+
+    uint32_t wanted = (conn.reading ? static_cast<uint32_t>(EPOLLIN) : 0u) |
+                      (conn.connecting || !conn.write_queue.empty() ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+    if (wanted == conn.interest) {
+        return;
+    }
+
+    struct epoll_event event = {};
+    event.events = wanted;
+    event.data.u64 = conn.id;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn.fd, &event);
+    conn.interest = wanted;
+}
+
+void AsyncClient::closeConnection(const std::shared_ptr<Connection>& conn, const std::string& error) {
+    if (conn->closed) {
+        return;
+    }
+    conn->closed = true;
+    conn->error = error;
+
+    if (conn->fd >= 0) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, nullptr);
+        close(conn->fd);
+        --open_connections;
+    }
+    connections.erase(conn->id);
+    if (conn->shared) {
+        auto it = peer_connections.find(peerKey(conn->address, conn->port, conn->stream));
+        if (it != peer_connections.end() && it->second == conn) {
+            peer_connections.erase(it);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(conn->inbox_mutex);
+        conn->open.store(false);
+    }
+    conn->inbox_cv.notify_all();
+    conn->write_queue.clear();
+
+    // Callbacks may post more work; nothing here is touched after they run
+    auto requests = std::move(conn->requests);
+    auto waiters = std::move(conn->connect_waiters);
+    conn->requests.clear();
+    conn->connect_waiters.clear();
+
+    requests_failed += requests.size();
+    for (auto& request : requests) {
+        request->fail(error);
+    }
+    for (auto& waiter : waiters) {
+        waiter(false);
+    }
+}
+
+void AsyncClient::checkTimeouts() {
+    auto now = std::chrono::steady_clock::now();
+    std::vector<std::pair<std::shared_ptr<Connection>, std::string>> expired;
+
+    for (auto& [id, conn] : connections) {
+        if (conn->connecting) {
+            if (now > conn->connect_deadline) {
+                expired.emplace_back(conn, "Connect timed out");
+            }
+        } else if (!conn->requests.empty()) {
+            if (now - conn->last_activity > std::chrono::milliseconds(REQUEST_TIMEOUT_MS)) {
+                expired.emplace_back(conn, "Request timed out");
+            }
+        } else if (conn->shared && now - conn->last_activity > std::chrono::seconds(IDLE_TIMEOUT_SECONDS)) {
+            expired.emplace_back(conn, "Idle");
+        }
+    }
+
+    for (auto& [conn, error] : expired) {
+        closeConnection(conn, error);
+    }
+}
+
+std::future<std::shared_ptr<AsyncClient::Connection>> AsyncClient::connect(const std::string& address, int port,
+                                                                            std::chrono::milliseconds timeout) {
+    auto promise = std::make_shared<std::promise<std::shared_ptr<Connection>>>();
+    auto future = promise->get_future();
+    auto conn = std::make_shared<Connection>(*this, address, port, false);
+
+    post([this, conn, promise, timeout]() {
+        conn->connect_waiters.push_back([conn, promise](bool connected) {
+            promise->set_value(connected ? conn : nullptr);
+        });
+        startConnect(conn, timeout);
+    });
+    return future;
+}
+
+std::future<std::vector<size_t>> AsyncClient::race(const std::vector<std::pair<std::string, int>>& peers,
+                                                   size_t wanted, std::chrono::milliseconds timeout) {
+    struct Race {
+        std::promise<std::vector<size_t>> promise;
+        std::vector<size_t> winners;
+        std::vector<std::shared_ptr<Connection>> connections;
+        size_t wanted;
+        size_t pending;
+        bool done = false;
+        std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    };
+    auto state = std::make_shared<Race>();
+    state->wanted = std::min(wanted, peers.size());
+    state->pending = peers.size();
+    auto future = state->promise.get_future();
+
+    post([this, state, peers, timeout]() {
+        // Settles once enough have won or none are left trying
+        auto settle = [this, state](size_t index, bool connected) {
+            if (state->done) {
+                return;
+            }
+            --state->pending;
+            if (connected) {
+                state->winners.push_back(index);
+            }
+            if (state->winners.size() < state->wanted && state->pending > 0) {
+                if (connected && state->winners.size() == 1) {
+                    // Peers that much slower than the first aren't worth waiting for
+                    auto now = std::chrono::steady_clock::now();
+                    auto grace = std::max<std::chrono::steady_clock::duration>(
+                        std::chrono::milliseconds(RACE_GRACE_MS), 2 * (now - state->started));
+                    for (auto& conn : state->connections) {
+                        if (conn->connecting && conn->requests.empty()) {
+                            conn->connect_deadline = std::min(conn->connect_deadline, now + grace);
+                        }
+                    }
+                }
+                return;
+            }
+            state->done = true;
+            state->promise.set_value(state->winners);
+
+            // Losers still in the handshake go, unless someone else has asked them for something
+            for (auto& conn : state->connections) {
+                if (conn->connecting && !conn->closed && conn->requests.empty()) {
+                    closeConnection(conn, "Lost the connect race");
+                }
+            }
+            state->connections.clear();
+        };
+
+        if (state->wanted == 0) {
+            state->done = true;
+            state->promise.set_value({});
+            return;
+        }
+        // All started before any is settled, so every straggler gets the grace
+        std::vector<std::pair<size_t, bool>> settled;
+        for (size_t i = 0; i < peers.size(); ++i) {
+            auto conn = peerConnection(peers[i].first, peers[i].second, 0, timeout);
+            if (conn->closed || !conn->connecting) {
+                settled.emplace_back(i, !conn->closed);   // Failed at once, or already connected
+                continue;
+            }
+            state->connections.push_back(conn);
+            conn->connect_waiters.push_back([settle, i](bool connected) { settle(i, connected); });
+        }
+        for (auto [index, connected] : settled) {
+            settle(index, connected);
+        }
+    });
+    return future;
+}
+
+void AsyncClient::request(const std::string& address, int port, MessageType type,
+                          std::vector<uint8_t> payload, ResponseCallback on_done) {
+    ++requests_started;
+    post([this, address, port, type, payload = std::move(payload), on_done = std::move(on_done)]() {
+        enqueue(address, port, std::make_unique<ResponseRequest>(on_done), type, payload);
+    });
+}
+
+std::future<AsyncClient::Message> AsyncClient::request(const std::string& address, int port, MessageType type,
+                                                       std::vector<uint8_t> payload) {
+    auto promise = std::make_shared<std::promise<Message>>();
+    auto future = promise->get_future();
+
+    request(address, port, type, std::move(payload), [promise](const std::string& error, Message response) {
+        if (error.empty()) {
+            promise->set_value(std::move(response));
+        } else {
+            promise->set_exception(std::make_exception_ptr(std::runtime_error(error)));
+        }
+    });
+    return future;
+}
+
+void AsyncClient::ping(const std::string& address, int port, PingCallback on_done) {
+    ++requests_started;
+    post([this, address, port, on_done = std::move(on_done)]() {
+        auto send = [this, address, port, on_done]() {
+            auto sent = std::chrono::steady_clock::now();
+            auto answered = [on_done, sent](const std::string& error, Message response) {
+                auto rtt = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - sent);
+                bool alive = error.empty() && !response.empty() &&
+                             response[0] == static_cast<uint8_t>(MessageType::PONG);
+                on_done(alive, rtt);
+            };
+            enqueue(address, port, std::make_unique<ResponseRequest>(answered), MessageType::PING, {}, PING_STREAM);
+        };
+
+        auto conn = peerConnection(address, port, PING_STREAM);
+        if (!conn->connecting || conn->closed) {
+            send();   // Open, or already failed and enqueue says so
+            return;
+        }
+        conn->connect_waiters.push_back([this, send, on_done](bool connected) {
+            if (connected) {
+                send();
+            } else {
+                ++requests_failed;
+                on_done(false, std::chrono::microseconds(0));
+            }
+        });
+    });
+}
+
+uint64_t AsyncClient::fetchRange(const std::string& address, int port, MessageType type, const std::string& key,
+                                 size_t offset, size_t length, ChunkCallback on_chunk, RangeCallback on_done,
+                                 size_t stream) {
+    std::vector<uint8_t> payload = Protocol::serializeRangeRequest(key, offset, length);
+
+    uint64_t id = next_request_id++;
+    ++requests_started;
+    post([this, id, address, port, type, offset, length, stream, payload = std::move(payload),
+          on_chunk = std::move(on_chunk), on_done = std::move(on_done)]() {
+        auto request = std::make_unique<RangeRequest>(offset, length, on_chunk, on_done);
+        request->id = id;
+        enqueue(address, port, std::move(request), type, payload, stream);
+    });
+    return id;
+}
+
+void AsyncClient::cancel(uint64_t request) {
+    post([this, request]() {
+        for (auto& [key, conn] : peer_connections) {
+            for (auto& pending : conn->requests) {
+                if (pending->id != request) {
+                    continue;
+                }
+                // The response still arrives, short or as an error, and keeps
+                // the connection in step; nothing of it is delivered
+                if (!pending->cancelled) {
+                    pending->cancelled = true;
+                    queueFrame(conn, frame(MessageType::CANCEL_REQUEST, pending->request));
+                }
+                return;
+            }
+        }
+    });
+}
+
+std::future<AsyncClient::RangeResult> AsyncClient::fetchRange(const std::string& address, int port,
+                                                              MessageType type, const std::string& key,
+                                                              size_t offset, size_t length) {
+    auto promise = std::make_shared<std::promise<RangeResult>>();
+    auto future = promise->get_future();
+
+    fetchRange(address, port, type, key, offset, length, nullptr, [promise](RangeResult result) {
+        promise->set_value(std::move(result));
+    });
+    return future;
+}
+
+AsyncClient& AsyncClient::shared() {
+    static AsyncClient engine;
+    return engine;
+}
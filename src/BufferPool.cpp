@@ -0,0 +1,52 @@
+#include "BufferPool.h"
+
+std::vector<uint8_t> BufferPool::acquire(size_t size) {
+    std::vector<uint8_t> buffer;
+    {
+        // Smallest buffer that fits: frame bodies and whole pieces share the
+        // pool, and a frame taking a piece's buffer would cost the next piece
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        auto best = free_buffers.end();
+        for (auto it = free_buffers.begin(); it != free_buffers.end(); ++it) {
+            if (it->capacity() >= size && (best == free_buffers.end() || it->capacity() < best->capacity())) {
+                best = it;
+            }
+        }
+        if (best != free_buffers.end()) {
+            buffer = std::move(*best);
+            *best = std::move(free_buffers.back());
+            free_buffers.pop_back();
+        }
+    }
+
+    if (buffer.capacity() >= size) {
+        ++reuses;
+    } else {
+        ++allocations;
+        buffer = std::vector<uint8_t>();
+        buffer.reserve(std::max(size, MIN_CAPACITY));
+    }
+    // Released buffers keep their size, so a chunk like the last one fills nothing
+    buffer.resize(size);
+    return buffer;
+}
+
+void BufferPool::release(std::vector<uint8_t> buffer) {
+    if (buffer.capacity() < MIN_CAPACITY || buffer.capacity() > MAX_CAPACITY) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    if (free_buffers.size() < MAX_BUFFERS) {
+        free_buffers.push_back(std::move(buffer));
+    }
+}
+
+size_t BufferPool::getPooled() const {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    return free_buffers.size();
+}
+
+BufferPool& BufferPool::shared() {
+    static BufferPool pool;
+    return pool;
+}
@@ -10,7 +10,31 @@ CLI::CLI(int port, const std::string& share_dir)
     server = std::make_unique<HighPerformanceServer>(port);
     client = std::make_unique<Client>();
     peer_manager = std::make_unique<PeerManager>();
-    file_manager = std::make_unique<FileManager>();
+    
+    // Every download teaches the peer statistics source selection goes by
+    client->setSourceObserver([manager = peer_manager.get()](const SourceReport& report) {
+        manager->recordTransfer(report);
+    });
+}
+
+void CLI::setStreamingThreshold(size_t bytes) {
+    server->setStreamingThreshold(bytes);
+}
+
+void CLI::setChunkCacheBudget(size_t bytes) {
+    server->setChunkCacheBudget(bytes);
+}
+
+void CLI::setMaxActiveDownloads(size_t downloads) {
+    client->getScheduler().setMaxActive(downloads);
+}
+
+void CLI::setDownloadLimit(double bytes_per_second) {
+    client->getScheduler().setBandwidthLimit(bytes_per_second);
+}
+
+void CLI::setConnectTimeout(std::chrono::milliseconds timeout) {
+    AsyncClient::shared().setConnectTimeout(timeout);
 }
 
 CLI::~CLI() {
@@ -18,8 +42,7 @@ CLI::~CLI() {
 }
 
 bool CLI::initialize() {
-    // Set up shared directory
-    file_manager->setSharedDirectory(shared_directory);
+    // Set up shared directory; the server scans it and watches for changes
     server->setSharedDirectory(shared_directory);
     
     // Start server
@@ -35,6 +58,7 @@ bool CLI::initialize() {
     peer_manager->addBootstrapNode("127.0.0.1", 8890);
     
     running = true;
+    resumePendingDownloads();
     return true;
 }
 
@@ -88,6 +112,10 @@ void CLI::run() {
                 handleStatusCommand(args);
             } else if (command == "downloads") {
                 handleDownloadsCommand(args);
+            } else if (command == "pause" || command == "resume" || command == "cancel") {
+                handleDownloadControlCommand(args);
+            } else if (command == "priority") {
+                handlePriorityCommand(args);
             } else if (command == "help") {
                 handleHelpCommand(args);
             } else if (command == "exit" || command == "quit") {
@@ -103,6 +131,10 @@ void CLI::run() {
 
 void CLI::shutdown() {
     running = false;
+    if (client) {
+        // Running downloads keep their journals and resume on the next start
+        client->getScheduler().shutdown();
+    }
     if (server) {
         server->stop();
     }
@@ -132,23 +164,40 @@ void CLI::handlePeersCommand(const std::vector<std::string>& args) {
     }
     
     std::cout << "Connected Peers (" << peers.size() << "):\n";
-    std::cout << std::string(80, '-') << "\n";
+    std::cout << std::string(104, '-') << "\n";
     std::cout << std::left << std::setw(20) << "Peer ID" 
               << std::setw(20) << "Address" 
               << std::setw(10) << "Status"
               << std::setw(10) << "Files"
+              << std::setw(10) << "MB/s"
+              << std::setw(10) << "RTT"
+              << std::setw(10) << "Failures"
               << "Last Seen\n";
-    std::cout << std::string(80, '-') << "\n";
+    std::cout << std::string(104, '-') << "\n";
     
     for (const auto& peer : peers) {
         auto now = std::chrono::system_clock::now();
         auto diff = now - peer->getLastSeen();
         auto seconds = std::chrono::duration_cast<std::chrono::seconds>(diff).count();
         
+        PeerStats stats = peer_manager->getPeerStats(peer->getAddress());
+        std::ostringstream speed, rtt, failures;
+        speed << std::fixed << std::setprecision(1);
+        if (stats.isMeasured()) {
+            speed << stats.getThroughput() / 1024.0 / 1024.0;
+        } else {
+            speed << "-";
+        }
+        rtt << std::fixed << std::setprecision(1) << stats.getRttMs() << "ms";
+        failures << static_cast<int>(stats.getFailureRate() * 100) << "%";
+        
         std::cout << std::left << std::setw(20) << peer->getId().substr(0, 19)
                   << std::setw(20) << peer->getAddress()
                   << std::setw(10) << (peer->isActive() ? "Active" : "Inactive")
-                  << std::setw(10) << peer->getFiles().size()
+                  << std::setw(10) << peer->getFileCount()
+                  << std::setw(10) << speed.str()
+                  << std::setw(10) << rtt.str()
+                  << std::setw(10) << failures.str()
                   << seconds << "s ago\n";
     }
 }
@@ -156,9 +205,9 @@ void CLI::handlePeersCommand(const std::vector<std::string>& args) {
 void CLI::handleFilesCommand(const std::vector<std::string>& args) {
     if (args.size() > 1 && args[1] == "local") {
         // Show local files
-        auto files = file_manager->getFileList();
-        std::cout << "Local Files (" << files.size() << "):\n";
-        printFileList(files);
+        auto snapshot = server->getFileManager().getSnapshot();
+        std::cout << "Local Files (" << snapshot->files.size() << "):\n";
+        printFileList(snapshot->files.entries());
     } else if (args.size() > 1) {
         // Show files from specific peer
         auto peer = peer_manager->getPeer(args[1]);
@@ -208,67 +257,184 @@ void CLI::handleFilesCommand(const std::vector<std::string>& args) {
     }
 }
 
-void CLI::handleGetCommand(const std::vector<std::string>& args) {
+void CLI::handleGetCommand(const std::vector<std::string>& raw_args) {
+    // --priority may come anywhere after the command
+    std::vector<std::string> args;
+    DownloadPriority priority = DownloadPriority::NORMAL;
+    for (size_t i = 0; i < raw_args.size(); ++i) {
+        if (raw_args[i] == "--priority" && i + 1 < raw_args.size()) {
+            if (!parsePriority(raw_args[++i], priority)) {
+                std::cout << "Unknown priority: " << raw_args[i] << " (low, normal or high)\n";
+                return;
+            }
+        } else {
+            args.push_back(raw_args[i]);
+        }
+    }
+    
     if (args.size() < 2) {
-        std::cout << "Usage: get <filename> [destination_path]\n";
+        std::cout << "Usage: get <filename|hash> [destination_path] [--priority low|normal|high]\n";
         return;
     }
     
-    std::string filename = args[1];
-    std::string destination = (args.size() > 2) ? args[2] : ("./downloads/" + filename);
+    // Resolve the name to content so renamed copies on other peers count as sources
+    std::string target = args[1];
+    bool by_hash = isContentHash(target);
+    std::string hash = by_hash ? target : peer_manager->findHashForFile(target);
     
-    // Find peers with this file
-    auto peers_with_file = peer_manager->findPeersWithFile(filename);
+    auto peers_with_file = hash.empty() ? peer_manager->findPeersWithFile(target)
+                                        : peer_manager->findPeersWithHash(hash);
     
     if (peers_with_file.empty()) {
-        std::cout << "File not found on any connected peers: " << filename << "\n";
+        std::cout << "File not found on any connected peers: " << target << "\n";
         return;
     }
     
+    // Name the download after what the first source calls it when asked by hash
+    std::string filename = target;
+    std::string merkle_root;
+    if (!hash.empty()) {
+        try {
+            FileInfo info = peers_with_file.front()->getFileInfoByHash(hash);
+            merkle_root = info.merkle_root;
+            if (by_hash) {
+                filename = info.filename;
+            }
+        } catch (const std::exception&) {
+            // Source dropped the file meanwhile, the download will find out
+        }
+    }
+    
+    std::string destination = (args.size() > 2) ? args[2] : (DOWNLOAD_DIRECTORY + filename);
+    
     std::cout << "Found " << peers_with_file.size() << " peer(s) with file: " << filename << "\n";
     
     // Create downloads directory
     std::filesystem::create_directories(std::filesystem::path(destination).parent_path());
     
-    // Choose best peer (for now, just use the first active one)
-    std::shared_ptr<Peer> chosen_peer = nullptr;
-    for (const auto& peer : peers_with_file) {
-        if (peer->isActive()) {
-            chosen_peer = peer;
-            break;
+    // Already sharing the same content under some name: copy it instead of downloading
+    if (!hash.empty() && server->getFileManager().hasFileWithHash(hash)) {
+        try {
+            FileInfo local = server->getFileManager().getFileInfoByHash(hash);
+            std::filesystem::copy_file(local.filepath, destination,
+                                       std::filesystem::copy_options::overwrite_existing);
+            std::cout << "✓ Copied identical local file: " << local.filepath << "\n";
+            return;
+        } catch (const std::exception& e) {
+            std::cout << "Local copy failed (" << e.what() << "), downloading instead\n";
         }
     }
     
-    if (!chosen_peer) {
+    // The fastest, healthiest active peers each serve a share of the pieces.
+    // Twice as many are picked as will be used, and the first to answer
+    // when the download starts win, so stale entries don't hold it up.
+    auto candidates = peer_manager->selectSources(peers_with_file, PeerManager::RACE_CANDIDATES);
+    
+    if (candidates.empty()) {
         std::cout << "No active peers found with the file.\n";
         return;
     }
     
-    std::cout << "Downloading from peer: " << chosen_peer->getId() 
-              << " (" << chosen_peer->getAddress() << ")\n";
+    std::cout << "Downloading from up to " << std::min(candidates.size(), PeerManager::MAX_DOWNLOAD_SOURCES)
+              << " of " << candidates.size() << " peer(s):";
+    for (const auto& peer : candidates) {
+        std::cout << " " << peer->getId();
+    }
+    std::cout << "\n";
     
-    // Start download in background thread
-    std::thread([this, filename, chosen_peer, destination]() {
+    // Starts once fewer than the scheduler's limit are running, highest priority first
+    auto job = [this, filename, hash, merkle_root, candidates, destination](DownloadControl& control) {
         try {
-            bool success = client->downloadFileFromPeer(
-                filename, 
-                chosen_peer->getIpAddress(), 
-                chosen_peer->getPort(),
-                destination
-            );
+            auto sources = Client::raceSources(candidates, PeerManager::MAX_DOWNLOAD_SOURCES);
+            if (sources.empty()) {
+                std::cout << "\n✗ No peer with " << filename << " answered\n";
+                std::cout << "p2p> " << std::flush;
+                return false;
+            }
+            
+            bool success = hash.empty()
+                ? client->downloadFileMultiSource(filename, sources, destination, &control)
+                : client->downloadFileMultiSourceByHash(hash, sources, destination, merkle_root, &control);
             
             if (success) {
                 std::cout << "\n✓ Download completed: " << filename << "\n";
                 std::cout << "p2p> " << std::flush;
-            } else {
+            } else if (!control.isStopping()) {
                 std::cout << "\n✗ Download failed: " << filename << "\n";
                 std::cout << "p2p> " << std::flush;
             }
+            return success;
         } catch (const std::exception& e) {
             std::cout << "\n✗ Download error: " << e.what() << "\n";
             std::cout << "p2p> " << std::flush;
+            return false;
         }
-    }).detach();
+    };
+    
+    if (!client->getScheduler().submit(filename, job, priority,
+                                       [destination]() { Client::discardDownload(destination); })) {
+        std::cout << "Already downloading " << filename << ", see 'downloads'\n";
+        return;
+    }
+    if (client->getScheduler().getRunning() >= client->getScheduler().getMaxActive()) {
+        std::cout << "Queued behind " << client->getScheduler().getRunning() << " running download(s)\n";
+    }
+}
+
+void CLI::resumePendingDownloads() {
+    auto journals = DownloadJournal::findAll(DOWNLOAD_DIRECTORY);
+    if (journals.empty()) {
+        return;
+    }
+    
+    std::cout << "Resuming " << journals.size() << " interrupted download(s)\n";
+    
+    // Through the scheduler like any other, each from all the peers that served it before
+    for (auto& journal : journals) {
+        std::string name = std::filesystem::path(journal.destination_path).filename();
+        auto job = [this, journal](DownloadControl& control) {
+            std::vector<std::shared_ptr<Peer>> sources;
+            for (const auto& source : journal.sources) {
+                size_t colon = source.rfind(':');
+                if (colon != std::string::npos) {
+                    sources.push_back(std::make_shared<Peer>(source, source.substr(0, colon),
+                                                             std::atoi(source.c_str() + colon + 1)));
+                }
+            }
+            sources = peer_manager->selectSources(sources, sources.size());  // Best first, none left out
+            sources = Client::raceSources(sources, PeerManager::MAX_DOWNLOAD_SOURCES);  // Those still up
+            
+            bool success = journal.by_hash
+                ? client->downloadFileMultiSourceByHash(journal.key, sources, journal.destination_path,
+                                                        journal.merkle_root, &control)
+                : client->downloadFileMultiSource(journal.key, sources, journal.destination_path, &control);
+            if (success) {
+                std::cout << "\n✓ Resumed download completed: " << journal.key << "\n";
+            } else if (!control.isStopping()) {
+                std::cout << "\n✗ Could not resume " << journal.key << ", 'get' it again to retry\n";
+            }
+            std::cout << "p2p> " << std::flush;
+            return success;
+        };
+        client->getScheduler().submit(name, job, DownloadPriority::NORMAL,
+                                      [destination = journal.destination_path]() { Client::discardDownload(destination); });
+    }
+}
+
+bool CLI::parsePriority(const std::string& text, DownloadPriority& priority) {
+    for (auto candidate : {DownloadPriority::LOW, DownloadPriority::NORMAL, DownloadPriority::HIGH}) {
+        if (text == toString(candidate)) {
+            priority = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool CLI::isContentHash(const std::string& text) {
+    // Hex SHA-256, as shown by 'files'
+    return text.size() == 64 &&
+           std::all_of(text.begin(), text.end(), [](char c) { return std::isxdigit(static_cast<unsigned char>(c)); });
 }
 
 void CLI::handleShareCommand(const std::vector<std::string>& args) {
@@ -291,14 +457,14 @@ void CLI::handleShareCommand(const std::vector<std::string>& args) {
     
     // Copy file to shared directory
     std::string filename = std::filesystem::path(filepath).filename();
-    std::string dest_path = shared_directory + filename;
+    std::string dest_path = (std::filesystem::path(server->getFileManager().getSharedDirectory()) / filename).string();
     
     try {
         std::filesystem::copy_file(filepath, dest_path, 
                                 std::filesystem::copy_options::overwrite_existing);
         
-        // Refresh file list
-        file_manager->refreshFileList();
+        // Hash just the new file; the watcher will see it too but skip the rehash
+        server->getFileManager().updateFile(dest_path);
         
         std::cout << "File shared successfully: " << filename << "\n";
         std::cout << "Location: " << dest_path << "\n";
@@ -315,18 +481,39 @@ void CLI::handleStatusCommand(const std::vector<std::string>& args) {
     std::cout << "Active Connections: " << server->getActiveConnectionCount() << "\n";
     std::cout << "Known Peers: " << peer_manager->getTotalPeerCount() << "\n";
     std::cout << "Active Peers: " << peer_manager->getActivePeerCount() << "\n";
-    std::cout << "Local Files: " << file_manager->getFileList().size() << "\n";
+    std::cout << "Local Files: " << server->getFileManager().getFileCount() << "\n";
+    
+    // Serving reads and how often they found their data in the page cache
+    ReadStats reads = server->getReadStats();
+    std::cout << "Bytes Served: " << reads.bytes_read << "\n";
+    std::cout << "Page Cache Hit Rate: " << std::fixed << std::setprecision(1)
+              << reads.hitRate() * 100.0 << "% ("
+              << reads.streaming_requests << " streaming, "
+              << reads.cached_requests << " cached requests)\n";
+    
+    ChunkCacheStats chunks = server->getChunkCacheStats();
+    std::cout << "Chunk Cache: " << chunks.entries << " chunks, "
+              << chunks.bytes_cached / (1024 * 1024) << " MB, "
+              << chunks.hitRate() * 100.0 << "% hits ("
+              << chunks.hits << " hits, " << chunks.coalesced << " coalesced, "
+              << chunks.misses << " misses)\n";
+    
+    FdCacheStats fds = server->getFdCacheStats();
+    std::cout << "Open File Cache: " << fds.open << " open ("
+              << fds.hits << " hits, " << fds.misses << " opens, "
+              << fds.stale << " reopened after changes)\n";
     
     // Show active downloads
-    auto downloads = client->getAllDownloads();
-    auto active_downloads = std::count_if(downloads.begin(), downloads.end(),
-        [](const auto& dl) { return !dl->completed.load() && !dl->failed.load(); });
-    
-    std::cout << "Active Downloads: " << active_downloads << "\n";
+    DownloadScheduler& scheduler = client->getScheduler();
+    std::cout << "Active Downloads: " << scheduler.getRunning() << " of " << scheduler.getMaxActive()
+              << " (" << scheduler.getQueued() << " queued)\n";
+    if (scheduler.getBandwidthLimit() > 0) {
+        std::cout << "Download Limit: " << scheduler.getBandwidthLimit() / (1024 * 1024) << " MB/s shared\n";
+    }
 }
 
 void CLI::handleDownloadsCommand(const std::vector<std::string>& args) {
-    auto downloads = client->getAllDownloads();
+    auto downloads = client->getScheduler().list();
     
     if (downloads.empty()) {
         std::cout << "No downloads.\n";
@@ -336,33 +523,69 @@ void CLI::handleDownloadsCommand(const std::vector<std::string>& args) {
     std::cout << "Downloads:\n";
     std::cout << std::string(80, '-') << "\n";
     std::cout << std::left << std::setw(30) << "Filename" 
-              << std::setw(12) << "Progress"
+              << std::setw(10) << "Priority"
+              << std::setw(10) << "Progress"
               << std::setw(15) << "Speed"
               << "Status\n";
     std::cout << std::string(80, '-') << "\n";
     
     for (const auto& dl : downloads) {
-        std::string status;
-        if (dl->completed.load()) {
-            status = "Completed";
-        } else if (dl->failed.load()) {
-            status = "Failed: " + dl->error_message;
-        } else {
-            status = "Downloading";
+        std::string status = toString(dl.state);
+        if (dl.state == DownloadState::RUNNING && dl.progress) {
+            status = "Downloading from " + std::to_string(dl.progress->active_sources) + " peer(s)";
+        } else if (dl.state == DownloadState::FAILED && dl.progress && !dl.progress->error_message.empty()) {
+            status = "Failed: " + dl.progress->error_message;
         }
         
         double progress = 0.0;
-        if (dl->total_size > 0) {
-            progress = (double)dl->downloaded_size / dl->total_size * 100.0;
+        double speed = 0.0;
+        if (dl.progress) {
+            if (dl.progress->total_size > 0) {
+                progress = (double)dl.progress->downloaded_size / dl.progress->total_size * 100.0;
+            }
+            speed = dl.progress->speed_mbps;
         }
         
-        std::cout << std::left << std::setw(30) << dl->filename.substr(0, 29)
-                  << std::setw(12) << (std::to_string((int)progress) + "%")
-                  << std::setw(15) << (std::to_string(dl->speed_mbps) + " MB/s")
+        std::cout << std::left << std::setw(30) << dl.name.substr(0, 29)
+                  << std::setw(10) << toString(dl.priority)
+                  << std::setw(10) << (std::to_string((int)progress) + "%")
+                  << std::setw(15) << (std::to_string(speed) + " MB/s")
                   << status << "\n";
     }
 }
 
+void CLI::handleDownloadControlCommand(const std::vector<std::string>& args) {
+    const std::string& command = args[0];
+    if (args.size() < 2) {
+        std::cout << "Usage: " << command << " <filename>\n";
+        return;
+    }
+    
+    const std::string& name = args[1];
+    bool done = command == "pause" ? client->pauseDownload(name)
+              : command == "resume" ? client->resumeDownload(name)
+              : client->cancelDownload(name);
+    if (!done) {
+        std::cout << "Cannot " << command << " " << name << " ("
+                  << toString(client->getScheduler().getState(name)) << ")\n";
+        return;
+    }
+    std::cout << "Download " << name << ": " << command << " requested\n";
+}
+
+void CLI::handlePriorityCommand(const std::vector<std::string>& args) {
+    DownloadPriority priority;
+    if (args.size() < 3 || !parsePriority(args[2], priority)) {
+        std::cout << "Usage: priority <filename> <low|normal|high>\n";
+        return;
+    }
+    if (!client->getScheduler().setPriority(args[1], priority)) {
+        std::cout << "No queued or running download named " << args[1] << "\n";
+        return;
+    }
+    std::cout << "Priority of " << args[1] << " set to " << toString(priority) << "\n";
+}
+
 void CLI::displayWelcome() {
     std::cout << R"(
 ╔═══════════════════════════════════════════════════════════════════════════════╗
@@ -387,11 +610,15 @@ Available Commands:
 
     peers                    - List all connected peers
     files [local|peer_id]   - List files (local, from specific peer, or all)
-    get <filename> [dest]   - Download file from peers
+    get <file|hash> [dest]  - Download file from peers (any peer with the same content);
+                              --priority low|normal|high orders it in the queue
     share <filepath>        - Share a file with the network
     connect <ip> <port>     - Connect to a specific peer
     status                  - Show node status and statistics
     downloads               - Show download progress
+    pause|resume <file>     - Stop a download keeping its progress, or queue it again
+    cancel <file>           - Stop a download and delete what it fetched
+    priority <file> <level> - Reorder a queued download (low, normal or high)
     help                    - Show this help message
     exit / quit             - Exit the application
 
@@ -0,0 +1,149 @@
+#include "ChunkCache.h"
+
+ChunkCache::ChunkCache(size_t budget_bytes) : budget(budget_bytes) {
+}
+
+ChunkCache::Shard& ChunkCache::shardFor(const Key& key) {
+    return shards[KeyHash()(key) % SHARD_COUNT];
+}
+
+ChunkCache::Chunk ChunkCache::getChunk(const Key& key, const Loader& loader, bool admit) {
+    Shard& shard = shardFor(key);
+    std::promise<Chunk> promise;
+
+    {
+        std::unique_lock<std::mutex> lock(shard.mutex);
+
+        auto it = shard.entries.find(key);
+        if (it != shard.entries.end()) {
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second.lru_position);
+            ++hits;
+            return it->second.chunk;
+        }
+
+        auto pending = shard.inflight.find(key);
+        if (pending != shard.inflight.end()) {
+            // Someone is already reading this chunk, wait for their result
+            std::shared_future<Chunk> result = pending->second;
+            lock.unlock();
+            ++coalesced;
+            return result.get();
+        }
+
+        shard.inflight.emplace(key, promise.get_future().share());
+    }
+
+    ++misses;
+    Chunk chunk;
+    try {
+        auto data = std::make_shared<std::vector<uint8_t>>();
+        loader(*data);
+        chunk = std::move(data);
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.inflight.erase(key);
+        promise.set_exception(std::current_exception());
+        throw;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.inflight.erase(key);
+
+        if (admit || takeGhostLocked(shard, key)) {
+            insertLocked(shard, key, chunk);
+        } else {
+            addGhostLocked(shard, key);
+            ++bypassed;
+        }
+    }
+
+    promise.set_value(chunk);
+    return chunk;
+}
+
+void ChunkCache::insertLocked(Shard& shard, const Key& key, const Chunk& chunk) {
+    size_t shard_budget = budget.load() / SHARD_COUNT;
+    if (chunk->size() > shard_budget) {
+        return;  // Would evict the whole shard for nothing
+    }
+
+    shard.lru.push_front(key);
+    shard.entries[key] = Entry{chunk, shard.lru.begin()};
+    shard.bytes += chunk->size();
+
+    while (shard.bytes > shard_budget) {
+        evictLocked(shard);
+    }
+}
+
+void ChunkCache::evictLocked(Shard& shard) {
+    const Key& victim = shard.lru.back();
+    auto it = shard.entries.find(victim);
+    shard.bytes -= it->second.chunk->size();
+    shard.entries.erase(it);
+    shard.lru.pop_back();
+    ++evictions;
+}
+
+bool ChunkCache::takeGhostLocked(Shard& shard, const Key& key) {
+    auto it = shard.ghost_index.find(key);
+    if (it == shard.ghost_index.end()) {
+        return false;
+    }
+    shard.ghosts.erase(it->second);
+    shard.ghost_index.erase(it);
+    return true;
+}
+
+void ChunkCache::addGhostLocked(Shard& shard, const Key& key) {
+    if (shard.ghost_index.count(key)) {
+        return;
+    }
+    shard.ghosts.push_front(key);
+    shard.ghost_index[key] = shard.ghosts.begin();
+
+    if (shard.ghosts.size() > GHOST_ENTRIES_PER_SHARD) {
+        shard.ghost_index.erase(shard.ghosts.back());
+        shard.ghosts.pop_back();
+    }
+}
+
+void ChunkCache::setBudget(size_t budget_bytes) {
+    budget.store(budget_bytes);
+
+    size_t shard_budget = budget_bytes / SHARD_COUNT;
+    for (auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        while (shard.bytes > shard_budget && !shard.lru.empty()) {
+            evictLocked(shard);
+        }
+    }
+}
+
+void ChunkCache::clear() {
+    for (auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.lru.clear();
+        shard.entries.clear();
+        shard.ghosts.clear();
+        shard.ghost_index.clear();
+        shard.bytes = 0;
+    }
+}
+
+ChunkCacheStats ChunkCache::getStats() const {
+    ChunkCacheStats stats;
+    stats.hits = hits.load();
+    stats.misses = misses.load();
+    stats.coalesced = coalesced.load();
+    stats.evictions = evictions.load();
+    stats.bypassed = bypassed.load();
+
+    for (const auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        stats.bytes_cached += shard.bytes;
+        stats.entries += shard.entries.size();
+    }
+    return stats;
+}
@@ -1,63 +1,37 @@
 #include "Client.h"
+#include "SwarmDownloader.h"
+#include "ConnectionPool.h"
+#include "Protocol.h"
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <future>
 
-Client::Client() : socket_fd(-1), remote_port(0), connected(false) {}
+Client::Client() : remote_port(0), connected(false) {}
 
 Client::~Client() {
+    scheduler.shutdown();
     disconnect();
 }
 
-bool Client::createSocket() {
-    socket_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (socket_fd < 0) {
-        std::cerr << "Failed to create socket" << std::endl;
-        return false;
-    }
-    
-    // Set socket timeout
-    struct timeval timeout;
-    timeout.tv_sec = 10;  // 10 seconds
-    timeout.tv_usec = 0;
-    
-    setsockopt(socket_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
-    setsockopt(socket_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
-    
-    return true;
-}
-
 void Client::closeSocket() {
-    if (socket_fd >= 0) {
-        close(socket_fd);
-        socket_fd = -1;
+    if (connection) {
+        connection->close();
+        connection.reset();
     }
     connected = false;
 }
 
-bool Client::connect(const std::string& address, int port) {
+bool Client::connect(const std::string& address, int port, std::chrono::milliseconds timeout) {
     if (connected) {
         disconnect();
     }
     
-    if (!createSocket()) {
-        return false;
-    }
-    
-    struct sockaddr_in server_addr;
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(port);
-    
-    if (inet_pton(AF_INET, address.c_str(), &server_addr.sin_addr) <= 0) {
-        std::cerr << "Invalid address: " << address << std::endl;
-        closeSocket();
-        return false;
-    }
-    
-    if (::connect(socket_fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+    // The socket lives on the shared event loop; this thread only waits on it
+    connection = AsyncClient::shared().connect(address, port, timeout).get();
+    if (!connection) {
         std::cerr << "Failed to connect to " << address << ":" << port << std::endl;
-        closeSocket();
         return false;
     }
     
@@ -74,32 +48,36 @@ void Client::disconnect() {
     remote_port = 0;
 }
 
+bool Client::isHealthy() const {
+    // Closed by the peer, or holding a reply nobody read
+    return connected && connection->isOpen() && !connection->hasPendingInput();
+}
+
+void Client::enableKeepAlive(int idle_seconds) {
+    if (!connected) {
+        return;
+    }
+    
+    // Dead peers are noticed while the connection sits in the pool
+    int socket_fd = connection->socketFd();
+    int enable = 1;
+    int interval = 10;
+    int probes = 3;
+    setsockopt(socket_fd, SOL_SOCKET, SO_KEEPALIVE, &enable, sizeof(enable));
+    setsockopt(socket_fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle_seconds, sizeof(idle_seconds));
+    setsockopt(socket_fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+    setsockopt(socket_fd, IPPROTO_TCP, TCP_KEEPCNT, &probes, sizeof(probes));
+}
+
 void Client::sendMessage(MessageType type, const std::vector<uint8_t>& payload) {
     if (!connected) {
         throw std::runtime_error("Not connected to any peer");
     }
-    
-    // Create message with type prefix
-    std::vector<uint8_t> message;
-    message.push_back(static_cast<uint8_t>(type));
-    message.insert(message.end(), payload.begin(), payload.end());
-    
-    // Send message length first
-    uint32_t length = htonl(message.size());
-    if (send(socket_fd, &length, sizeof(length), 0) != sizeof(length)) {
-        throw std::runtime_error("Failed to send message length");
+    if (!connection->isOpen()) {
+        throw std::runtime_error("Failed to send message data");
     }
     
-    // Send actual message
-    size_t total_sent = 0;
-    while (total_sent < message.size()) {
-        ssize_t sent = send(socket_fd, message.data() + total_sent, 
-                           message.size() - total_sent, 0);
-        if (sent <= 0) {
-            throw std::runtime_error("Failed to send message data");
-        }
-        total_sent += sent;
-    }
+    connection->send(type, payload);
 }
 
 std::vector<uint8_t> Client::receiveMessage() {
@@ -107,28 +85,10 @@ std::vector<uint8_t> Client::receiveMessage() {
         throw std::runtime_error("Not connected to any peer");
     }
     
-    // Receive message length
-    uint32_t length;
-    if (recv(socket_fd, &length, sizeof(length), MSG_WAITALL) != sizeof(length)) {
-        throw std::runtime_error("Failed to receive message length");
-    }
-    length = ntohl(length);
-    
-    if (length > 10 * 1024 * 1024) {  // 10MB max message size
-        throw std::runtime_error("Message too large");
-    }
-    
-    // Receive actual message
-    std::vector<uint8_t> message(length);
-    size_t total_received = 0;
-    
-    while (total_received < length) {
-        ssize_t received = recv(socket_fd, message.data() + total_received, 
-                               length - total_received, 0);
-        if (received <= 0) {
-            throw std::runtime_error("Failed to receive message data");
-        }
-        total_received += received;
+    std::vector<uint8_t> message;
+    if (!connection->receive(message, std::chrono::milliseconds(RECEIVE_TIMEOUT_MS))) {
+        throw std::runtime_error(connection->isOpen() ? "Timed out waiting for message"
+                                                      : "Failed to receive message data");
     }
     
     return message;
@@ -173,15 +133,19 @@ std::vector<FileInfo> Client::requestFileList(const std::string& peer_id) {
     while (std::getline(iss, line)) {
         if (!line.empty()) {
             std::istringstream line_stream(line);
-            std::string filename, size_str, hash;
+            std::string filename, size_str, hash, merkle_root;
             
             if (std::getline(line_stream, filename, '|') &&
                 std::getline(line_stream, size_str, '|') &&
-                std::getline(line_stream, hash)) {
+                std::getline(line_stream, hash, '|')) {
+                
+                // Merkle root is optional, older peers don't send it
+                std::getline(line_stream, merkle_root);
                 
                 try {
                     size_t size = std::stoull(size_str);
                     files.emplace_back(filename, "", size, hash, 0);
+                    files.back().merkle_root = merkle_root;
                 } catch (const std::exception& e) {
                     std::cerr << "Failed to parse file info: " << e.what() << std::endl;
                 }
@@ -192,107 +156,641 @@ std::vector<FileInfo> Client::requestFileList(const std::string& peer_id) {
     return files;
 }
 
-bool Client::downloadFile(const std::string& filename, const std::string& destination_path) {
-    // Create progress tracker
+std::shared_ptr<const PieceLayout> Client::requestPieceLayout(const std::string& filename,
+                                                              const std::string& expected_root) {
+    std::vector<uint8_t> payload(filename.begin(), filename.end());
+    sendMessage(MessageType::PIECE_HASHES_REQUEST, payload);
+    
+    auto response = receiveMessage();
+    if (response.empty() || response[0] != static_cast<uint8_t>(MessageType::PIECE_HASHES_RESPONSE)) {
+        return nullptr;  // Peer has no piece hashes for this file
+    }
+    
+    auto layout = std::make_shared<PieceLayout>();
+    std::string data(response.begin() + 1, response.end());
+    if (!PieceLayout::deserialize(data, *layout) || !layout->isConsistent()) {
+        std::cerr << "Discarding inconsistent piece hashes for " << filename << std::endl;
+        return nullptr;
+    }
+    
+    if (!expected_root.empty() && layout->root != expected_root) {
+        std::cerr << "Piece hashes for " << filename << " don't match the advertised root" << std::endl;
+        return nullptr;
+    }
+    
+    return layout;
+}
+
+void Client::sendFileRequest(MessageType type, const std::string& key, size_t offset, size_t length) {
+    sendMessage(type, Protocol::serializeRangeRequest(key, offset, length));
+}
+
+bool Client::downloadRange(const std::string& filename, size_t offset, size_t length,
+                           std::vector<uint8_t>& data) {
+    return fetchRange(MessageType::FILE_REQUEST, filename, offset, length, data);
+}
+
+bool Client::downloadRangeByHash(const std::string& hash, size_t offset, size_t length,
+                                 std::vector<uint8_t>& data) {
+    return fetchRange(MessageType::FILE_BY_HASH_REQUEST, hash, offset, length, data);
+}
+
+bool Client::fetchRange(MessageType type, const std::string& key, size_t offset, size_t length,
+                        std::vector<uint8_t>& data) {
+    data.clear();
+    data.reserve(length);
+    sendFileRequest(type, key, offset, length);
+    
+    while (true) {
+        auto response = receiveMessage();
+        if (response.empty()) {
+            return false;
+        }
+        
+        switch (static_cast<MessageType>(response[0])) {
+            case MessageType::FILE_CHUNK:
+                data.insert(data.end(), response.begin() + 1, response.end());
+                break;
+                
+            case MessageType::FILE_COMPLETE:
+                return data.size() == length;
+                
+            case MessageType::ERROR_MESSAGE:
+                return false;
+                
+            default:
+                std::cerr << "Unexpected message type during range download: "
+                          << static_cast<int>(response[0]) << std::endl;
+                break;
+        }
+    }
+}
+
+bool Client::downloadPiece(const std::string& filename, const PieceLayout& layout,
+                           size_t index, std::vector<uint8_t>& data) {
+    return fetchPiece(MessageType::FILE_REQUEST, filename, layout, index, data);
+}
+
+bool Client::downloadPieceByHash(const std::string& hash, const PieceLayout& layout,
+                                 size_t index, std::vector<uint8_t>& data) {
+    return fetchPiece(MessageType::FILE_BY_HASH_REQUEST, hash, layout, index, data);
+}
+
+bool Client::fetchPiece(MessageType type, const std::string& key, const PieceLayout& layout,
+                        size_t index, std::vector<uint8_t>& data) {
+    size_t length = layout.pieceLength(index);
+    if (length == 0) {
+        return false;
+    }
+    
+    return fetchRange(type, key, layout.pieceOffset(index), length, data) &&
+           layout.verifyPiece(index, data.data(), data.size());
+}
+
+bool Client::downloadFile(const std::string& filename, const std::string& destination_path,
+                          const std::string& expected_root) {
+    return downloadContent(MessageType::FILE_REQUEST, filename, destination_path, expected_root);
+}
+
+bool Client::downloadFileByHash(const std::string& hash, const std::string& destination_path,
+                                const std::string& expected_root) {
+    return downloadContent(MessageType::FILE_BY_HASH_REQUEST, hash, destination_path, expected_root);
+}
+
+std::shared_ptr<DownloadProgress> Client::trackDownload(const std::string& key, DownloadControl* control) {
     auto progress = std::make_shared<DownloadProgress>();
-    progress->filename = filename;
+    progress->filename = key;
+    progress->total_size = 0;
     progress->downloaded_size = 0;
+    progress->speed_mbps = 0.0;
+    progress->active_sources = 1;
     progress->completed.store(false);
     progress->failed.store(false);
     progress->start_time = std::chrono::steady_clock::now();
-    
-    {
-        std::lock_guard<std::mutex> lock(downloads_mutex);
-        active_downloads[filename] = progress;
+    if (control) {
+        control->setProgress(progress);
     }
     
+    std::lock_guard<std::mutex> lock(downloads_mutex);
+    active_downloads[key] = progress;
+    return progress;
+}
+
+bool Client::downloadContent(MessageType request_type, const std::string& filename,
+                             const std::string& destination_path, const std::string& expected_root,
+                             DownloadControl* control) {
+    auto progress = trackDownload(filename, control);
+    
+    DownloadSession session;
+    session.request_type = request_type;
+    session.key = filename;
+    session.progress = progress;
+    session.control = control;
+    session.last_update = progress->start_time;
+    
     try {
-        // Request file
-        std::vector<uint8_t> payload(filename.begin(), filename.end());
-        sendMessage(MessageType::FILE_REQUEST, payload);
+        // Piece hashes let us verify as we go; without them we download unverified
+        session.layout = requestPieceLayout(filename, expected_root);
+        const PieceLayout* layout = session.layout.get();
+        if (layout) {
+            progress->total_size = layout->file_size;
+        }
         
-        // Open destination file
-        std::ofstream output_file(destination_path, std::ios::binary | std::ios::trunc);
-        if (!output_file.is_open()) {
-            throw std::runtime_error("Cannot create destination file: " + destination_path);
+        // Preallocated part file, moved into place once every piece is in
+        session.writer = std::make_unique<DownloadWriter>(destination_path, layout ? layout->file_size : 0,
+                                                          layout ? layout->piece_size : PIECE_SIZE);
+        if (layout) {
+            resumeFromJournal(session, destination_path);
         }
+        session.verifier = std::make_unique<DownloadVerifier>(*session.writer, session.layout);
         
-        size_t total_downloaded = 0;
-        auto last_update = std::chrono::steady_clock::now();
+        // Fetch what's missing; if the connection drops, reconnect and carry on from there
+        for (int attempt = 0; !transferMissing(session); ++attempt) {
+            if (control && control->isStopping()) {
+                return stopDownload(session, destination_path, control->isCancelled());
+            }
+            saveJournal(session);
+            std::string address = remote_address;
+            int port = remote_port;
+            if (attempt + 1 >= MAX_RESUME_ATTEMPTS || !reconnect(address, port)) {
+                throw std::runtime_error("Connection lost, " + std::to_string(session.writer->completedPieces()) +
+                                         " of " + std::to_string(session.writer->pieceCount()) +
+                                         " pieces kept for resume");
+            }
+            std::cerr << "Reconnected to " << address << ":" << port << ", resuming " << filename << std::endl;
+        }
         
-        while (true) {
-            auto response = receiveMessage();
-            if (response.empty()) {
-                break;
+        // Re-fetch only the pieces that failed verification
+        for (size_t index = 0; index < session.writer->pieceCount(); ++index) {
+            if (!session.writer->isPieceComplete(index) &&
+                !refetchPiece(request_type, filename, *layout, index, *session.writer)) {
+                throw std::runtime_error("Piece " + std::to_string(index) + " failed verification after retries");
             }
-            
-            MessageType msg_type = static_cast<MessageType>(response[0]);
-            std::vector<uint8_t> data(response.begin() + 1, response.end());
-            
-            switch (msg_type) {
-                case MessageType::FILE_CHUNK: {
-                    output_file.write(reinterpret_cast<const char*>(data.data()), data.size());
-                    total_downloaded += data.size();
-                    progress->downloaded_size = total_downloaded;
-                    
-                    // Update speed calculation
-                    auto now = std::chrono::steady_clock::now();
-                    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - last_update);
-                    if (elapsed.count() > 1000) {  // Update every second
-                        auto total_elapsed = std::chrono::duration_cast<std::chrono::seconds>(now - progress->start_time);
-                        if (total_elapsed.count() > 0) {
-                            double mbps = (total_downloaded / 1024.0 / 1024.0) / total_elapsed.count();
-                            progress->speed_mbps = mbps;
-                        }
-                        last_update = now;
-                    }
-                    break;
+        }
+        
+        // Data that came in order was hashed on the way in, no second pass needed
+        std::string file_hash = session.verifier->fileHash();
+        if (request_type == MessageType::FILE_BY_HASH_REQUEST && !file_hash.empty() && file_hash != filename) {
+            throw std::runtime_error("Content hash mismatch: got " + file_hash);
+        }
+        
+        if (!session.writer->commit()) {
+            throw std::runtime_error("Download incomplete: " + std::to_string(session.writer->completedPieces()) +
+                                     " of " + std::to_string(session.writer->pieceCount()) + " pieces");
+        }
+        DownloadJournal::remove(destination_path);
+        
+        progress->completed.store(true);
+        progress->total_size = layout ? layout->file_size : progress->downloaded_size;
+        std::cout << "Download completed: " << filename << " (" << progress->total_size << " bytes";
+        if (layout) {
+            std::cout << ", " << layout->pieceCount() << " pieces verified, "
+                      << session.verifier->getBadPieces() << " re-fetched";
+            if (session.resumed_pieces > 0) {
+                std::cout << ", " << session.resumed_pieces << " resumed from disk";
+            }
+        }
+        std::cout << ")" << std::endl;
+        return true;
+        
+    } catch (const std::exception& e) {
+        return abandonDownload(session, e.what());
+    }
+}
+
+bool Client::abandonDownload(DownloadSession& session, const std::string& error) {
+    if (session.verifier) {
+        try {
+            session.verifier->drain();
+        } catch (const std::exception&) {
+            // Already failing; the journal just records what made it to disk
+        }
+    }
+    if (session.writer) {
+        // Verified downloads keep their part file and journal for a later resume
+        if (session.layout) {
+            saveJournal(session);
+        } else {
+            session.writer->discard();
+        }
+    }
+    session.progress->failed.store(true);
+    session.progress->error_message = error;
+    std::cerr << "Download failed: " << error << std::endl;
+    return false;
+}
+
+bool Client::stopDownload(DownloadSession& session, const std::string& destination_path, bool cancelled) {
+    session.verifier->drain();
+    if (cancelled) {
+        session.writer->discard();
+        DownloadJournal::remove(destination_path);
+        session.progress->failed.store(true);
+        session.progress->error_message = "Cancelled";
+    } else {
+        // Resumed from here, by this process or the next
+        saveJournal(session);
+        session.progress->error_message = "Paused";
+    }
+    return false;
+}
+
+void Client::resumeFromJournal(DownloadSession& session, const std::string& destination_path) {
+    const PieceLayout& layout = *session.layout;
+    DownloadJournal& journal = session.journal;
+    
+    journal.destination_path = destination_path;
+    journal.key = session.key;
+    journal.by_hash = session.request_type == MessageType::FILE_BY_HASH_REQUEST;
+    journal.merkle_root = layout.root;
+    journal.file_size = layout.file_size;
+    journal.piece_size = layout.piece_size;
+    
+    DownloadJournal saved;
+    if (DownloadJournal::load(destination_path, saved) && saved.merkle_root == layout.root &&
+        saved.file_size == layout.file_size && saved.piece_size == layout.piece_size) {
+        journal.sources = saved.sources;
+        
+        // Only trust what is actually on disk: re-hash the pieces the journal lists
+        std::vector<uint8_t> data;
+        for (size_t index = 0; index < layout.pieceCount(); ++index) {
+            if (saved.hasPiece(index) && session.writer->readPiece(index, data) &&
+                layout.verifyPiece(index, data.data(), data.size())) {
+                session.writer->markPieceComplete(index);
+                session.progress->downloaded_size += data.size();
+                ++session.resumed_pieces;
+            }
+        }
+        
+        std::cout << "Resuming " << session.key << ": " << session.resumed_pieces << " of "
+                  << layout.pieceCount() << " pieces already on disk" << std::endl;
+    }
+    
+    journal.addSource(remote_address, remote_port);
+    saveJournal(session);
+}
+
+void Client::saveJournal(DownloadSession& session) {
+    if (!session.layout || !session.writer) {
+        return;
+    }
+    try {
+        session.writer->flush();
+    } catch (const std::exception& e) {
+        std::cerr << "Error flushing download: " << e.what() << std::endl;
+    }
+    session.journal.bitmap = session.writer->getBitmap();
+    session.journal.save();
+    session.bytes_since_save = 0;
+}
+
+bool Client::transferMissing(DownloadSession& session) {
+    const PieceLayout* layout = session.layout.get();
+    if (!layout) {
+        // Size unknown, whole file in one go
+        if (!receiveRange(session, 0, 0)) {
+            return false;
+        }
+        session.verifier->drain();
+        return true;
+    }
+    
+    // Blocks from a dropped connection must land before the bitmap is read
+    session.verifier->drain();
+    
+    // One offset request per run of missing pieces
+    size_t count = layout->pieceCount();
+    for (size_t first = 0; first < count; ) {
+        if (session.writer->isPieceComplete(first)) {
+            ++first;
+            continue;
+        }
+        
+        size_t last = first;
+        while (last + 1 < count && !session.writer->isPieceComplete(last + 1)) {
+            ++last;
+        }
+        
+        // A piece cut off mid-way is sent again from its start
+        for (size_t index = first; index <= last; ++index) {
+            session.writer->invalidatePiece(index);
+        }
+        
+        size_t offset = layout->pieceOffset(first);
+        size_t end = layout->pieceOffset(last) + layout->pieceLength(last);
+        if (!receiveRange(session, offset, end - offset)) {
+            return false;
+        }
+        first = last + 1;
+    }
+    
+    // Pieces that failed verification are missing again once this returns
+    session.verifier->drain();
+    return true;
+}
+
+bool Client::receiveRange(DownloadSession& session, size_t offset, size_t length) {
+    DownloadProgress& progress = *session.progress;
+    size_t piece_size = session.layout ? session.layout->piece_size : PIECE_SIZE;
+    
+    try {
+        sendFileRequest(session.request_type, session.key, offset, length);
+    } catch (const std::runtime_error&) {
+        return false;
+    }
+    
+    size_t cursor = offset;
+    
+    while (true) {
+        std::vector<uint8_t> response;
+        try {
+            response = receiveMessage();
+        } catch (const std::runtime_error&) {
+            return false;  // Connection lost, what arrived so far is kept
+        }
+        if (response.empty()) {
+            return false;
+        }
+        
+        MessageType msg_type = static_cast<MessageType>(response[0]);
+        
+        switch (msg_type) {
+            case MessageType::FILE_CHUNK: {
+                // The frame as received, type byte skipped; hashing and the disk
+                // write happen on the verifier's thread, straight from it
+                size_t chunk_size = response.size() - 1;
+                if (length > 0 && cursor - offset + chunk_size > length) {
+                    throw std::runtime_error("Peer sent more than the " + std::to_string(length) +
+                                             " bytes requested");
                 }
+                session.verifier->push(cursor, std::move(response), 1);
+                cursor += chunk_size;
+                progress.downloaded_size += chunk_size;
                 
-                case MessageType::FILE_COMPLETE: {
-                    progress->completed.store(true);
-                    progress->total_size = total_downloaded;
-                    std::cout << "Download completed: " << filename << " (" << total_downloaded << " bytes)" << std::endl;
-                    return true;
+                // Under the scheduler: stop here, or hold off reading on
+                // until the bandwidth share has paid for this chunk
+                if (session.control) {
+                    session.control->consume(chunk_size);
+                    while (!session.control->hasBudget() && !session.control->isStopping()) {
+                        std::this_thread::sleep_for(std::chrono::milliseconds(THROTTLE_WAIT_MS));
+                    }
+                    if (session.control->isStopping()) {
+                        return false;  // The rest of the range is left on the connection
+                    }
                 }
                 
-                case MessageType::ERROR_MESSAGE: {
-                    std::string error_msg(data.begin(), data.end());
-                    progress->failed.store(true);
-                    progress->error_message = error_msg;
-                    throw std::runtime_error("Server error: " + error_msg);
+                session.bytes_since_save += chunk_size;
+                if (session.bytes_since_save >= JOURNAL_SAVE_INTERVAL * piece_size) {
+                    saveJournal(session);
                 }
                 
-                default:
-                    std::cerr << "Unexpected message type during download: " << static_cast<int>(msg_type) << std::endl;
-                    break;
+                // Update speed calculation
+                auto now = std::chrono::steady_clock::now();
+                auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - session.last_update);
+                if (elapsed.count() > 1000) {  // Update every second
+                    auto total_elapsed = std::chrono::duration_cast<std::chrono::seconds>(now - progress.start_time);
+                    if (total_elapsed.count() > 0) {
+                        progress.speed_mbps = (progress.downloaded_size / 1024.0 / 1024.0) / total_elapsed.count();
+                    }
+                    session.last_update = now;
+                }
+                break;
             }
+            
+            case MessageType::FILE_COMPLETE: {
+                if (session.layout && cursor - offset != length) {
+                    throw std::runtime_error("Size mismatch: got " + std::to_string(cursor - offset) +
+                                             " of " + std::to_string(length) + " bytes");
+                }
+                return true;
+            }
+            
+            case MessageType::ERROR_MESSAGE: {
+                throw std::runtime_error("Server error: " + std::string(response.begin() + 1, response.end()));
+            }
+            
+            default:
+                std::cerr << "Unexpected message type during download: " << static_cast<int>(msg_type) << std::endl;
+                break;
+        }
+    }
+}
+
+bool Client::reconnect(const std::string& address, int port) {
+    for (int attempt = 0; attempt < MAX_RESUME_ATTEMPTS; ++attempt) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(RECONNECT_DELAY_MS << attempt));
+        if (connect(address, port)) {
+            return true;
         }
-        
-        return false;
-        
-    } catch (const std::exception& e) {
-        progress->failed.store(true);
-        progress->error_message = e.what();
-        std::cerr << "Download failed: " << e.what() << std::endl;
-        return false;
     }
+    return false;
+}
+
+bool Client::refetchPiece(MessageType request_type, const std::string& filename,
+                          const PieceLayout& layout, size_t index, DownloadWriter& writer) {
+    std::vector<uint8_t> data;
+    
+    for (int attempt = 0; attempt < MAX_PIECE_RETRIES; ++attempt) {
+        if (fetchPiece(request_type, filename, layout, index, data)) {
+            writer.writePiece(index, data.data(), data.size());
+            return true;
+        }
+        std::cerr << "Piece " << index << " of " << filename << " failed verification, retrying" << std::endl;
+    }
+    
+    return false;
 }
 
 bool Client::downloadFileFromPeer(const std::string& filename, 
                                  const std::string& peer_address, 
                                  int peer_port,
                                  const std::string& destination_path) {
-    Client peer_client;
-    if (!peer_client.connect(peer_address, peer_port)) {
+    auto peer_client = ConnectionPool::shared().acquire(peer_address, peer_port);
+    if (!peer_client) {
         return false;
     }
     
-    bool result = peer_client.downloadFile(filename, destination_path);
-    peer_client.disconnect();
+    bool result = peer_client->downloadFile(filename, destination_path);
+    if (!result) {
+        peer_client.invalidate();  // May have stopped mid-transfer
+    }
     return result;
 }
 
+bool Client::downloadFileByHashFromPeer(const std::string& hash,
+                                        const std::string& peer_address,
+                                        int peer_port,
+                                        const std::string& destination_path,
+                                        const std::string& expected_root) {
+    auto peer_client = ConnectionPool::shared().acquire(peer_address, peer_port);
+    if (!peer_client) {
+        return false;
+    }
+    
+    bool result = peer_client->downloadFileByHash(hash, destination_path, expected_root);
+    if (!result) {
+        peer_client.invalidate();
+    }
+    return result;
+}
+
+bool Client::downloadFileMultiSource(const std::string& filename,
+                                     const std::vector<std::shared_ptr<Peer>>& sources,
+                                     const std::string& destination_path, DownloadControl* control) {
+    return downloadFromMultipleSources(MessageType::FILE_REQUEST, filename, sources, destination_path, "", control);
+}
+
+bool Client::downloadFileMultiSourceByHash(const std::string& hash,
+                                           const std::vector<std::shared_ptr<Peer>>& sources,
+                                           const std::string& destination_path,
+                                           const std::string& expected_root, DownloadControl* control) {
+    return downloadFromMultipleSources(MessageType::FILE_BY_HASH_REQUEST, hash, sources,
+                                       destination_path, expected_root, control);
+}
+
+void Client::discardDownload(const std::string& destination_path) {
+    std::error_code error;
+    std::filesystem::remove(destination_path + DownloadWriter::PART_SUFFIX, error);
+    DownloadJournal::remove(destination_path);
+}
+
+bool Client::downloadFromMultipleSources(MessageType request_type, const std::string& key,
+                                         const std::vector<std::shared_ptr<Peer>>& sources,
+                                         const std::string& destination_path,
+                                         const std::string& expected_root, DownloadControl* control) {
+    // Piece hashes are what let pieces from different peers be checked and
+    // put together; take them from the first source that has them
+    ConnectionPool::Lease layout_client;
+    std::shared_ptr<const PieceLayout> layout;
+    for (const auto& peer : sources) {
+        layout_client = ConnectionPool::shared().acquire(peer->getIpAddress(), peer->getPort());
+        if (!layout_client) {
+            continue;
+        }
+        try {
+            layout = layout_client->requestPieceLayout(key, expected_root);
+        } catch (const std::runtime_error&) {
+            layout_client.invalidate();  // Try the next source
+        }
+        if (layout) {
+            break;
+        }
+    }
+    
+    if (!layout) {
+        // Nothing to verify pieces against, so one source at a time, each
+        // still paused, cancelled and throttled through control
+        for (const auto& peer : sources) {
+            if (control && control->isStopping()) {
+                return false;
+            }
+            auto started = std::chrono::steady_clock::now();
+            auto peer_client = ConnectionPool::shared().acquire(peer->getIpAddress(), peer->getPort());
+            bool success = peer_client &&
+                peer_client->downloadContent(request_type, key, destination_path, expected_root, control);
+            if (peer_client && !success) {
+                peer_client.invalidate();  // May have stopped mid-transfer
+            }
+            if (!success && control && control->isStopping()) {
+                return false;
+            }
+            auto busy = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started);
+            
+            std::error_code error;
+            size_t bytes = success ? std::filesystem::file_size(destination_path, error) : 0;
+            reportSource({peer->getIpAddress(), peer->getPort(), error ? 0 : bytes, busy,
+                          std::chrono::microseconds(0), success ? 1u : 0u, success ? 0u : 1u});
+            if (success) {
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    auto progress = trackDownload(key, control);
+    progress->total_size = layout->file_size;
+    progress->active_sources = sources.size();
+    
+    DownloadSession session;
+    session.request_type = request_type;
+    session.key = key;
+    session.layout = layout;
+    session.progress = progress;
+    session.last_update = progress->start_time;
+    
+    try {
+        session.writer = std::make_unique<DownloadWriter>(destination_path, layout->file_size, layout->piece_size);
+        layout_client->resumeFromJournal(session, destination_path);
+        layout_client.release();
+        for (const auto& peer : sources) {
+            session.journal.addSource(peer->getIpAddress(), peer->getPort());
+        }
+        session.verifier = std::make_unique<DownloadVerifier>(*session.writer, layout);
+        
+        bool complete;
+        {
+            SwarmDownloader swarm(request_type, key, layout, *session.writer, *session.verifier, progress);
+            swarm.setControl(control);
+            for (const auto& peer : sources) {
+                swarm.addSource(peer->getIpAddress(), peer->getPort());
+            }
+            complete = swarm.run(JOURNAL_SAVE_INTERVAL, [this, &session]() { saveJournal(session); });
+            for (size_t source = 0; source < swarm.getSourceCount(); ++source) {
+                reportSource(swarm.getSourceReport(source));
+            }
+        }
+        
+        if (!complete && control && control->isStopping()) {
+            return stopDownload(session, destination_path, control->isCancelled());
+        }
+        if (!complete || !session.writer->commit()) {
+            throw std::runtime_error("All sources failed, " + std::to_string(session.writer->completedPieces()) +
+                                     " of " + std::to_string(session.writer->pieceCount()) +
+                                     " pieces kept for resume");
+        }
+        DownloadJournal::remove(destination_path);
+        
+        progress->completed.store(true);
+        std::cout << "Download completed: " << key << " (" << layout->file_size << " bytes, "
+                  << layout->pieceCount() << " pieces verified from " << sources.size() << " source(s), "
+                  << session.verifier->getBadPieces() << " re-fetched, "
+                  << progress->speed_mbps << " MB/s";
+        if (session.resumed_pieces > 0) {
+            std::cout << ", " << session.resumed_pieces << " resumed from disk";
+        }
+        std::cout << ")" << std::endl;
+        return true;
+        
+    } catch (const std::exception& e) {
+        return abandonDownload(session, e.what());
+    }
+}
+
+std::vector<std::shared_ptr<Peer>> Client::raceSources(const std::vector<std::shared_ptr<Peer>>& candidates,
+                                                       size_t max_sources, std::chrono::milliseconds timeout) {
+    std::vector<std::pair<std::string, int>> endpoints;
+    endpoints.reserve(candidates.size());
+    for (const auto& peer : candidates) {
+        endpoints.emplace_back(peer->getIpAddress(), peer->getPort());
+    }
+    
+    auto winners = AsyncClient::shared().race(endpoints, max_sources, timeout).get();
+    std::sort(winners.begin(), winners.end());
+    
+    std::vector<std::shared_ptr<Peer>> sources;
+    sources.reserve(winners.size());
+    for (size_t index : winners) {
+        sources.push_back(candidates[index]);
+    }
+    return sources;
+}
+
+void Client::reportSource(const SourceReport& report) {
+    if (source_observer) {
+        source_observer(report);
+    }
+}
+
 std::shared_ptr<DownloadProgress> Client::getDownloadProgress(const std::string& filename) {
     std::lock_guard<std::mutex> lock(downloads_mutex);
     auto it = active_downloads.find(filename);
@@ -314,6 +812,16 @@ void Client::sendPing() {
     sendMessage(MessageType::PING, {});
 }
 
+bool Client::ping() {
+    try {
+        sendMessage(MessageType::PING, {});
+        auto response = receiveMessage();
+        return !response.empty() && response[0] == static_cast<uint8_t>(MessageType::PONG);
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
 bool Client::sendPong() {
     try {
         sendMessage(MessageType::PONG, {});
@@ -0,0 +1,158 @@
+#include "ConnectionPool.h"
+
+ConnectionPool::Lease::Lease(ConnectionPool* owner, std::string peer_key, std::unique_ptr<Client> connection)
+    : pool(owner), key(std::move(peer_key)), client(std::move(connection)),
+      uncaught(std::uncaught_exceptions()) {}
+
+ConnectionPool::Lease::~Lease() {
+    // Unwinding from a failed exchange: whatever is left on the socket can't be trusted
+    if (std::uncaught_exceptions() > uncaught) {
+        invalidate();
+    }
+    release();
+}
+
+ConnectionPool::Lease::Lease(Lease&& other) noexcept
+    : pool(other.pool), key(std::move(other.key)), client(std::move(other.client)),
+      uncaught(other.uncaught) {
+    other.pool = nullptr;
+}
+
+ConnectionPool::Lease& ConnectionPool::Lease::operator=(Lease&& other) noexcept {
+    if (this != &other) {
+        release();
+        pool = other.pool;
+        key = std::move(other.key);
+        client = std::move(other.client);
+        uncaught = other.uncaught;
+        other.pool = nullptr;
+    }
+    return *this;
+}
+
+void ConnectionPool::Lease::invalidate() {
+    client.reset();  // Disconnects
+}
+
+void ConnectionPool::Lease::release() {
+    if (pool && client && client->isConnected()) {
+        pool->park(key, std::move(client));
+    }
+    client.reset();
+    pool = nullptr;
+}
+
+std::string ConnectionPool::keyFor(const std::string& address, int port) {
+    return address + ":" + std::to_string(port);
+}
+
+ConnectionPool::Lease ConnectionPool::acquire(const std::string& address, int port) {
+    std::string key = keyFor(address, port);
+
+    // Newest parked first; it is the least likely to have been dropped
+    while (true) {
+        IdleConnection candidate;
+        {
+            std::lock_guard<std::mutex> lock(pool_mutex);
+            auto it = idle.find(key);
+            if (it == idle.end() || it->second.empty()) {
+                break;
+            }
+            candidate = std::move(it->second.back());
+            it->second.pop_back();
+        }
+
+        auto idle_for = std::chrono::steady_clock::now() - candidate.since;
+        if (idle_for > std::chrono::seconds(IDLE_TIMEOUT_SECONDS)) {
+            ++evicted;
+            continue;
+        }
+        if (!candidate.client->isHealthy() ||
+            (idle_for > std::chrono::seconds(PING_AFTER_IDLE_SECONDS) && !candidate.client->ping())) {
+            ++failed_checks;
+            continue;
+        }
+
+        ++hits;
+        return Lease(this, key, std::move(candidate.client));
+    }
+
+    ++misses;
+    auto client = std::make_unique<Client>();
+    if (!client->connect(address, port)) {
+        return Lease();
+    }
+    client->enableKeepAlive(KEEPALIVE_IDLE_SECONDS);
+    return Lease(this, key, std::move(client));
+}
+
+void ConnectionPool::park(const std::string& key, std::unique_ptr<Client> client) {
+    std::unique_ptr<Client> surplus;  // Closed outside the lock
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    auto& connections = idle[key];
+    if (connections.size() >= MAX_IDLE_PER_PEER) {
+        surplus = std::move(connections.front().client);
+        connections.erase(connections.begin());
+        ++evicted;
+    }
+    connections.push_back({std::move(client), std::chrono::steady_clock::now()});
+}
+
+void ConnectionPool::evictIdle() {
+    auto cutoff = std::chrono::steady_clock::now() - std::chrono::seconds(IDLE_TIMEOUT_SECONDS);
+    std::vector<std::unique_ptr<Client>> expired;
+
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        for (auto it = idle.begin(); it != idle.end(); ) {
+            auto& connections = it->second;
+            auto fresh = std::stable_partition(connections.begin(), connections.end(),
+                [&](const IdleConnection& connection) { return connection.since < cutoff; });
+            for (auto stale = connections.begin(); stale != fresh; ++stale) {
+                expired.push_back(std::move(stale->client));
+            }
+            connections.erase(connections.begin(), fresh);
+            it = connections.empty() ? idle.erase(it) : std::next(it);
+        }
+    }
+    evicted += expired.size();
+}
+
+void ConnectionPool::closePeer(const std::string& address, int port) {
+    std::vector<IdleConnection> connections;
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    auto it = idle.find(keyFor(address, port));
+    if (it != idle.end()) {
+        connections.swap(it->second);
+        idle.erase(it);
+    }
+}
+
+void ConnectionPool::clear() {
+    std::unordered_map<std::string, std::vector<IdleConnection>> connections;
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    connections.swap(idle);
+}
+
+ConnectionPoolStats ConnectionPool::getStats() const {
+    ConnectionPoolStats stats;
+    stats.hits = hits.load();
+    stats.misses = misses.load();
+    stats.evicted = evicted.load();
+    stats.failed_checks = failed_checks.load();
+
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    stats.idle = 0;
+    for (const auto& [key, connections] : idle) {
+        stats.idle += connections.size();
+    }
+    return stats;
+}
+
+ConnectionPool& ConnectionPool::shared() {
+    // The engine first, so it is destroyed after the Clients parked here
+    // have closed their connections on it
+    AsyncClient::shared();
+    static ConnectionPool pool;
+    return pool;
+}
@@ -0,0 +1,176 @@
+#include "DirectoryScanner.h"
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+// Kernel record layout for getdents64; glibc only exposes it from 2.30 on
+struct LinuxDirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+};
+
+} // namespace
+
+DirectoryScanner::DirectoryScanner(size_t threads) : active_dirs(0) {
+    num_threads = threads ? threads : std::max(1u, std::thread::hardware_concurrency());
+}
+
+void DirectoryScanner::scan(const std::string& root, BoundedQueue<ScanEntry>& out, const Filter& filter) {
+    {
+        std::lock_guard<std::mutex> lock(dirs_mutex);
+        pending_dirs.clear();
+        pending_dirs.push_back(root);
+        active_dirs = 0;
+    }
+    directories_scanned = 0;
+    files_found = 0;
+    errors = 0;
+
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < num_threads; ++i) {
+        workers.emplace_back([&]() { worker(out, filter); });
+    }
+    worker(out, filter);
+
+    for (auto& t : workers) {
+        t.join();
+    }
+    out.close();
+}
+
+std::vector<ScanEntry> DirectoryScanner::scanAll(const std::string& root, const Filter& filter) {
+    BoundedQueue<ScanEntry> queue(SCAN_QUEUE_CAPACITY);
+    std::thread walker([&]() { scan(root, queue, filter); });
+
+    std::vector<ScanEntry> entries;
+    ScanEntry entry;
+    while (queue.pop(entry)) {
+        entries.push_back(std::move(entry));
+    }
+
+    walker.join();
+    return entries;
+}
+
+void DirectoryScanner::worker(BoundedQueue<ScanEntry>& out, const Filter& filter) {
+    std::vector<std::string> subdirs;
+
+    while (true) {
+        std::string directory;
+        {
+            std::unique_lock<std::mutex> lock(dirs_mutex);
+            dirs_cv.wait(lock, [this]() { return !pending_dirs.empty() || active_dirs == 0; });
+            if (pending_dirs.empty()) {
+                return;  // Nothing queued and nobody left to find more
+            }
+
+            // Depth first keeps the pending list short on wide trees
+            directory = std::move(pending_dirs.back());
+            pending_dirs.pop_back();
+            ++active_dirs;
+        }
+
+        subdirs.clear();
+        readDirectory(directory, out, filter, subdirs);
+
+        {
+            std::lock_guard<std::mutex> lock(dirs_mutex);
+            for (auto& subdir : subdirs) {
+                pending_dirs.push_back(std::move(subdir));
+            }
+            --active_dirs;
+        }
+        dirs_cv.notify_all();
+    }
+}
+
+void DirectoryScanner::readDirectory(const std::string& directory, BoundedQueue<ScanEntry>& out,
+                                     const Filter& filter, std::vector<std::string>& subdirs) {
+    int dir_fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd < 0) {
+        std::cerr << "Cannot open directory " << directory << ": " << strerror(errno) << std::endl;
+        ++errors;
+        return;
+    }
+    ++directories_scanned;
+
+    std::string prefix = directory;
+    if (prefix.empty() || prefix.back() != '/') {
+        prefix += '/';
+    }
+
+    thread_local std::vector<char> buffer(DIRENT_BUFFER_SIZE);
+
+    while (true) {
+        long bytes = syscall(SYS_getdents64, dir_fd, buffer.data(), buffer.size());
+        if (bytes <= 0) {
+            if (bytes < 0) {
+                std::cerr << "Error reading directory " << directory << ": " << strerror(errno) << std::endl;
+                ++errors;
+            }
+            break;
+        }
+
+        for (long pos = 0; pos < bytes; ) {
+            auto* dirent = reinterpret_cast<LinuxDirent64*>(buffer.data() + pos);
+            pos += dirent->d_reclen;
+
+            const char* name = dirent->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+
+            if (dirent->d_type == DT_DIR) {
+                subdirs.push_back(prefix + name);
+                continue;
+            }
+            if (dirent->d_type != DT_REG && dirent->d_type != DT_LNK && dirent->d_type != DT_UNKNOWN) {
+                continue;  // Devices, sockets, fifos
+            }
+
+            // One stat per entry, resolved against the open directory
+            ScanEntry entry;
+            int flags = dirent->d_type == DT_LNK ? 0 : AT_SYMLINK_NOFOLLOW;
+            if (fstatat(dir_fd, name, &entry.st, flags) != 0) {
+                ++errors;  // Raced with a delete or a dangling link
+                continue;
+            }
+
+            if (dirent->d_type == DT_UNKNOWN) {
+                // Filesystems without d_type: classify from the stat instead
+                if (S_ISDIR(entry.st.st_mode)) {
+                    subdirs.push_back(prefix + name);
+                    continue;
+                }
+                if (S_ISLNK(entry.st.st_mode) && fstatat(dir_fd, name, &entry.st, 0) != 0) {
+                    ++errors;
+                    continue;
+                }
+            }
+
+            // Directory symlinks are not followed, same as the old iterator
+            if (!S_ISREG(entry.st.st_mode)) {
+                continue;
+            }
+            if (filter && !filter(name)) {
+                continue;
+            }
+
+            entry.path = prefix + name;
+            ++files_found;
+            if (!out.push(std::move(entry))) {
+                close(dir_fd);  // Consumer gave up
+                return;
+            }
+        }
+    }
+
+    close(dir_fd);
+}
@@ -0,0 +1,165 @@
+#include "DownloadJournal.h"
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+bool DownloadJournal::hasPiece(size_t index) const {
+    return index / 8 < bitmap.size() && (bitmap[index / 8] & (1u << (index % 8)));
+}
+
+void DownloadJournal::addSource(const std::string& address, int port) {
+    std::string source = address + ":" + std::to_string(port);
+    if (std::find(sources.begin(), sources.end(), source) == sources.end()) {
+        sources.push_back(source);
+    }
+}
+
+std::string DownloadJournal::serialize() const {
+    static const char* hex_digits = "0123456789abcdef";
+
+    std::ostringstream oss;
+    oss << FORMAT_TAG << "\n"
+        << destination_path << "\n"
+        << key << "\n"
+        << (by_hash ? 1 : 0) << "|" << file_size << "|" << piece_size << "|" << merkle_root << "\n";
+
+    for (size_t i = 0; i < sources.size(); ++i) {
+        oss << (i ? "," : "") << sources[i];
+    }
+    oss << "\n";
+
+    for (uint8_t byte : bitmap) {
+        oss << hex_digits[byte >> 4] << hex_digits[byte & 0x0f];
+    }
+    oss << "\n";
+    return oss.str();
+}
+
+bool DownloadJournal::deserialize(const std::string& data, DownloadJournal& journal) {
+    std::istringstream iss(data);
+    std::string tag, header, source_line, bitmap_hex;
+
+    if (!std::getline(iss, tag) || tag != FORMAT_TAG ||
+        !std::getline(iss, journal.destination_path) ||
+        !std::getline(iss, journal.key) ||
+        !std::getline(iss, header) ||
+        !std::getline(iss, source_line) ||
+        !std::getline(iss, bitmap_hex)) {
+        return false;
+    }
+
+    std::istringstream fields(header);
+    std::string by_hash_str, file_size_str, piece_size_str;
+    if (!std::getline(fields, by_hash_str, '|') ||
+        !std::getline(fields, file_size_str, '|') ||
+        !std::getline(fields, piece_size_str, '|') ||
+        !std::getline(fields, journal.merkle_root)) {
+        return false;
+    }
+
+    try {
+        journal.by_hash = by_hash_str == "1";
+        journal.file_size = std::stoull(file_size_str);
+        journal.piece_size = std::stoull(piece_size_str);
+    } catch (const std::exception&) {
+        return false;
+    }
+
+    journal.sources.clear();
+    std::istringstream source_stream(source_line);
+    std::string source;
+    while (std::getline(source_stream, source, ',')) {
+        if (!source.empty()) {
+            journal.sources.push_back(source);
+        }
+    }
+
+    if (bitmap_hex.size() % 2 != 0) {
+        return false;
+    }
+    journal.bitmap.clear();
+    journal.bitmap.reserve(bitmap_hex.size() / 2);
+    for (size_t i = 0; i < bitmap_hex.size(); i += 2) {
+        try {
+            journal.bitmap.push_back(static_cast<uint8_t>(std::stoul(bitmap_hex.substr(i, 2), nullptr, 16)));
+        } catch (const std::exception&) {
+            return false;
+        }
+    }
+
+    return journal.piece_size > 0;
+}
+
+std::string DownloadJournal::pathFor(const std::string& destination_path) {
+    return destination_path + JOURNAL_SUFFIX;
+}
+
+bool DownloadJournal::save() const {
+    std::string path = pathFor(destination_path);
+    std::string temp_path = path + ".tmp";
+
+    {
+        std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            std::cerr << "Cannot write download journal: " << temp_path << std::endl;
+            return false;
+        }
+        file << serialize();
+        if (!file.good()) {
+            return false;
+        }
+    }
+
+    if (rename(temp_path.c_str(), path.c_str()) < 0) {
+        std::cerr << "Cannot replace download journal " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool DownloadJournal::load(const std::string& destination_path, DownloadJournal& journal) {
+    std::ifstream file(pathFor(destination_path), std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    std::ostringstream oss;
+    oss << file.rdbuf();
+    if (!deserialize(oss.str(), journal)) {
+        std::cerr << "Ignoring corrupt download journal: " << pathFor(destination_path) << std::endl;
+        return false;
+    }
+    journal.destination_path = destination_path;
+    return true;
+}
+
+void DownloadJournal::remove(const std::string& destination_path) {
+    std::error_code ec;
+    std::filesystem::remove(pathFor(destination_path), ec);
+}
+
+std::vector<DownloadJournal> DownloadJournal::findAll(const std::string& directory) {
+    std::vector<DownloadJournal> journals;
+    std::error_code ec;
+    if (!std::filesystem::is_directory(directory, ec)) {
+        return journals;
+    }
+
+    const std::string suffix = JOURNAL_SUFFIX;
+    for (auto it = std::filesystem::recursive_directory_iterator(directory, ec);
+         it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+        if (ec) {
+            break;
+        }
+        std::string path = it->path().string();
+        if (path.size() <= suffix.size() || path.compare(path.size() - suffix.size(), suffix.size(), suffix) != 0) {
+            continue;
+        }
+
+        DownloadJournal journal;
+        if (load(path.substr(0, path.size() - suffix.size()), journal)) {
+            journals.push_back(std::move(journal));
+        }
+    }
+    return journals;
+}
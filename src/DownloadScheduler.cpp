@@ -0,0 +1,381 @@
+#include "DownloadScheduler.h"
+#include <algorithm>
+
+const char* toString(DownloadPriority priority) {
+    switch (priority) {
+        case DownloadPriority::LOW: return "low";
+        case DownloadPriority::NORMAL: return "normal";
+        case DownloadPriority::HIGH: return "high";
+    }
+    return "unknown";
+}
+
+const char* toString(DownloadState state) {
+    switch (state) {
+        case DownloadState::QUEUED: return "Queued";
+        case DownloadState::RUNNING: return "Running";
+        case DownloadState::PAUSED: return "Paused";
+        case DownloadState::COMPLETED: return "Completed";
+        case DownloadState::FAILED: return "Failed";
+        case DownloadState::CANCELLED: return "Cancelled";
+    }
+    return "Unknown";
+}
+
+void DownloadControl::refillLocked(std::chrono::steady_clock::time_point now) {
+    if (rate > 0.0) {
+        double seconds = std::chrono::duration<double>(now - refilled).count();
+        tokens = std::min(tokens + rate * seconds, rate * BURST_SECONDS);
+    }
+    refilled = now;
+}
+
+void DownloadControl::setRate(double bytes_per_second) {
+    std::lock_guard<std::mutex> lock(rate_mutex);
+    auto now = std::chrono::steady_clock::now();
+    refillLocked(now);
+
+    // Coming off unlimited, start from nothing rather than a burst's worth,
+    // or a short download would mostly run unthrottled
+    if (rate <= 0.0) {
+        tokens = 0.0;
+    }
+    rate = std::max(bytes_per_second, 0.0);
+    tokens = std::min(tokens, rate * BURST_SECONDS);
+}
+
+double DownloadControl::getRate() const {
+    std::lock_guard<std::mutex> lock(rate_mutex);
+    return rate;
+}
+
+bool DownloadControl::hasBudget() {
+    std::lock_guard<std::mutex> lock(rate_mutex);
+    if (rate <= 0.0) {
+        return true;
+    }
+    refillLocked(std::chrono::steady_clock::now());
+    return tokens > 0.0;
+}
+
+void DownloadControl::consume(size_t bytes) {
+    std::lock_guard<std::mutex> lock(rate_mutex);
+    if (rate <= 0.0) {
+        return;
+    }
+    refillLocked(std::chrono::steady_clock::now());
+    tokens -= static_cast<double>(bytes);
+}
+
+void DownloadControl::setProgress(std::shared_ptr<DownloadProgress> download_progress) {
+    std::lock_guard<std::mutex> lock(rate_mutex);
+    progress = std::move(download_progress);
+}
+
+std::shared_ptr<DownloadProgress> DownloadControl::getProgress() const {
+    std::lock_guard<std::mutex> lock(rate_mutex);
+    return progress;
+}
+
+DownloadScheduler::DownloadScheduler(size_t active)
+    : max_active(std::max<size_t>(active, 1)), running(0), bandwidth_limit(0.0),
+      next_sequence(0), stopping(false) {}
+
+DownloadScheduler::~DownloadScheduler() {
+    shutdown();
+}
+
+void DownloadScheduler::addWorkersLocked() {
+    while (workers.size() < max_active) {
+        workers.emplace_back(&DownloadScheduler::workerLoop, this);
+    }
+}
+
+std::shared_ptr<DownloadScheduler::Entry> DownloadScheduler::nextLocked() {
+    std::shared_ptr<Entry> best;
+    for (const auto& entry : entries) {
+        if (entry->state != DownloadState::QUEUED) {
+            continue;
+        }
+        if (!best || entry->priority > best->priority ||
+            (entry->priority == best->priority && entry->sequence < best->sequence)) {
+            best = entry;
+        }
+    }
+    return best;
+}
+
+std::shared_ptr<DownloadScheduler::Entry> DownloadScheduler::findLocked(const std::string& name) const {
+    for (const auto& entry : entries) {
+        if (entry->name == name) {
+            return entry;
+        }
+    }
+    return nullptr;
+}
+
+void DownloadScheduler::rebalanceLocked() {
+    double share = (bandwidth_limit > 0.0 && running > 0) ? bandwidth_limit / running : 0.0;
+    for (const auto& entry : entries) {
+        if (entry->state == DownloadState::RUNNING && entry->control) {
+            entry->control->setRate(share);
+        }
+    }
+}
+
+void DownloadScheduler::workerLoop() {
+    std::unique_lock<std::mutex> lock(scheduler_mutex);
+    while (true) {
+        std::shared_ptr<Entry> entry;
+        work_cv.wait(lock, [&]() {
+            if (stopping) {
+                return true;
+            }
+            entry = running < max_active ? nextLocked() : nullptr;
+            return entry != nullptr;
+        });
+        if (stopping) {
+            return;
+        }
+
+        auto control = std::make_shared<DownloadControl>();
+        entry->state = DownloadState::RUNNING;
+        entry->control = control;
+        ++running;
+        rebalanceLocked();
+
+        Job job = entry->job;
+        lock.unlock();
+        bool complete = false;
+        try {
+            complete = job(*control);
+        } catch (const std::exception& e) {
+            std::cerr << "Download " << entry->name << " failed: " << e.what() << std::endl;
+        }
+        lock.lock();
+
+        --running;
+        if (control->isCancelled()) {
+            entry->state = DownloadState::CANCELLED;
+        } else if (complete) {
+            entry->state = DownloadState::COMPLETED;
+        } else if (control->isPaused()) {
+            // Keeps its place in the queue
+            entry->state = entry->requeue ? DownloadState::QUEUED : DownloadState::PAUSED;
+        } else {
+            entry->state = DownloadState::FAILED;
+        }
+        entry->requeue = false;
+        rebalanceLocked();
+
+        work_cv.notify_all();
+        idle_cv.notify_all();
+    }
+}
+
+bool DownloadScheduler::submit(const std::string& name, Job job, DownloadPriority priority, Discard discard) {
+    {
+        std::lock_guard<std::mutex> lock(scheduler_mutex);
+        if (stopping) {
+            return false;
+        }
+
+        auto existing = findLocked(name);
+        if (existing) {
+            if (existing->state == DownloadState::QUEUED || existing->state == DownloadState::RUNNING ||
+                existing->state == DownloadState::PAUSED) {
+                return false;
+            }
+            entries.remove(existing);   // Finished before; this is a new download
+        }
+
+        auto entry = std::make_shared<Entry>();
+        entry->name = name;
+        entry->priority = priority;
+        entry->state = DownloadState::QUEUED;
+        entry->sequence = next_sequence++;
+        entry->job = std::move(job);
+        entry->discard = std::move(discard);
+        entries.push_back(std::move(entry));
+        addWorkersLocked();
+    }
+    work_cv.notify_all();
+    return true;
+}
+
+bool DownloadScheduler::pause(const std::string& name) {
+    std::lock_guard<std::mutex> lock(scheduler_mutex);
+    auto entry = findLocked(name);
+    if (!entry) {
+        return false;
+    }
+
+    switch (entry->state) {
+        case DownloadState::QUEUED:
+            entry->state = DownloadState::PAUSED;
+            return true;
+        case DownloadState::RUNNING:
+            // Settles as paused once the job returns
+            entry->control->pause();
+            entry->requeue = false;
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool DownloadScheduler::resume(const std::string& name) {
+    {
+        std::lock_guard<std::mutex> lock(scheduler_mutex);
+        auto entry = findLocked(name);
+        if (!entry) {
+            return false;
+        }
+
+        switch (entry->state) {
+            case DownloadState::PAUSED:
+            case DownloadState::FAILED:
+                entry->state = DownloadState::QUEUED;
+                break;
+            case DownloadState::RUNNING:
+                if (!entry->control->isPaused() || entry->control->isCancelled()) {
+                    return false;
+                }
+                entry->requeue = true;
+                return true;
+            default:
+                return false;
+        }
+    }
+    work_cv.notify_all();
+    return true;
+}
+
+bool DownloadScheduler::cancel(const std::string& name) {
+    Discard discard;
+    {
+        std::lock_guard<std::mutex> lock(scheduler_mutex);
+        auto entry = findLocked(name);
+        if (!entry) {
+            return false;
+        }
+
+        switch (entry->state) {
+            case DownloadState::RUNNING:
+                // The job discards its own files on seeing it
+                entry->control->cancel();
+                return true;
+            case DownloadState::QUEUED:
+            case DownloadState::PAUSED:
+            case DownloadState::FAILED:
+                entry->state = DownloadState::CANCELLED;
+                discard = entry->discard;
+                break;
+            default:
+                return false;
+        }
+    }
+    idle_cv.notify_all();
+
+    if (discard) {
+        discard();
+    }
+    return true;
+}
+
+bool DownloadScheduler::setPriority(const std::string& name, DownloadPriority priority) {
+    std::lock_guard<std::mutex> lock(scheduler_mutex);
+    auto entry = findLocked(name);
+    if (!entry || entry->state == DownloadState::COMPLETED || entry->state == DownloadState::CANCELLED) {
+        return false;
+    }
+    entry->priority = priority;
+    return true;
+}
+
+void DownloadScheduler::setMaxActive(size_t downloads) {
+    {
+        std::lock_guard<std::mutex> lock(scheduler_mutex);
+        if (stopping) {
+            return;
+        }
+        max_active = std::max<size_t>(downloads, 1);
+        if (!workers.empty()) {
+            addWorkersLocked();
+        }
+    }
+    work_cv.notify_all();
+}
+
+size_t DownloadScheduler::getMaxActive() const {
+    std::lock_guard<std::mutex> lock(scheduler_mutex);
+    return max_active;
+}
+
+void DownloadScheduler::setBandwidthLimit(double bytes_per_second) {
+    std::lock_guard<std::mutex> lock(scheduler_mutex);
+    bandwidth_limit = std::max(bytes_per_second, 0.0);
+    rebalanceLocked();
+}
+
+double DownloadScheduler::getBandwidthLimit() const {
+    std::lock_guard<std::mutex> lock(scheduler_mutex);
+    return bandwidth_limit;
+}
+
+DownloadState DownloadScheduler::getState(const std::string& name) const {
+    std::lock_guard<std::mutex> lock(scheduler_mutex);
+    auto entry = findLocked(name);
+    return entry ? entry->state : DownloadState::CANCELLED;
+}
+
+std::vector<DownloadScheduler::DownloadInfo> DownloadScheduler::list() const {
+    std::lock_guard<std::mutex> lock(scheduler_mutex);
+    std::vector<DownloadInfo> result;
+    for (const auto& entry : entries) {
+        result.push_back({entry->name, entry->priority, entry->state,
+                          entry->control ? entry->control->getProgress() : nullptr});
+    }
+    return result;
+}
+
+size_t DownloadScheduler::getRunning() const {
+    std::lock_guard<std::mutex> lock(scheduler_mutex);
+    return running;
+}
+
+size_t DownloadScheduler::getQueued() const {
+    std::lock_guard<std::mutex> lock(scheduler_mutex);
+    return std::count_if(entries.begin(), entries.end(),
+                         [](const auto& entry) { return entry->state == DownloadState::QUEUED; });
+}
+
+void DownloadScheduler::waitIdle() {
+    std::unique_lock<std::mutex> lock(scheduler_mutex);
+    idle_cv.wait(lock, [this]() {
+        return stopping || (running == 0 && std::none_of(entries.begin(), entries.end(),
+            [](const auto& entry) { return entry->state == DownloadState::QUEUED; }));
+    });
+}
+
+void DownloadScheduler::shutdown() {
+    std::vector<std::thread> stopped;
+    {
+        std::lock_guard<std::mutex> lock(scheduler_mutex);
+        stopping = true;
+        for (const auto& entry : entries) {
+            if (entry->state == DownloadState::RUNNING) {
+                entry->control->pause();
+            }
+        }
+        stopped.swap(workers);
+    }
+    work_cv.notify_all();
+    idle_cv.notify_all();
+
+    for (auto& worker : stopped) {
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+}
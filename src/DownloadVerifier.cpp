@@ -0,0 +1,198 @@
+#include "DownloadVerifier.h"
+
+DownloadVerifier::DownloadVerifier(DownloadWriter& output, std::shared_ptr<const PieceLayout> piece_layout)
+    : writer(output), layout(std::move(piece_layout)), queue(QUEUE_DEPTH),
+      pushed(0), processed(0), file_offset(0), sequential(true) {
+    worker_thread = std::thread(&DownloadVerifier::run, this);
+}
+
+DownloadVerifier::~DownloadVerifier() {
+    queue.close();
+    if (worker_thread.joinable()) {
+        worker_thread.join();
+    }
+}
+
+void DownloadVerifier::push(size_t offset, std::vector<uint8_t> data, size_t skip) {
+    rethrowError();
+    if (data.size() <= skip) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        ++pushed;
+    }
+    queue.push(Block{offset, std::move(data), skip});
+}
+
+void DownloadVerifier::setPieceCallback(PieceCallback callback) {
+    std::lock_guard<std::mutex> lock(state_mutex);
+    piece_callback = std::move(callback);
+}
+
+void DownloadVerifier::drain() {
+    {
+        std::unique_lock<std::mutex> lock(state_mutex);
+        drained_cv.wait(lock, [this]() { return processed == pushed; });
+    }
+    rethrowError();
+    writer.flush();  // So the writer's bitmap covers everything pushed
+}
+
+void DownloadVerifier::rethrowError() {
+    std::lock_guard<std::mutex> lock(state_mutex);
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+std::string DownloadVerifier::fileHash() {
+    drain();
+
+    bool complete = sequential && bad_pieces.load() == 0 &&
+                    (!layout || file_offset == layout->file_size);
+    if (!complete) {
+        return "";
+    }
+    sequential = false;  // The context is consumed
+    return file_ctx.finishHex();
+}
+
+void DownloadVerifier::run() {
+    Block block;
+    while (queue.pop(block)) {
+        bool failed;
+        {
+            std::lock_guard<std::mutex> lock(state_mutex);
+            failed = static_cast<bool>(error);
+        }
+
+        // After a failure only keep the counters moving so drain() returns
+        if (!failed) {
+            try {
+                process(block);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(state_mutex);
+                error = std::current_exception();
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(state_mutex);
+            ++processed;
+        }
+        drained_cv.notify_all();
+    }
+}
+
+void DownloadVerifier::process(Block& block) {
+    size_t offset = block.offset;
+    const uint8_t* data = block.data.data() + block.skip;
+    size_t length = block.data.size() - block.skip;
+
+    // Whole-file hash, as long as the stream is in order. A range sent again
+    // after a reconnect overlaps what was hashed already; only the new tail counts.
+    if (sequential) {
+        if (offset <= file_offset && offset + length > file_offset) {
+            size_t skip = file_offset - offset;
+            file_ctx.update(data + skip, length - skip);
+            file_offset += length - skip;
+        } else if (offset > file_offset) {
+            sequential = false;
+        }
+    }
+
+    // Pieces are checked as their bytes come in, whatever the order
+    if (layout) {
+        size_t position = offset;
+        const uint8_t* cursor = data;
+        size_t remaining = length;
+        while (remaining > 0 && position < layout->file_size) {
+            size_t index = position / layout->piece_size;
+            size_t offset_in_piece = position - layout->pieceOffset(index);
+            size_t take = std::min(remaining, layout->pieceLength(index) - offset_in_piece);
+            hashPiece(index, offset_in_piece, cursor, take);
+            position += take;
+            cursor += take;
+            remaining -= take;
+        }
+    }
+
+    writer.write(offset, std::move(block.data), block.skip);
+
+    // Failed pieces go back to missing once their bytes are on disk
+    if (!failed_pieces.empty()) {
+        writer.flush();
+        for (size_t index : failed_pieces) {
+            writer.invalidatePiece(index);
+        }
+        failed_pieces.clear();
+    }
+    
+    if (!checked_pieces.empty()) {
+        PieceCallback callback;
+        {
+            std::lock_guard<std::mutex> lock(state_mutex);
+            callback = piece_callback;
+        }
+        if (callback) {
+            for (const auto& [index, valid] : checked_pieces) {
+                callback(index, valid);
+            }
+        }
+        checked_pieces.clear();
+    }
+}
+
+void DownloadVerifier::hashPiece(size_t index, size_t offset_in_piece, const uint8_t* data, size_t length) {
+    PieceState& state = pieces[index];
+
+    if (offset_in_piece == 0 && state.filled > 0) {
+        // The piece is being sent again from its start; forget the partial one
+        state.ctx.reset();
+        state.filled = 0;
+        state.early.clear();
+    }
+
+    if (offset_in_piece == state.filled) {
+        feedPiece(index, state, data, length);
+    } else if (offset_in_piece > state.filled) {
+        state.early[offset_in_piece].assign(data, data + length);
+    }
+    // Below filled: a duplicate of bytes already hashed, nothing to do
+}
+
+void DownloadVerifier::feedPiece(size_t index, PieceState& state, const uint8_t* data, size_t length) {
+    state.ctx.update(data, length);
+    state.filled += length;
+
+    // Blocks that were waiting for this one
+    auto it = state.early.begin();
+    while (it != state.early.end() && it->first <= state.filled) {
+        size_t skip = state.filled - it->first;
+        if (skip < it->second.size()) {
+            state.ctx.update(it->second.data() + skip, it->second.size() - skip);
+            state.filled += it->second.size() - skip;
+        }
+        it = state.early.erase(it);
+    }
+
+    checkPiece(index, state);
+}
+
+void DownloadVerifier::checkPiece(size_t index, PieceState& state) {
+    if (state.filled < layout->pieceLength(index)) {
+        return;
+    }
+
+    bool valid = index < layout->piece_hashes.size() && state.ctx.finishHex() == layout->piece_hashes[index];
+    if (valid) {
+        ++verified_pieces;
+    } else {
+        ++bad_pieces;
+        failed_pieces.push_back(index);  // Invalidated in process() after the write
+    }
+    checked_pieces.emplace_back(index, valid);
+    pieces.erase(index);
+}
@@ -0,0 +1,294 @@
+#include "DownloadWriter.h"
+#include <cstring>
+#include <sys/stat.h>
+
+DownloadWriter::DownloadWriter(const std::string& destination, size_t size, size_t piece)
+    : destination_path(destination), part_path(destination + PART_SUFFIX), fd(-1),
+      file_size(size), piece_size(piece ? piece : PIECE_SIZE), completed_pieces(0),
+      batch_offset(0), batch_bytes(0), committed(false) {
+    fd = open(part_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot create destination file: " + part_path + ": " + strerror(errno));
+    }
+
+    if (file_size > 0) {
+        // Reserve every block now; filesystems without fallocate just get the size
+        struct stat st;
+        if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) != file_size &&
+            ftruncate(fd, 0) < 0) {
+            std::cerr << "Cannot reset " << part_path << ": " << strerror(errno) << std::endl;
+        }
+        if (fallocate(fd, 0, 0, file_size) < 0 && ftruncate(fd, file_size) < 0) {
+            int err = errno;
+            close(fd);
+            throw std::runtime_error("Cannot allocate " + std::to_string(file_size) +
+                                     " bytes for " + part_path + ": " + strerror(err));
+        }
+    } else if (ftruncate(fd, 0) < 0) {
+        std::cerr << "Cannot reset " << part_path << ": " << strerror(errno) << std::endl;
+    }
+
+    size_t pieces = pieceCount();
+    bitmap.assign((pieces + 7) / 8, 0);
+    piece_bytes.assign(pieces, 0);
+}
+
+DownloadWriter::~DownloadWriter() {
+    try {
+        flush();
+    } catch (const std::exception& e) {
+        std::cerr << "Error flushing " << part_path << ": " << e.what() << std::endl;
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+size_t DownloadWriter::pieceCount() const {
+    return file_size == 0 ? 0 : (file_size + piece_size - 1) / piece_size;
+}
+
+void DownloadWriter::write(size_t offset, const uint8_t* data, size_t length) {
+    write(offset, std::vector<uint8_t>(data, data + length));
+}
+
+void DownloadWriter::write(size_t offset, std::vector<uint8_t> data, size_t skip) {
+    if (data.size() <= skip) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(writer_mutex);
+    if (fd < 0) {
+        throw std::runtime_error("Download already finished: " + part_path);
+    }
+    
+    // Nothing past the end: a longer part file fails the size check on
+    // resume, which would throw away every piece already verified
+    if (file_size > 0 && offset + (data.size() - skip) > file_size) {
+        if (offset >= file_size) {
+            BufferPool::shared().release(std::move(data));
+            return;
+        }
+        data.resize(skip + (file_size - offset));
+    }
+    
+    if (!batch.empty() && offset != batch_offset + batch_bytes) {
+        flushLocked();
+    }
+    if (batch.empty()) {
+        batch_offset = offset;
+    }
+
+    batch_bytes += data.size() - skip;
+    batch.push_back({std::move(data), skip});
+
+    if (batch.size() >= MAX_BATCH_BUFFERS || batch_bytes >= MAX_BATCH_BYTES) {
+        flushLocked();
+    }
+}
+
+void DownloadWriter::flush() {
+    std::lock_guard<std::mutex> lock(writer_mutex);
+    flushLocked();
+}
+
+void DownloadWriter::flushLocked() {
+    if (batch.empty()) {
+        return;
+    }
+
+    // Take the run first so a failed write doesn't leave it queued
+    std::vector<Buffer> buffers;
+    buffers.swap(batch);
+    size_t offset = batch_offset;
+    size_t length = batch_bytes;
+    batch_bytes = 0;
+
+    std::vector<struct iovec> iov;
+    iov.reserve(buffers.size());
+    for (auto& buffer : buffers) {
+        iov.push_back({buffer.data.data() + buffer.skip, buffer.data.size() - buffer.skip});
+    }
+
+    pwriteAll(offset, iov);
+    accountLocked(offset, length);
+
+    for (auto& buffer : buffers) {
+        BufferPool::shared().release(std::move(buffer.data));
+    }
+}
+
+void DownloadWriter::pwriteAll(size_t offset, std::vector<struct iovec>& iov) {
+    size_t first = 0;
+    while (first < iov.size()) {
+        ssize_t written = pwritev(fd, iov.data() + first, static_cast<int>(iov.size() - first), offset);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error("Write to " + part_path + " failed: " + strerror(errno));
+        }
+
+        // Short write: skip what made it and retry the rest
+        offset += written;
+        size_t remaining = static_cast<size_t>(written);
+        while (first < iov.size() && remaining >= iov[first].iov_len) {
+            remaining -= iov[first].iov_len;
+            ++first;
+        }
+        if (first < iov.size()) {
+            iov[first].iov_base = static_cast<uint8_t*>(iov[first].iov_base) + remaining;
+            iov[first].iov_len -= remaining;
+        }
+    }
+}
+
+void DownloadWriter::accountLocked(size_t offset, size_t length) {
+    size_t end = std::min(offset + length, file_size);
+    while (offset < end) {
+        size_t index = offset / piece_size;
+        size_t piece_end = std::min((index + 1) * piece_size, file_size);
+        size_t span = std::min(end, piece_end) - offset;
+
+        if (!pieceCompleteLocked(index)) {
+            piece_bytes[index] += static_cast<uint32_t>(span);
+            if (piece_bytes[index] >= piece_end - index * piece_size) {
+                setPieceLocked(index, true);
+            }
+        }
+        offset += span;
+    }
+}
+
+void DownloadWriter::setPieceLocked(size_t index, bool complete) {
+    uint8_t mask = static_cast<uint8_t>(1u << (index % 8));
+    bool was_complete = bitmap[index / 8] & mask;
+    if (complete == was_complete) {
+        return;
+    }
+
+    if (complete) {
+        bitmap[index / 8] |= mask;
+        ++completed_pieces;
+    } else {
+        bitmap[index / 8] &= static_cast<uint8_t>(~mask);
+        --completed_pieces;
+    }
+}
+
+void DownloadWriter::writePiece(size_t index, const uint8_t* data, size_t length) {
+    std::lock_guard<std::mutex> lock(writer_mutex);
+    if (index >= pieceCount()) {
+        throw std::runtime_error("Piece " + std::to_string(index) + " out of range for " + part_path);
+    }
+    flushLocked();
+
+    length = std::min(length, file_size - index * piece_size);
+    std::vector<struct iovec> iov = {{const_cast<uint8_t*>(data), length}};
+    pwriteAll(index * piece_size, iov);
+    setPieceLocked(index, true);
+}
+
+void DownloadWriter::invalidatePiece(size_t index) {
+    std::lock_guard<std::mutex> lock(writer_mutex);
+    if (index < pieceCount()) {
+        setPieceLocked(index, false);
+        piece_bytes[index] = 0;  // Also forget a partial piece, it will be sent again from the start
+    }
+}
+
+void DownloadWriter::markPieceComplete(size_t index) {
+    std::lock_guard<std::mutex> lock(writer_mutex);
+    if (index < pieceCount()) {
+        setPieceLocked(index, true);
+    }
+}
+
+bool DownloadWriter::readPiece(size_t index, std::vector<uint8_t>& data) {
+    std::lock_guard<std::mutex> lock(writer_mutex);
+    if (fd < 0 || index >= pieceCount()) {
+        return false;
+    }
+    flushLocked();
+
+    size_t offset = index * piece_size;
+    data.resize(std::min(piece_size, file_size - offset));
+    size_t total = 0;
+    while (total < data.size()) {
+        ssize_t got = pread(fd, data.data() + total, data.size() - total, offset + total);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return false;
+        }
+        total += got;
+    }
+    return true;
+}
+
+bool DownloadWriter::pieceCompleteLocked(size_t index) const {
+    return index < piece_bytes.size() && (bitmap[index / 8] & (1u << (index % 8)));
+}
+
+bool DownloadWriter::isPieceComplete(size_t index) const {
+    std::lock_guard<std::mutex> lock(writer_mutex);
+    return pieceCompleteLocked(index);
+}
+
+size_t DownloadWriter::completedPieces() const {
+    std::lock_guard<std::mutex> lock(writer_mutex);
+    return completed_pieces;
+}
+
+bool DownloadWriter::isComplete() const {
+    std::lock_guard<std::mutex> lock(writer_mutex);
+    return completed_pieces == pieceCount();
+}
+
+std::vector<uint8_t> DownloadWriter::getBitmap() const {
+    std::lock_guard<std::mutex> lock(writer_mutex);
+    return bitmap;
+}
+
+bool DownloadWriter::commit() {
+    std::lock_guard<std::mutex> lock(writer_mutex);
+    if (committed) {
+        return true;
+    }
+    if (fd < 0) {
+        return false;
+    }
+
+    flushLocked();
+    if (completed_pieces != pieceCount()) {
+        return false;
+    }
+
+    // Data must be durable before the rename makes it visible; if it isn't,
+    // the part file stays as it is for a resume
+    if (fdatasync(fd) < 0) {
+        throw std::runtime_error("Cannot sync " + part_path + ": " + strerror(errno));
+    }
+    close(fd);
+    fd = -1;
+
+    if (rename(part_path.c_str(), destination_path.c_str()) < 0) {
+        throw std::runtime_error("Cannot move " + part_path + " to " + destination_path + ": " + strerror(errno));
+    }
+    committed = true;
+    return true;
+}
+
+void DownloadWriter::discard() {
+    std::lock_guard<std::mutex> lock(writer_mutex);
+    batch.clear();
+    batch_bytes = 0;
+    if (fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+    if (!committed) {
+        unlink(part_path.c_str());
+    }
+}
@@ -0,0 +1,107 @@
+#include "FdCache.h"
+#include <sys/stat.h>
+#include <algorithm>
+
+FdCache::FdCache(size_t cap) : capacity(std::max<size_t>(cap, 1)) {
+}
+
+FdCache::Handle FdCache::open(const std::string& path, FileAccess::Mode mode) {
+    struct stat st;
+    bool have_stat = stat(path.c_str(), &st) == 0;
+
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        auto it = entries.find(path);
+        if (it != entries.end()) {
+            bool unchanged = have_stat && it->second.requested == mode &&
+                             it->second.file->identity() == FileAccess::identityOf(st);
+            if (unchanged) {
+                lru.splice(lru.begin(), lru, it->second.lru_position);
+                ++hits;
+                return it->second.file;
+            }
+
+            // Replaced, rewritten or gone: don't hand out the old version
+            eraseLocked(it);
+            ++stale;
+        }
+    }
+
+    // Open outside the lock, it may block on a slow disk
+    ++misses;
+    Handle file = std::make_shared<const FileAccess>(path, mode);
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    auto it = entries.find(path);
+    if (it != entries.end()) {
+        // Another request opened it meanwhile; both handles work, keep theirs
+        return file;
+    }
+
+    lru.push_front(path);
+    entries.emplace(path, Entry{file, mode, lru.begin()});
+
+    while (entries.size() > capacity) {
+        eraseLocked(entries.find(lru.back()));
+        ++evictions;
+    }
+
+    return file;
+}
+
+void FdCache::eraseLocked(std::unordered_map<std::string, Entry>::iterator it) {
+    lru.erase(it->second.lru_position);
+    entries.erase(it);
+}
+
+void FdCache::invalidate(const std::string& path) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    auto it = entries.find(path);
+    if (it != entries.end()) {
+        eraseLocked(it);
+    }
+}
+
+void FdCache::invalidateUnder(const std::string& directory) {
+    std::string prefix = directory;
+    if (!prefix.empty() && prefix.back() != '/') {
+        prefix += '/';
+    }
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    for (auto it = entries.begin(); it != entries.end(); ) {
+        if (it->first.compare(0, prefix.size(), prefix) == 0) {
+            lru.erase(it->second.lru_position);
+            it = entries.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void FdCache::clear() {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    entries.clear();
+    lru.clear();
+}
+
+void FdCache::setCapacity(size_t cap) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    capacity = std::max<size_t>(cap, 1);
+    while (entries.size() > capacity) {
+        eraseLocked(entries.find(lru.back()));
+        ++evictions;
+    }
+}
+
+FdCacheStats FdCache::getStats() const {
+    FdCacheStats stats;
+    stats.hits = hits.load();
+    stats.misses = misses.load();
+    stats.stale = stale.load();
+    stats.evictions = evictions.load();
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    stats.open = entries.size();
+    return stats;
+}
@@ -0,0 +1,212 @@
+#include "FileAccess.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <cstring>
+
+namespace {
+// statfs f_type values for filesystems where we prefer pread over mmap
+constexpr long NFS_SUPER_MAGIC = 0x6969;
+constexpr long SMB_SUPER_MAGIC = 0x517B;
+constexpr long CIFS_SUPER_MAGIC = 0xFF534D42;
+constexpr long SMB2_SUPER_MAGIC = 0xFE534D42;
+constexpr long FUSE_SUPER_MAGIC = 0x65735546;
+constexpr long CEPH_SUPER_MAGIC = 0x00C36400;
+constexpr long V9FS_SUPER_MAGIC = 0x01021997;
+
+size_t pageSize() {
+    static const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return page_size;
+}
+}
+
+FileAccess::FileAccess(const std::string& path, Mode requested)
+    : filepath(path), fd(-1), file_size(0), access_mode(Mode::PREAD), mapping(nullptr) {
+    fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open file: " + path);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        throw std::runtime_error("Not a regular file: " + path);
+    }
+    file_size = static_cast<size_t>(st.st_size);
+    file_identity = identityOf(st);
+
+    bool want_mmap = false;
+    switch (requested) {
+        case Mode::MMAP:
+            want_mmap = file_size > 0;
+            break;
+        case Mode::PREAD:
+            want_mmap = false;
+            break;
+        case Mode::AUTO:
+            want_mmap = file_size >= MMAP_MIN_SIZE && isMmapFriendly(fd);
+            break;
+    }
+
+    if (want_mmap && mapFile()) {
+        access_mode = Mode::MMAP;
+    }
+}
+
+FileAccess::Identity FileAccess::identityOf(const struct stat& st) {
+    Identity id;
+    id.dev = st.st_dev;
+    id.ino = st.st_ino;
+    id.size = static_cast<size_t>(st.st_size);
+    id.mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    return id;
+}
+
+FileAccess::~FileAccess() {
+    if (mapping) {
+        munmap(mapping, file_size);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+bool FileAccess::isMmapFriendly(int file_fd) {
+    struct statfs fs;
+    if (fstatfs(file_fd, &fs) < 0) {
+        return false;
+    }
+
+    switch (static_cast<long>(fs.f_type)) {
+        case NFS_SUPER_MAGIC:
+        case SMB_SUPER_MAGIC:
+        case CIFS_SUPER_MAGIC:
+        case SMB2_SUPER_MAGIC:
+        case FUSE_SUPER_MAGIC:
+        case CEPH_SUPER_MAGIC:
+        case V9FS_SUPER_MAGIC:
+            return false;
+        default:
+            return true;
+    }
+}
+
+bool FileAccess::mapFile() {
+    void* addr = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+    mapping = static_cast<uint8_t*>(addr);
+
+    // Access is mostly front to back, let the kernel read ahead aggressively
+    madvise(mapping, file_size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    if (file_size >= HUGE_PAGE_MIN_SIZE) {
+        madvise(mapping, file_size, MADV_HUGEPAGE);  // Only a hint, ignored where unsupported
+    }
+#endif
+
+    return true;
+}
+
+size_t FileAccess::read(size_t offset, size_t length, uint8_t* buffer) const {
+    if (offset >= file_size) {
+        return 0;
+    }
+    length = std::min(length, file_size - offset);
+
+    // Not from the mapping even when there is one: served files stay open
+    // in the FdCache, and a truncation would fault the whole process
+    size_t total = 0;
+    while (total < length) {
+        ssize_t n = pread(fd, buffer + total, length - total, offset + total);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error("Failed to read " + filepath + ": " + strerror(errno));
+        }
+        if (n == 0) {
+            break;  // Truncated underneath us
+        }
+        total += n;
+    }
+    return total;
+}
+
+void FileAccess::forEachBlock(const BlockVisitor& visitor) const {
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    std::vector<uint8_t> buffer(std::min(READ_BLOCK_SIZE, file_size));
+    for (size_t offset = 0; offset < file_size; ) {
+        size_t length = read(offset, buffer.size(), buffer.data());
+        if (length == 0) {
+            break;  // Truncated underneath us
+        }
+        visitor(buffer.data(), length);
+        offset += length;
+    }
+}
+
+void FileAccess::willNeed(size_t offset, size_t length) const {
+    if (offset >= file_size || length == 0) {
+        return;
+    }
+    length = std::min(length, file_size - offset);
+
+    if (mapping) {
+        // madvise wants a page-aligned start
+        size_t aligned = offset & ~(pageSize() - 1);
+        madvise(mapping + aligned, length + (offset - aligned), MADV_WILLNEED);
+    } else {
+        posix_fadvise(fd, offset, length, POSIX_FADV_WILLNEED);
+    }
+}
+
+void FileAccess::dropCache(size_t offset, size_t length) const {
+    if (offset >= file_size || length == 0) {
+        return;
+    }
+    length = std::min(length, file_size - offset);
+
+    if (mapping) {
+        // Our own mapping pins the pages, release it before asking the kernel
+        size_t aligned = offset & ~(pageSize() - 1);
+        madvise(mapping + aligned, length + (offset - aligned), MADV_DONTNEED);
+    }
+    posix_fadvise(fd, offset, length, POSIX_FADV_DONTNEED);
+}
+
+size_t FileAccess::residentBytes(size_t offset, size_t length) const {
+    if (offset >= file_size || length == 0) {
+        return 0;
+    }
+    length = std::min(length, file_size - offset);
+
+    size_t page = pageSize();
+    size_t aligned = offset & ~(page - 1);
+    size_t span = length + (offset - aligned);
+
+    // Pread files get a throwaway mapping, it costs no I/O to set up
+    void* addr = mapping ? static_cast<void*>(mapping + aligned)
+                         : mmap(nullptr, span, PROT_READ, MAP_SHARED, fd, aligned);
+    if (addr == MAP_FAILED) {
+        return 0;
+    }
+
+    std::vector<unsigned char> pages((span + page - 1) / page);
+    size_t resident = 0;
+    if (mincore(addr, span, pages.data()) == 0) {
+        for (size_t i = 0; i < pages.size(); ++i) {
+            if (pages[i] & 1) {
+                size_t page_start = aligned + i * page;
+                size_t from = std::max(page_start, offset);
+                size_t to = std::min(page_start + page, offset + length);
+                resident += to - from;
+            }
+        }
+    }
+
+    if (!mapping) {
+        munmap(addr, span);
+    }
+    return resident;
+}
@@ -0,0 +1,186 @@
+#include "FileIndex.h"
+
+FileIndex::FileIndex(std::vector<FileInfo> entries) {
+    assign(std::move(entries));
+}
+
+void FileIndex::indexEntry(size_t pos) {
+    const FileInfo& file = files[pos];
+    by_name.emplace(file.filename, pos);
+    if (!file.filepath.empty()) {
+        by_path[file.filepath] = pos;
+    }
+    if (!file.hash.empty()) {
+        by_hash.emplace(file.hash, pos);
+    }
+}
+
+void FileIndex::unindexEntry(size_t pos) {
+    const FileInfo& file = files[pos];
+    eraseIndex(by_name, file.filename, pos);
+    if (!file.filepath.empty()) {
+        auto it = by_path.find(file.filepath);
+        if (it != by_path.end() && it->second == pos) {
+            by_path.erase(it);
+        }
+    }
+    if (!file.hash.empty()) {
+        eraseIndex(by_hash, file.hash, pos);
+    }
+}
+
+void FileIndex::eraseIndex(std::unordered_multimap<std::string, size_t>& index,
+                           const std::string& key, size_t pos) {
+    auto range = index.equal_range(key);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == pos) {
+            index.erase(it);
+            return;
+        }
+    }
+}
+
+void FileIndex::moveIndex(std::unordered_multimap<std::string, size_t>& index,
+                          const std::string& key, size_t from, size_t to) {
+    auto range = index.equal_range(key);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == from) {
+            it->second = to;
+            return;
+        }
+    }
+}
+
+void FileIndex::removeAt(size_t pos) {
+    unindexEntry(pos);
+
+    size_t last = files.size() - 1;
+    if (pos != last) {
+        // Move the last entry into the hole and repoint its index entries
+        FileInfo& moved = files[last];
+        moveIndex(by_name, moved.filename, last, pos);
+        if (!moved.filepath.empty()) {
+            by_path[moved.filepath] = pos;
+        }
+        if (!moved.hash.empty()) {
+            moveIndex(by_hash, moved.hash, last, pos);
+        }
+        files[pos] = std::move(moved);
+    }
+
+    files.pop_back();
+}
+
+void FileIndex::add(const FileInfo& file) {
+    files.push_back(file);
+    indexEntry(files.size() - 1);
+}
+
+void FileIndex::upsertByName(const FileInfo& file) {
+    auto it = by_name.find(file.filename);
+    if (it == by_name.end()) {
+        add(file);
+        return;
+    }
+
+    size_t pos = it->second;
+    unindexEntry(pos);
+    files[pos] = file;
+    indexEntry(pos);
+}
+
+void FileIndex::upsertByPath(const FileInfo& file) {
+    auto it = by_path.find(file.filepath);
+    if (it == by_path.end()) {
+        add(file);
+        return;
+    }
+
+    size_t pos = it->second;
+    unindexEntry(pos);
+    files[pos] = file;
+    indexEntry(pos);
+}
+
+size_t FileIndex::removeByName(const std::string& filename) {
+    size_t removed = 0;
+    for (auto it = by_name.find(filename); it != by_name.end(); it = by_name.find(filename)) {
+        removeAt(it->second);
+        ++removed;
+    }
+    return removed;
+}
+
+size_t FileIndex::removeByPath(const std::string& filepath) {
+    auto it = by_path.find(filepath);
+    if (it == by_path.end()) {
+        return 0;
+    }
+    removeAt(it->second);
+    return 1;
+}
+
+size_t FileIndex::removeUnderPath(const std::string& directory) {
+    std::string prefix = directory;
+    if (prefix.empty() || prefix.back() != '/') {
+        prefix += '/';
+    }
+
+    // Directory removal is rare, a linear pass is fine here
+    size_t removed = 0;
+    size_t pos = 0;
+    while (pos < files.size()) {
+        if (files[pos].filepath.compare(0, prefix.size(), prefix) == 0) {
+            removeAt(pos);  // Re-check pos, it now holds the former last entry
+            ++removed;
+        } else {
+            ++pos;
+        }
+    }
+    return removed;
+}
+
+void FileIndex::assign(std::vector<FileInfo> entries) {
+    files = std::move(entries);
+    by_name.clear();
+    by_path.clear();
+    by_hash.clear();
+
+    by_name.reserve(files.size());
+    by_path.reserve(files.size());
+    by_hash.reserve(files.size());
+    for (size_t pos = 0; pos < files.size(); ++pos) {
+        indexEntry(pos);
+    }
+}
+
+void FileIndex::clear() {
+    files.clear();
+    by_name.clear();
+    by_path.clear();
+    by_hash.clear();
+}
+
+const FileInfo* FileIndex::findByName(const std::string& filename) const {
+    auto it = by_name.find(filename);
+    return (it != by_name.end()) ? &files[it->second] : nullptr;
+}
+
+const FileInfo* FileIndex::findByPath(const std::string& filepath) const {
+    auto it = by_path.find(filepath);
+    return (it != by_path.end()) ? &files[it->second] : nullptr;
+}
+
+const FileInfo* FileIndex::findByHash(const std::string& hash) const {
+    auto it = by_hash.find(hash);
+    return (it != by_hash.end()) ? &files[it->second] : nullptr;
+}
+
+std::vector<FileInfo> FileIndex::findAllByHash(const std::string& hash) const {
+    std::vector<FileInfo> result;
+    auto range = by_hash.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        result.push_back(files[it->second]);
+    }
+    return result;
+}
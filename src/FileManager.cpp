@@ -1,14 +1,28 @@
 #include "FileManager.h"
-#include <openssl/sha.h>
-#include <iomanip>
+#include <sys/stat.h>
 #include <sstream>
+#include <algorithm>
+
+namespace {
+int64_t mtimeNanos(const struct stat& st) {
+    return static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+}
+}
 
 FileManager::FileManager() {
+    snapshot = std::make_shared<const FileSnapshot>();
     shared_directory = "./shared/";
     std::filesystem::create_directories(shared_directory);
 }
 
+FileManager::~FileManager() {
+    stopWatching();
+}
+
 void FileManager::setSharedDirectory(const std::string& directory) {
+    bool was_watching = isWatching();
+    stopWatching();
+    
     shared_directory = directory;
     if (!shared_directory.empty() && shared_directory.back() != '/') {
         shared_directory += '/';
@@ -16,61 +30,192 @@ void FileManager::setSharedDirectory(const std::string& directory) {
     
     std::filesystem::create_directories(shared_directory);
     refreshFileList();
+    
+    if (was_watching) {
+        startWatching();
+    }
 }
 
-std::string FileManager::calculateFileHash(const std::string& filepath) {
-    std::ifstream file(filepath, std::ios::binary);
-    if (!file.is_open()) {
-        throw std::runtime_error("Cannot open file for hashing: " + filepath);
+std::string FileManager::calculateFileHash(const std::string& filepath,
+                                           std::shared_ptr<const PieceLayout>* pieces) {
+    // Piece hashes come out of the same pass when asked for
+    return HashEngine::hashFile(filepath, pieces);
+}
+
+void FileManager::scanDirectory() {
+    // Writers are serialized; readers keep using the old snapshot meanwhile
+    std::lock_guard<std::mutex> lock(files_mutex);
+    
+    BoundedQueue<ScanEntry> queue(DirectoryScanner::SCAN_QUEUE_CAPACITY);
+    std::thread walker([this, &queue]() {
+        scanner.scan(shared_directory, queue, [this](const std::string& name) {
+            return isValidFile(name);
+        });
+    });
+    
+    // Only hash inodes we haven't seen unchanged before; hard links are
+    // hashed once and picked up from the first link afterwards. The rest go
+    // to the HashEngine in batches while the walker carries on, so each
+    // batch is spread over every core, its largest files first.
+    std::vector<ScanEntry> entries;
+    std::vector<HashResult> results;
+    std::vector<ScanEntry> links;
+    std::unordered_set<FileIdentity, FileIdentityHash> claimed;
+    std::vector<size_t> pending;   // Into entries
+    size_t pending_bytes = 0;
+    
+    auto hashPending = [&]() {
+        std::vector<std::string> paths;
+        paths.reserve(pending.size());
+        for (size_t index : pending) {
+            paths.push_back(entries[index].path);
+        }
+        auto hashed = hash_engine.hashFiles(paths);
+        for (size_t i = 0; i < pending.size(); ++i) {
+            results[pending[i]] = std::move(hashed[i]);
+        }
+        pending.clear();
+        pending_bytes = 0;
+    };
+    
+    try {
+        ScanEntry entry;
+        while (queue.pop(entry)) {
+            HashResult result;
+            result.filepath = entry.path;
+            if (!lookupCachedHash(entry.st, result)) {
+                if (!claimed.insert(FileIdentity{entry.st.st_dev, entry.st.st_ino}).second) {
+                    links.push_back(std::move(entry));
+                    continue;
+                }
+                pending.push_back(entries.size());
+                pending_bytes += static_cast<size_t>(entry.st.st_size);
+            }
+            entries.push_back(std::move(entry));
+            results.push_back(std::move(result));
+            
+            if (pending.size() >= SCAN_HASH_BATCH || pending_bytes >= SCAN_HASH_BATCH_BYTES) {
+                hashPending();
+            }
+        }
+        if (!pending.empty()) {
+            hashPending();
+        }
+    } catch (...) {
+        // Stop the walker before unwinding; a joinable thread can't be destroyed
+        queue.close();
+        walker.join();
+        throw;
     }
+    walker.join();
     
-    SHA256_CTX sha256;
-    SHA256_Init(&sha256);
+    if (!links.empty()) {
+        std::unordered_map<FileIdentity, size_t, FileIdentityHash> by_identity;
+        for (size_t i = 0; i < entries.size(); ++i) {
+            by_identity.emplace(FileIdentity{entries[i].st.st_dev, entries[i].st.st_ino}, i);
+        }
+        for (auto& link : links) {
+            auto it = by_identity.find(FileIdentity{link.st.st_dev, link.st.st_ino});
+            if (it == by_identity.end()) {
+                continue;
+            }
+            HashResult result = results[it->second];
+            result.filepath = link.path;
+            entries.push_back(std::move(link));
+            results.push_back(std::move(result));
+        }
+    }
     
-    char buffer[BUFFER_SIZE];
-    while (file.read(buffer, sizeof(buffer)) || file.gcount() > 0) {
-        SHA256_Update(&sha256, buffer, file.gcount());
+    // Rebuild the cache from what's on disk now, which also drops deleted files
+    {
+        std::lock_guard<std::mutex> cache_lock(hash_cache_mutex);
+        hash_cache.clear();
     }
     
-    unsigned char hash[SHA256_DIGEST_LENGTH];
-    SHA256_Final(hash, &sha256);
+    std::vector<FileInfo> scanned_files;
+    scanned_files.reserve(results.size());
+    std::unordered_map<std::string, std::shared_ptr<const PieceLayout>> layouts;  // One per content
     
-    std::ostringstream oss;
-    for (int i = 0; i < SHA256_DIGEST_LENGTH; ++i) {
-        oss << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(hash[i]);
+    for (size_t i = 0; i < results.size(); ++i) {
+        const ScanEntry& entry = entries[i];
+        if (!results[i].ok()) {
+            std::cerr << "Skipping " << entry.path << ": " << results[i].error << std::endl;
+            continue;
+        }
+        
+        // Identical content shares a single piece layout
+        auto [layout, inserted] = layouts.emplace(results[i].hash, results[i].pieces);
+        results[i].pieces = layout->second;
+        storeCachedHash(entry.st, results[i]);
+        
+        std::filesystem::path path(entry.path);
+        FileInfo info(path.filename().string(), entry.path, entry.st.st_size, results[i].hash, entry.st.st_mtime);
+        info.merkle_root = results[i].pieces->root;
+        info.pieces = results[i].pieces;
+        scanned_files.push_back(std::move(info));
     }
     
-    return oss.str();
+    size_t file_count = scanned_files.size();
+    size_t unique_count = layouts.size();
+    publishSnapshot(FileIndex(std::move(scanned_files)));
+    
+    // Handles to files that are gone would keep their space allocated
+    fd_cache.clear();
+    
+    std::cout << "Scanned " << file_count << " files in " << shared_directory;
+    if (unique_count < file_count) {
+        std::cout << " (" << file_count - unique_count << " duplicates)";
+    }
+    std::cout << std::endl;
 }
 
-void FileManager::scanDirectory() {
-    std::lock_guard<std::mutex> lock(files_mutex);
-    local_files.clear();
+bool FileManager::lookupCachedHash(const struct stat& st, HashResult& result) const {
+    std::lock_guard<std::mutex> lock(hash_cache_mutex);
+    auto it = hash_cache.find(FileIdentity{st.st_dev, st.st_ino});
+    if (it == hash_cache.end() ||
+        it->second.size != static_cast<size_t>(st.st_size) || it->second.mtime_ns != mtimeNanos(st)) {
+        return false;
+    }
     
-    try {
-        for (const auto& entry : std::filesystem::recursive_directory_iterator(shared_directory)) {
-            if (entry.is_regular_file() && isValidFile(entry.path())) {
-                std::string filepath = entry.path().string();
-                std::string filename = entry.path().filename().string();
-                size_t size = std::filesystem::file_size(entry.path());
-                auto last_write = std::filesystem::last_write_time(entry.path());
-                
-                // Convert to system_clock time_point
-                auto sctp = std::chrono::time_point_cast<std::chrono::system_clock::duration>(
-                    last_write - std::filesystem::file_time_type::clock::now() + std::chrono::system_clock::now()
-                );
-                time_t mod_time = std::chrono::system_clock::to_time_t(sctp);
-                
-                std::string hash = calculateFileHash(filepath);
-                
-                local_files.emplace_back(filename, filepath, size, hash, mod_time);
-            }
+    result.hash = it->second.hash;
+    result.pieces = it->second.pieces;
+    return true;
+}
+
+void FileManager::storeCachedHash(const struct stat& st, const HashResult& result) {
+    std::lock_guard<std::mutex> lock(hash_cache_mutex);
+    hash_cache[FileIdentity{st.st_dev, st.st_ino}] =
+        CachedHash{static_cast<size_t>(st.st_size), mtimeNanos(st), result.hash, result.pieces};
+}
+
+void FileManager::publishSnapshot(FileIndex files) {
+    // Caller holds files_mutex, so versions are handed out in order
+    auto current = getSnapshot();
+    auto next = std::make_shared<FileSnapshot>();
+    next->version = current ? current->version + 1 : 1;
+    next->files = std::move(files);
+    
+    std::atomic_store(&snapshot, std::shared_ptr<const FileSnapshot>(std::move(next)));
+}
+
+FileInfo FileManager::makeFileInfo(const std::filesystem::path& path, const struct stat& st,
+                                   const FileSnapshot& current) {
+    HashResult result;
+    if (!lookupCachedHash(st, result)) {
+        result.hash = calculateFileHash(path.string(), &result.pieces);
+        
+        // Content we already share keeps its existing piece layout
+        const FileInfo* same = current.files.findByHash(result.hash);
+        if (same && same->pieces) {
+            result.pieces = same->pieces;
         }
-    } catch (const std::filesystem::filesystem_error& e) {
-        std::cerr << "Error scanning directory: " << e.what() << std::endl;
+        storeCachedHash(st, result);
     }
     
-    std::cout << "Scanned " << local_files.size() << " files in " << shared_directory << std::endl;
+    FileInfo info(path.filename().string(), path.string(), st.st_size, result.hash, st.st_mtime);
+    info.merkle_root = result.pieces->root;
+    info.pieces = std::move(result.pieces);
+    return info;
 }
 
 bool FileManager::isValidFile(const std::filesystem::path& filepath) {
@@ -81,7 +226,7 @@ bool FileManager::isValidFile(const std::filesystem::path& filepath) {
     
     // Skip system files and common non-shareable extensions
     std::string extension = filepath.extension().string();
-    std::vector<std::string> skip_extensions = {".tmp", ".log", ".lock", ".pid"};
+    std::vector<std::string> skip_extensions = {".tmp", ".log", ".lock", ".pid", ".part", ".journal"};
     
     return std::find(skip_extensions.begin(), skip_extensions.end(), extension) == skip_extensions.end();
 }
@@ -90,29 +235,200 @@ void FileManager::refreshFileList() {
     scanDirectory();
 }
 
+FileSnapshotPtr FileManager::getSnapshot() const {
+    return std::atomic_load(&snapshot);
+}
+
 std::vector<FileInfo> FileManager::getFileList() const {
-    std::lock_guard<std::mutex> lock(files_mutex);
-    return local_files;
+    return getSnapshot()->files.entries();
+}
+
+size_t FileManager::getFileCount() const {
+    return getSnapshot()->files.size();
 }
 
 bool FileManager::hasFile(const std::string& filename) const {
-    std::lock_guard<std::mutex> lock(files_mutex);
-    return std::find_if(local_files.begin(), local_files.end(),
-        [&filename](const FileInfo& f) { return f.filename == filename; }) != local_files.end();
+    return getSnapshot()->files.findByName(filename) != nullptr;
 }
 
 FileInfo FileManager::getFileInfo(const std::string& filename) const {
-    std::lock_guard<std::mutex> lock(files_mutex);
-    auto it = std::find_if(local_files.begin(), local_files.end(),
-        [&filename](const FileInfo& f) { return f.filename == filename; });
+    auto current = getSnapshot();
+    const FileInfo* file = current->files.findByName(filename);
     
-    if (it != local_files.end()) {
-        return *it;
+    if (file) {
+        return *file;
     }
     
     throw std::runtime_error("File not found: " + filename);
 }
 
+bool FileManager::hasFileWithHash(const std::string& hash) const {
+    return getSnapshot()->files.findByHash(hash) != nullptr;
+}
+
+FileInfo FileManager::getFileInfoByHash(const std::string& hash) const {
+    auto current = getSnapshot();
+    const FileInfo* file = current->files.findByHash(hash);
+    
+    if (file) {
+        return *file;
+    }
+    
+    throw std::runtime_error("No file with hash: " + hash);
+}
+
+std::vector<FileInfo> FileManager::getFilesByHash(const std::string& hash) const {
+    return getSnapshot()->files.findAllByHash(hash);
+}
+
+std::vector<FileInfo> FileManager::getUniqueFiles() const {
+    auto current = getSnapshot();
+    std::vector<FileInfo> unique;
+    std::unordered_set<std::string> seen;
+    
+    for (const auto& file : current->files.entries()) {
+        if (seen.insert(file.hash).second) {
+            unique.push_back(file);
+        }
+    }
+    return unique;
+}
+
+void FileManager::collectFileChange(const std::string& filepath, const FileSnapshot& current,
+                                    std::vector<FileInfo>& updated, std::vector<std::string>& removed) {
+    std::filesystem::path path(filepath);
+    std::error_code ec;
+    
+    if (!std::filesystem::is_regular_file(path, ec) || !isValidFile(path)) {
+        // Gone or replaced by something we don't share
+        removed.push_back(filepath);
+        return;
+    }
+    
+    struct stat st;
+    if (stat(filepath.c_str(), &st) != 0) {
+        removed.push_back(filepath);
+        return;
+    }
+    
+    // Skip the rehash if nothing we track has changed
+    const FileInfo* existing = current.files.findByPath(filepath);
+    if (existing && existing->size == static_cast<size_t>(st.st_size) &&
+        existing->last_modified == st.st_mtime) {
+        return;
+    }
+    
+    try {
+        updated.push_back(makeFileInfo(path, st, current));
+    } catch (const std::exception& e) {
+        std::cerr << "Failed to update " << filepath << ": " << e.what() << std::endl;
+    }
+}
+
+void FileManager::applyFileChanges(const std::vector<FileInfo>& updated,
+                                   const std::vector<std::string>& removed) {
+    if (updated.empty() && removed.empty()) {
+        return;
+    }
+    
+    // Copy-on-write: build the next index off to the side, then swap it in
+    std::lock_guard<std::mutex> lock(files_mutex);
+    FileIndex next = getSnapshot()->files;
+    
+    for (const auto& filepath : removed) {
+        fd_cache.invalidate(filepath);
+        if (next.removeByPath(filepath) == 0) {
+            // Not a file we track, so it may be a directory taking files along
+            next.removeUnderPath(filepath);
+            fd_cache.invalidateUnder(filepath);
+        }
+    }
+    for (const auto& file : updated) {
+        fd_cache.invalidate(file.filepath);
+        next.upsertByPath(file);
+    }
+    
+    publishSnapshot(std::move(next));
+}
+
+void FileManager::updateFile(const std::string& filepath) {
+    // Hash outside the writer lock so large files don't hold up other writers
+    std::vector<FileInfo> updated;
+    std::vector<std::string> removed;
+    collectFileChange(filepath, *getSnapshot(), updated, removed);
+    applyFileChanges(updated, removed);
+}
+
+void FileManager::removeFile(const std::string& filepath) {
+    applyFileChanges({}, {filepath});
+}
+
+bool FileManager::startWatching() {
+    if (isWatching()) {
+        return true;
+    }
+    
+    watcher = std::make_unique<FileWatcher>(shared_directory,
+        [this](const std::vector<FileWatcher::Event>& events) { handleWatchEvents(events); });
+    
+    if (!watcher->start()) {
+        watcher.reset();
+        return false;
+    }
+    
+    return true;
+}
+
+void FileManager::stopWatching() {
+    if (watcher) {
+        watcher->stop();
+        watcher.reset();
+    }
+}
+
+void FileManager::handleWatchEvents(const std::vector<FileWatcher::Event>& events) {
+    // One snapshot per batch rather than one per event
+    auto current = getSnapshot();
+    std::vector<FileInfo> updated;
+    std::vector<std::string> removed;
+    
+    for (const auto& event : events) {
+        switch (event.type) {
+            case FileWatcher::EventType::CHANGED:
+                collectFileChange(event.path, *current, updated, removed);
+                break;
+                
+            case FileWatcher::EventType::REMOVED:
+                removed.push_back(event.path);
+                break;
+                
+            case FileWatcher::EventType::RESCAN:
+                scanDirectory();
+                return;
+        }
+    }
+    
+    applyFileChanges(updated, removed);
+}
+
+FdCache::Handle FileManager::openFile(const std::string& filename) {
+    FileInfo info = getFileInfo(filename);
+    return fd_cache.open(info.filepath, read_policy.accessMode(info.size));
+}
+
+FdCache::Handle FileManager::openFileByHash(const std::string& hash) {
+    // Any copy will do; try the next one if a copy vanished since the last scan
+    auto copies = getFilesByHash(hash);
+    for (const auto& file : copies) {
+        try {
+            return fd_cache.open(file.filepath, read_policy.accessMode(file.size));
+        } catch (const std::exception&) {
+            continue;
+        }
+    }
+    throw std::runtime_error("No file with hash: " + hash);
+}
+
 bool FileManager::validateFileIntegrity(const std::string& filepath, const std::string& expected_hash) {
     try {
         std::string actual_hash = calculateFileHash(filepath);
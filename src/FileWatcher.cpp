@@ -0,0 +1,250 @@
+#include "FileWatcher.h"
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <climits>
+#include <cstring>
+
+namespace {
+constexpr uint32_t WATCH_MASK = IN_CREATE | IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_FROM |
+                                IN_MOVED_TO | IN_DELETE | IN_DELETE_SELF | IN_EXCL_UNLINK;
+}
+
+FileWatcher::FileWatcher(const std::string& directory, Callback cb,
+                         std::chrono::milliseconds settle)
+    : root_directory(directory), callback(std::move(cb)), settle_time(settle),
+      inotify_fd(-1), wakeup_fd(-1), running(false) {
+    // Watch paths are built with std::filesystem, so drop the trailing slash
+    while (root_directory.size() > 1 && root_directory.back() == '/') {
+        root_directory.pop_back();
+    }
+}
+
+FileWatcher::~FileWatcher() {
+    stop();
+}
+
+bool FileWatcher::start() {
+    if (running.load()) return true;
+
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd < 0) {
+        std::cerr << "Failed to initialize inotify: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeup_fd < 0) {
+        std::cerr << "Failed to create watcher wakeup fd" << std::endl;
+        close(inotify_fd);
+        inotify_fd = -1;
+        return false;
+    }
+
+    // Existing files were picked up by the initial scan, only watch them
+    addWatchRecursive(root_directory, false);
+
+    running.store(true);
+    watch_thread = std::thread(&FileWatcher::watchLoop, this);
+    return true;
+}
+
+void FileWatcher::stop() {
+    if (running.exchange(false)) {
+        uint64_t one = 1;
+        if (write(wakeup_fd, &one, sizeof(one)) < 0) {
+            // Thread will still notice on its next poll timeout
+        }
+        if (watch_thread.joinable()) {
+            watch_thread.join();
+        }
+    }
+
+    if (inotify_fd >= 0) {
+        close(inotify_fd);
+        inotify_fd = -1;
+    }
+    if (wakeup_fd >= 0) {
+        close(wakeup_fd);
+        wakeup_fd = -1;
+    }
+
+    watch_dirs.clear();
+    pending_changes.clear();
+    ready_events.clear();
+}
+
+void FileWatcher::watchLoop() {
+    struct pollfd fds[2];
+    fds[0].fd = inotify_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = wakeup_fd;
+    fds[1].events = POLLIN;
+
+    while (running.load()) {
+        // Sleep until the kernel has events or the next pending file settles
+        int ready = poll(fds, 2, nextTimeoutMs());
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "File watcher poll failed: " << strerror(errno) << std::endl;
+            break;
+        }
+
+        if (fds[1].revents & POLLIN) {
+            break;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            processEvents();
+        }
+
+        flushSettled();
+    }
+}
+
+void FileWatcher::processEvents() {
+    alignas(struct inotify_event) char buffer[64 * 1024];
+
+    while (true) {
+        ssize_t length = read(inotify_fd, buffer, sizeof(buffer));
+        if (length <= 0) {
+            break;  // EAGAIN: queue drained
+        }
+
+        for (char* ptr = buffer; ptr < buffer + length; ) {
+            auto* event = reinterpret_cast<struct inotify_event*>(ptr);
+            handleEvent(event);
+            ptr += sizeof(struct inotify_event) + event->len;
+        }
+    }
+}
+
+void FileWatcher::handleEvent(const struct inotify_event* event) {
+    if (event->mask & IN_Q_OVERFLOW) {
+        // Events were lost, so nothing pending can be trusted any more
+        pending_changes.clear();
+        ready_events.push_back({EventType::RESCAN, root_directory});
+        return;
+    }
+
+    if (event->mask & IN_IGNORED) {
+        watch_dirs.erase(event->wd);
+        return;
+    }
+
+    auto it = watch_dirs.find(event->wd);
+    if (it == watch_dirs.end() || event->len == 0) {
+        return;
+    }
+
+    std::string path = (std::filesystem::path(it->second) / event->name).string();
+    auto now = std::chrono::steady_clock::now();
+
+    if (event->mask & IN_ISDIR) {
+        if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+            // Files may have landed before the watch was added, report them too
+            addWatchRecursive(path, true);
+        } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+            removeWatchesUnder(path);
+            ready_events.push_back({EventType::REMOVED, path});
+        }
+        return;
+    }
+
+    if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+        pending_changes.erase(path);
+        ready_events.push_back({EventType::REMOVED, path});
+    } else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+        // Writer is done, no need to wait out the settle period
+        pending_changes[path] = now;
+    } else if (event->mask & (IN_CREATE | IN_MODIFY)) {
+        // Still being written, push the deadline back on every write
+        pending_changes[path] = now + settle_time;
+    }
+}
+
+void FileWatcher::flushSettled() {
+    auto now = std::chrono::steady_clock::now();
+
+    for (auto it = pending_changes.begin(); it != pending_changes.end(); ) {
+        if (it->second <= now) {
+            ready_events.push_back({EventType::CHANGED, it->first});
+            it = pending_changes.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    if (ready_events.empty()) {
+        return;
+    }
+
+    std::vector<Event> batch;
+    batch.swap(ready_events);
+
+    try {
+        callback(batch);
+    } catch (const std::exception& e) {
+        std::cerr << "File watcher callback failed: " << e.what() << std::endl;
+    }
+}
+
+int FileWatcher::nextTimeoutMs() const {
+    if (!ready_events.empty()) {
+        return 0;
+    }
+    if (pending_changes.empty()) {
+        return -1;  // Nothing pending, block until the kernel wakes us
+    }
+
+    auto earliest = std::chrono::steady_clock::time_point::max();
+    for (const auto& [path, deadline] : pending_changes) {
+        earliest = std::min(earliest, deadline);
+    }
+
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+        earliest - std::chrono::steady_clock::now()).count();
+    if (remaining <= 0) {
+        return 0;
+    }
+    return static_cast<int>(std::min<long long>(remaining, INT_MAX));
+}
+
+void FileWatcher::addWatchRecursive(const std::string& directory, bool report_files) {
+    int wd = inotify_add_watch(inotify_fd, directory.c_str(), WATCH_MASK);
+    if (wd < 0) {
+        std::cerr << "Failed to watch " << directory << ": " << strerror(errno) << std::endl;
+        return;
+    }
+    watch_dirs[wd] = directory;
+
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(directory, ec)) {
+        if (entry.is_directory(ec) && !entry.is_symlink(ec)) {
+            addWatchRecursive(entry.path().string(), report_files);
+        } else if (report_files && entry.is_regular_file(ec)) {
+            pending_changes[entry.path().string()] = std::chrono::steady_clock::now() + settle_time;
+        }
+    }
+}
+
+void FileWatcher::removeWatchesUnder(const std::string& directory) {
+    std::string prefix = directory + "/";
+
+    for (auto it = watch_dirs.begin(); it != watch_dirs.end(); ) {
+        if (it->second == directory || it->second.compare(0, prefix.size(), prefix) == 0) {
+            inotify_rm_watch(inotify_fd, it->first);
+            it = watch_dirs.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    for (auto it = pending_changes.begin(); it != pending_changes.end(); ) {
+        if (it->first.compare(0, prefix.size(), prefix) == 0) {
+            it = pending_changes.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
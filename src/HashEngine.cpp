@@ -0,0 +1,204 @@
+#include "HashEngine.h"
+#include "FileAccess.h"
+#include "MerkleTree.h"
+#include <algorithm>
+#include <functional>
+#include <cstdlib>
+
+namespace {
+// OpenSSL 3 does an implicit algorithm fetch on every EVP_sha256() init,
+// which dominates for small inputs; fetch once and reuse the method
+const EVP_MD* sha256Method() {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    static EVP_MD* method = EVP_MD_fetch(nullptr, "SHA256", nullptr);
+    if (method) {
+        return method;
+    }
+#endif
+    return EVP_sha256();
+}
+}
+
+Sha256::Sha256() : ctx(EVP_MD_CTX_new()) {
+    if (!ctx) {
+        throw std::runtime_error("Failed to allocate SHA-256 context");
+    }
+    reset();
+}
+
+Sha256::~Sha256() {
+    EVP_MD_CTX_free(ctx);
+}
+
+void Sha256::reset() {
+    if (EVP_DigestInit_ex(ctx, sha256Method(), nullptr) != 1) {
+        throw std::runtime_error("Failed to initialize SHA-256");
+    }
+}
+
+void Sha256::update(const uint8_t* data, size_t length) {
+    if (length > 0) {
+        EVP_DigestUpdate(ctx, data, length);
+    }
+}
+
+void Sha256::finish(unsigned char* digest) {
+    unsigned int length = 0;
+    EVP_DigestFinal_ex(ctx, digest, &length);
+    reset();
+}
+
+std::string Sha256::finishHex() {
+    unsigned char digest[DIGEST_LENGTH];
+    finish(digest);
+    return MerkleTree::toHex(digest, DIGEST_LENGTH);
+}
+
+void Sha256::digest(const uint8_t* data, size_t length, unsigned char* out) {
+    unsigned int out_length = 0;
+    if (EVP_Digest(data, length, out, &out_length, sha256Method(), nullptr) != 1) {
+        throw std::runtime_error("SHA-256 digest failed");
+    }
+}
+
+std::string Sha256::hashHex(const uint8_t* data, size_t length) {
+    unsigned char out[DIGEST_LENGTH];
+    digest(data, length, out);
+    return MerkleTree::toHex(out, DIGEST_LENGTH);
+}
+
+HashEngine::AlignedBuffer::AlignedBuffer(size_t sz) : data(nullptr), size(sz) {
+    data = static_cast<uint8_t*>(std::aligned_alloc(BUFFER_ALIGNMENT, size));
+    if (!data) {
+        throw std::runtime_error("Failed to allocate hash buffer");
+    }
+}
+
+HashEngine::AlignedBuffer::~AlignedBuffer() {
+    std::free(data);
+}
+
+HashEngine::AlignedBuffer& HashEngine::threadBuffer() {
+    // One buffer per thread, reused for every file that thread hashes
+    thread_local AlignedBuffer buffer(HASH_BUFFER_SIZE);
+    return buffer;
+}
+
+HashEngine::HashEngine(size_t threads)
+    : num_threads(threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency())) {
+}
+
+std::string HashEngine::hashFile(const std::string& filepath,
+                                 std::shared_ptr<const PieceLayout>* pieces) {
+    HashResult result;
+    hashInto(filepath, pieces != nullptr, result);
+    if (!result.ok()) {
+        throw std::runtime_error(result.error);
+    }
+    if (pieces) {
+        *pieces = std::move(result.pieces);
+    }
+    return result.hash;
+}
+
+void HashEngine::hashInto(const std::string& filepath, bool with_pieces, HashResult& result) {
+    result.filepath = filepath;
+
+    try {
+        // pread only: the watcher rehashes files while they are being
+        // rewritten, and a mapping would fault once one shrinks
+        FileAccess file(filepath, FileAccess::Mode::PREAD);
+        thread_local Sha256 whole_file;
+        whole_file.reset();
+        PieceHasher piece_hasher;
+
+        auto consume = [&](const uint8_t* data, size_t length) {
+            whole_file.update(data, length);
+            if (with_pieces) {
+                piece_hasher.update(data, length);
+            }
+        };
+
+        posix_fadvise(file.getFd(), 0, 0, POSIX_FADV_SEQUENTIAL);
+
+        // Readahead one block past the one being hashed
+        AlignedBuffer& buffer = threadBuffer();
+        for (size_t offset = 0; offset < file.size(); ) {
+            file.willNeed(offset + HASH_BUFFER_SIZE, HASH_BUFFER_SIZE);
+            size_t length = file.read(offset, buffer.size, buffer.data);
+            if (length == 0) {
+                break;  // Truncated underneath us
+            }
+            consume(buffer.data, length);
+            offset += length;
+        }
+
+        if (with_pieces) {
+            result.pieces = piece_hasher.finish();
+        }
+        result.hash = whole_file.finishHex();
+    } catch (const std::exception& e) {
+        result.hash.clear();
+        result.error = e.what();
+    }
+}
+
+std::vector<HashResult> HashEngine::hashFiles(const std::vector<std::string>& filepaths,
+                                              bool with_pieces) const {
+    std::vector<HashResult> results(filepaths.size());
+    if (filepaths.empty()) {
+        return results;
+    }
+
+    // Split into work items: large files alone and biggest first, small files in batches
+    std::vector<std::pair<size_t, size_t>> large;  // (size, index)
+    std::vector<size_t> small;
+    for (size_t i = 0; i < filepaths.size(); ++i) {
+        std::error_code ec;
+        size_t size = std::filesystem::file_size(filepaths[i], ec);
+        if (!ec && size >= SMALL_FILE_SIZE) {
+            large.emplace_back(size, i);
+        } else {
+            small.push_back(i);  // Errors are reported by hashInto
+        }
+    }
+    std::sort(large.begin(), large.end(), std::greater<>());
+
+    std::vector<std::vector<size_t>> work;
+    work.reserve(large.size() + small.size() / SMALL_FILE_BATCH + 1);
+    for (const auto& [size, index] : large) {
+        work.push_back({index});
+    }
+    for (size_t i = 0; i < small.size(); i += SMALL_FILE_BATCH) {
+        work.emplace_back(small.begin() + i,
+                          small.begin() + std::min(small.size(), i + SMALL_FILE_BATCH));
+    }
+
+    std::atomic<size_t> next_item{0};
+    auto worker = [&]() {
+        for (size_t item = next_item++; item < work.size(); item = next_item++) {
+            for (size_t index : work[item]) {
+                hashInto(filepaths[index], with_pieces, results[index]);
+            }
+        }
+    };
+
+    size_t thread_count = std::min(num_threads, work.size());
+    if (thread_count <= 1) {
+        worker();
+        return results;
+    }
+
+    std::vector<std::thread> threads;
+    threads.reserve(thread_count - 1);
+    for (size_t i = 1; i < thread_count; ++i) {
+        threads.emplace_back(worker);
+    }
+    worker();  // The calling thread takes a share too
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    return results;
+}
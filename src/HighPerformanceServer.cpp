@@ -1,10 +1,13 @@
 #include "HighPerformanceServer.h"
+#include "Protocol.h"
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <fcntl.h>
 #include <algorithm>
+#include <cstring>
 
-HighPerformanceServer::HighPerformanceServer(int p) : port(p), running(false) {
+HighPerformanceServer::HighPerformanceServer(int p)
+    : server_socket(-1), epoll_fd(-1), port(p), running(false) {
     peer_manager = std::make_unique<PeerManager>();
     file_manager = std::make_unique<FileManager>();
 }
@@ -121,7 +124,9 @@ void HighPerformanceServer::configureSocket(int socket_fd) {
 
 void HighPerformanceServer::eventLoop() {
     while (running.load()) {
-        int event_count = epoll_wait(epoll_fd, events.data(), MAX_EVENTS, 100);  // 100ms timeout
+        // Don't sleep while some connection is still waiting for its next turn
+        int timeout = ready_writers.empty() ? 100 : 0;  // 100ms timeout
+        int event_count = epoll_wait(epoll_fd, events.data(), MAX_EVENTS, timeout);
         
         for (int i = 0; i < event_count; ++i) {
             int fd = events[i].data.fd;
@@ -134,14 +139,24 @@ void HighPerformanceServer::eventLoop() {
             } else {
                 if (events_mask & (EPOLLERR | EPOLLHUP)) {
                     closeConnection(fd);
-                } else if (events_mask & EPOLLIN) {
+                    continue;
+                }
+                if (events_mask & EPOLLIN) {
                     handleClientData(fd);
-                } else if (events_mask & EPOLLOUT) {
+                }
+                if (events_mask & EPOLLOUT) {
                     handleClientWrite(fd);
                 }
             }
         }
         
+        // Round-robin between connections with more to send
+        std::vector<int> writers;
+        writers.swap(ready_writers);
+        for (int fd : writers) {
+            handleClientWrite(fd);
+        }
+        
         // Periodic cleanup
         static auto last_cleanup = std::chrono::steady_clock::now();
         auto now = std::chrono::steady_clock::now();
@@ -191,7 +206,441 @@ void HighPerformanceServer::handleNewConnection() {
     }
 }
 
+void HighPerformanceServer::handleClientData(int client_fd) {
+    Connection* conn = findConnection(client_fd);
+    if (!conn) {
+        return;
+    }
+    
+    // Edge-triggered: read until the socket is empty
+    while (true) {
+        if (conn->bytes_read == conn->read_buffer.size()) {
+            conn->read_buffer.resize(conn->read_buffer.size() * 2);
+        }
+        ssize_t received = recv(client_fd, conn->read_buffer.data() + conn->bytes_read,
+                                conn->read_buffer.size() - conn->bytes_read, 0);
+        if (received > 0) {
+            conn->bytes_read += received;
+            continue;
+        }
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        closeConnection(client_fd);  // Closed by the peer or failed
+        return;
+    }
+    conn->last_activity = std::chrono::steady_clock::now();
+    
+    // Split into messages: 4-byte big-endian length, then type and payload
+    size_t consumed = 0;
+    while (conn->bytes_read - consumed >= sizeof(uint32_t)) {
+        uint32_t length;
+        memcpy(&length, conn->read_buffer.data() + consumed, sizeof(length));
+        length = ntohl(length);
+        
+        if (length == 0 || length > MAX_MESSAGE_SIZE) {
+            std::cerr << "Invalid message length " << length << " from " << conn->peer_address << std::endl;
+            closeConnection(client_fd);
+            return;
+        }
+        if (conn->bytes_read - consumed - sizeof(uint32_t) < length) {
+            break;  // Rest of the body is still on its way
+        }
+        
+        auto begin = conn->read_buffer.begin() + consumed + sizeof(uint32_t);
+        std::vector<uint8_t> message(begin, begin + length);
+        consumed += sizeof(uint32_t) + length;
+        
+        if (conn->pending_requests.size() >= MAX_PENDING_REQUESTS) {
+            std::cerr << "Too many pipelined requests from " << conn->peer_address << std::endl;
+            closeConnection(client_fd);
+            return;
+        }
+        processCompleteMessage(conn, message);
+    }
+    
+    if (consumed > 0) {
+        std::copy(conn->read_buffer.begin() + consumed, conn->read_buffer.begin() + conn->bytes_read,
+                  conn->read_buffer.begin());
+        conn->bytes_read -= consumed;
+    }
+    if (conn->bytes_read == 0 && conn->read_buffer.size() > BUFFER_SIZE) {
+        conn->read_buffer.resize(BUFFER_SIZE);
+        conn->read_buffer.shrink_to_fit();
+    }
+    conn->state = conn->bytes_read < sizeof(uint32_t) ? Connection::READING_HEADER : Connection::READING_BODY;
+    
+    fillTransfer(conn);
+    if (!flushWrites(conn)) {
+        closeConnection(client_fd);
+    }
+}
+
+void HighPerformanceServer::handleClientWrite(int client_fd) {
+    Connection* conn = findConnection(client_fd);
+    if (conn && !flushWrites(conn)) {
+        closeConnection(client_fd);
+    }
+}
+
+bool HighPerformanceServer::flushWrites(Connection* conn) {
+    size_t turn = 0;
+    
+    while (true) {
+        while (conn->bytes_written < conn->write_buffer.size()) {
+            if (turn >= WRITE_TURN_BYTES) {
+                // Let the other connections send; picked up again next loop
+                ready_writers.push_back(conn->socket_fd);
+                return true;
+            }
+            
+            ssize_t sent = send(conn->socket_fd, conn->write_buffer.data() + conn->bytes_written,
+                                conn->write_buffer.size() - conn->bytes_written, MSG_NOSIGNAL);
+            if (sent < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    watchWrites(conn, true);
+                    return true;
+                }
+                return false;
+            }
+            conn->bytes_written += sent;
+            turn += sent;
+            bytes_transferred += sent;
+            conn->last_activity = std::chrono::steady_clock::now();
+        }
+        
+        conn->write_buffer.clear();
+        conn->bytes_written = 0;
+        
+        // Socket still writable: stream more of the current transfer
+        if (!conn->transfer) {
+            break;
+        }
+        fillTransfer(conn);
+        if (conn->write_buffer.empty()) {
+            break;
+        }
+    }
+    
+    conn->state = Connection::READING_HEADER;
+    watchWrites(conn, false);
+    return true;
+}
+
+void HighPerformanceServer::watchWrites(Connection* conn, bool enable) {
+    if (conn->watching_writes == enable) {
+        return;
+    }
+    
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLET | (enable ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+    event.data.fd = conn->socket_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->socket_fd, &event) == 0) {
+        conn->watching_writes = enable;
+    }
+}
+
+void HighPerformanceServer::closeConnection(int client_fd) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client_fd, nullptr);
+    
+    std::lock_guard<std::mutex> lock(connections_mutex);
+    auto it = connections.find(client_fd);
+    if (it != connections.end()) {
+        close(client_fd);
+        connections.erase(it);
+    }
+}
+
+Connection* HighPerformanceServer::findConnection(int client_fd) {
+    std::lock_guard<std::mutex> lock(connections_mutex);
+    auto it = connections.find(client_fd);
+    return it != connections.end() ? it->second.get() : nullptr;
+}
+
+void HighPerformanceServer::cleanupStaleConnections() {
+    auto cutoff = std::chrono::steady_clock::now() - std::chrono::seconds(STALE_CONNECTION_SECONDS);
+    std::vector<int> stale;
+    
+    {
+        std::lock_guard<std::mutex> lock(connections_mutex);
+        for (const auto& [fd, conn] : connections) {
+            if (conn->last_activity < cutoff) {
+                stale.push_back(fd);
+            }
+        }
+    }
+    
+    for (int fd : stale) {
+        std::cout << "Closing idle connection (fd: " << fd << ")" << std::endl;
+        closeConnection(fd);
+    }
+}
+
+void HighPerformanceServer::processCompleteMessage(Connection* conn, const std::vector<uint8_t>& message) {
+    // Cancels act at once; waiting their turn would defeat them
+    if (static_cast<MessageType>(message[0]) == MessageType::CANCEL_REQUEST) {
+        cancelRequest(conn, std::vector<uint8_t>(message.begin() + 1, message.end()));
+        return;
+    }
+    
+    // Responses go out in request order, so anything behind a transfer waits for it
+    if (conn->transfer || !conn->pending_requests.empty()) {
+        conn->pending_requests.push_back(message);
+        return;
+    }
+    dispatchRequest(conn, message);
+}
+
+void HighPerformanceServer::startPendingRequests(Connection* conn) {
+    // Requests that arrived meanwhile, up to the next transfer
+    while (!conn->transfer && !conn->pending_requests.empty()) {
+        std::vector<uint8_t> next = std::move(conn->pending_requests.front());
+        conn->pending_requests.pop_front();
+        dispatchRequest(conn, next);
+    }
+}
+
+void HighPerformanceServer::cancelRequest(Connection* conn, const std::vector<uint8_t>& request) {
+    // The running transfer stops after what is already queued and completes short
+    if (conn->transfer && conn->transfer->request == request) {
+        conn->transfer->end = conn->transfer->offset;
+        return;
+    }
+    
+    // A waiting one still gets its turn, so responses stay in request order,
+    // but only to answer that it was cancelled
+    for (auto& pending : conn->pending_requests) {
+        if (pending == request) {
+            pending = {static_cast<uint8_t>(MessageType::CANCEL_REQUEST)};
+            return;
+        }
+    }
+}
+
+void HighPerformanceServer::dispatchRequest(Connection* conn, const std::vector<uint8_t>& message) {
+    auto started = std::chrono::steady_clock::now();
+    MessageType type = static_cast<MessageType>(message[0]);
+    std::vector<uint8_t> payload(message.begin() + 1, message.end());
+    
+    try {
+        switch (type) {
+            case MessageType::PING:
+                queueResponse(conn, MessageType::PONG, {});
+                break;
+                
+            case MessageType::PONG:
+                return;
+                
+            case MessageType::PEER_LIST_REQUEST: {
+                std::ostringstream oss;
+                for (const auto& peer : peer_manager->getAllPeers()) {
+                    oss << peer->serialize() << "\n";
+                }
+                std::string peer_data = oss.str();
+                queueResponse(conn, MessageType::PEER_LIST_RESPONSE,
+                              std::vector<uint8_t>(peer_data.begin(), peer_data.end()));
+                break;
+            }
+            
+            case MessageType::FILE_LIST_REQUEST: {
+                auto snapshot = file_manager->getSnapshot();
+                std::ostringstream oss;
+                for (const auto& file : snapshot->files.entries()) {
+                    oss << file.filename << "|" << file.size << "|" << file.hash << "|" << file.merkle_root << "\n";
+                }
+                std::string file_data = oss.str();
+                queueResponse(conn, MessageType::FILE_LIST_RESPONSE,
+                              std::vector<uint8_t>(file_data.begin(), file_data.end()));
+                break;
+            }
+            
+            case MessageType::FILE_REQUEST:
+            case MessageType::FILE_BY_HASH_REQUEST: {
+                std::string key;
+                size_t offset = 0, length = 0;
+                if (!Protocol::parseRangeRequest(payload, key, offset, length)) {
+                    queueError(conn, "Malformed range request");
+                    break;
+                }
+                
+                // Serves whichever local copy holds the content when asked by hash
+                auto file = type == MessageType::FILE_BY_HASH_REQUEST ? file_manager->openFileByHash(key)
+                                                                      : file_manager->openFile(key);
+                startTransfer(conn, std::move(file), offset, length);
+                conn->transfer->request = message;
+                return;  // Timed once the transfer is done
+            }
+            
+            case MessageType::CANCEL_REQUEST:
+                // Stands in for a request cancelled while it waited
+                queueError(conn, "Cancelled");
+                break;
+            
+            case MessageType::PIECE_HASHES_REQUEST: {
+                // Accepts a content hash as well as a filename
+                std::string key(payload.begin(), payload.end());
+                auto file_info = file_manager->hasFile(key) ? file_manager->getFileInfo(key)
+                                                            : file_manager->getFileInfoByHash(key);
+                if (!file_info.pieces) {
+                    throw std::runtime_error("No piece hashes for: " + key);
+                }
+                std::string layout = file_info.pieces->serialize();
+                queueResponse(conn, MessageType::PIECE_HASHES_RESPONSE,
+                              std::vector<uint8_t>(layout.begin(), layout.end()));
+                break;
+            }
+            
+            default:
+                std::cerr << "Unknown message type: " << static_cast<int>(type) << std::endl;
+                return;
+        }
+    } catch (const std::exception& e) {
+        queueError(conn, e.what());
+    }
+    
+    recordResponse(started);
+}
+
+void HighPerformanceServer::queueResponse(Connection* conn, MessageType type, const std::vector<uint8_t>& payload) {
+    // Drop the sent prefix before it grows the buffer further
+    if (conn->bytes_written > 0 && conn->bytes_written * 2 >= conn->write_buffer.size()) {
+        conn->write_buffer.erase(conn->write_buffer.begin(), conn->write_buffer.begin() + conn->bytes_written);
+        conn->bytes_written = 0;
+    }
+    
+    // Same framing as the client: length of type + payload, big-endian
+    uint32_t length = htonl(static_cast<uint32_t>(payload.size() + 1));
+    const uint8_t* length_bytes = reinterpret_cast<const uint8_t*>(&length);
+    conn->write_buffer.insert(conn->write_buffer.end(), length_bytes, length_bytes + sizeof(length));
+    conn->write_buffer.push_back(static_cast<uint8_t>(type));
+    conn->write_buffer.insert(conn->write_buffer.end(), payload.begin(), payload.end());
+    conn->state = Connection::WRITING_RESPONSE;
+}
+
+void HighPerformanceServer::queueError(Connection* conn, const std::string& message) {
+    queueResponse(conn, MessageType::ERROR_MESSAGE, std::vector<uint8_t>(message.begin(), message.end()));
+}
+
+void HighPerformanceServer::startTransfer(Connection* conn, FdCache::Handle file, size_t offset, size_t length) {
+    // Zero length means "to the end of the file"
+    size_t end = file->size();
+    if (length > 0 && offset + length < end) {
+        end = offset + length;
+    }
+    
+    auto transfer = std::make_unique<Transfer>();
+    transfer->file = std::move(file);
+    transfer->offset = offset;
+    transfer->end = end;
+    transfer->started = std::chrono::steady_clock::now();
+    
+    // Chunk-aligned at both ends, as the cache reads and keeps whole chunks
+    size_t chunk = ChunkCache::CHUNK_SIZE;
+    size_t stream_start = std::min(offset, end) / chunk * chunk;
+    size_t stream_end = std::min(transfer->file->size(), (end + chunk - 1) / chunk * chunk);
+    transfer->stream = std::make_unique<ReadPolicy::Stream>(file_manager->getReadPolicy(), *transfer->file,
+                                                            stream_start, stream_end - stream_start);
+    conn->transfer = std::move(transfer);
+}
+
+void HighPerformanceServer::fillTransfer(Connection* conn) {
+    ChunkCache& cache = file_manager->getChunkCache();
+    
+    // Only as much as the socket can take soon; the rest is read as it drains
+    while (conn->transfer && conn->write_buffer.size() - conn->bytes_written < WRITE_HIGH_WATER) {
+        Transfer& transfer = *conn->transfer;
+        
+        if (transfer.offset >= transfer.end) {
+            queueResponse(conn, MessageType::FILE_COMPLETE, {});
+            recordResponse(transfer.started);
+            conn->transfer.reset();
+            startPendingRequests(conn);
+            continue;
+        }
+        
+        const FileAccess& file = *transfer.file;
+        size_t index = transfer.offset / ChunkCache::CHUNK_SIZE;
+        size_t chunk_start = index * ChunkCache::CHUNK_SIZE;
+        
+        ChunkCache::Chunk chunk;
+        try {
+            chunk = cache.getChunk({file.identity(), index}, [&](std::vector<uint8_t>& data) {
+                data.resize(std::min(ChunkCache::CHUNK_SIZE, file.size() - chunk_start));
+                data.resize(transfer.stream->read(chunk_start, data.size(), data.data()));
+            }, !transfer.stream->isStreaming());
+        } catch (const std::exception& e) {
+            conn->transfer.reset();
+            queueError(conn, e.what());
+            startPendingRequests(conn);
+            continue;
+        }
+        
+        size_t chunk_end = std::min(chunk_start + chunk->size(), transfer.end);
+        if (chunk_end <= transfer.offset) {
+            transfer.offset = transfer.end;  // Truncated underneath us
+            continue;
+        }
+        
+        std::vector<uint8_t> payload;
+        while (transfer.offset < chunk_end) {
+            size_t length = std::min(CHUNK_MESSAGE_SIZE, chunk_end - transfer.offset);
+            const uint8_t* data = chunk->data() + (transfer.offset - chunk_start);
+            payload.assign(data, data + length);
+            queueResponse(conn, MessageType::FILE_CHUNK, payload);
+            transfer.offset += length;
+        }
+    }
+}
+
+void HighPerformanceServer::recordResponse(std::chrono::steady_clock::time_point started) {
+    auto elapsed = std::chrono::steady_clock::now() - started;
+    total_response_us += std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+    ++requests_served;
+}
+
+void HighPerformanceServer::setSharedDirectory(const std::string& directory) {
+    file_manager->setSharedDirectory(directory);
+    if (!file_manager->startWatching()) {
+        std::cerr << "Warning: file watching unavailable, use 'share' to pick up new files" << std::endl;
+    }
+}
+
+void HighPerformanceServer::setStreamingThreshold(size_t bytes) {
+    file_manager->getReadPolicy().setStreamingThreshold(bytes);
+}
+
+void HighPerformanceServer::setChunkCacheBudget(size_t bytes) {
+    file_manager->getChunkCache().setBudget(bytes);
+}
+
+ChunkCacheStats HighPerformanceServer::getChunkCacheStats() const {
+    return file_manager->getChunkCache().getStats();
+}
+
+FdCacheStats HighPerformanceServer::getFdCacheStats() const {
+    return file_manager->getFdCache().getStats();
+}
+
+ReadStats HighPerformanceServer::getReadStats() const {
+    return file_manager->getReadPolicy().getStats();
+}
+
 size_t HighPerformanceServer::getActiveConnectionCount() const {
     std::lock_guard<std::mutex> lock(connections_mutex);
     return connections.size();
-}
\ No newline at end of file
+}
+
+double HighPerformanceServer::getAverageResponseTime() const {
+    size_t served = requests_served.load();
+    return served == 0 ? 0.0 : total_response_us.load() / 1000.0 / served;  // Milliseconds
+}
+
+size_t HighPerformanceServer::getBytesTransferred() const {
+    return bytes_transferred.load();
+}
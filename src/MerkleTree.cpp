@@ -0,0 +1,188 @@
+#include "MerkleTree.h"
+#include <sstream>
+#include <algorithm>
+#include <cstring>
+
+size_t PieceLayout::pieceCountFor(size_t file_size, size_t piece_size) {
+    if (piece_size == 0) {
+        return 0;
+    }
+    return (file_size + piece_size - 1) / piece_size;
+}
+
+size_t PieceLayout::pieceLength(size_t index) const {
+    size_t offset = pieceOffset(index);
+    if (offset >= file_size) {
+        return 0;
+    }
+    return std::min(piece_size, file_size - offset);
+}
+
+bool PieceLayout::verifyPiece(size_t index, const uint8_t* data, size_t length) const {
+    if (index >= piece_hashes.size() || length != pieceLength(index)) {
+        return false;
+    }
+    return MerkleTree::hashData(data, length) == piece_hashes[index];
+}
+
+bool PieceLayout::isConsistent() const {
+    return piece_size > 0 &&
+           piece_hashes.size() == pieceCountFor(file_size, piece_size) &&
+           MerkleTree::computeRoot(piece_hashes) == root;
+}
+
+std::string PieceLayout::serialize() const {
+    std::ostringstream oss;
+    oss << piece_size << "|" << file_size << "|" << root << "\n";
+    for (const auto& hash : piece_hashes) {
+        oss << hash << "\n";
+    }
+    return oss.str();
+}
+
+bool PieceLayout::deserialize(const std::string& data, PieceLayout& layout) {
+    std::istringstream iss(data);
+    std::string line;
+
+    if (!std::getline(iss, line)) {
+        return false;
+    }
+
+    std::istringstream header(line);
+    std::string piece_size_str, file_size_str;
+    if (!std::getline(header, piece_size_str, '|') ||
+        !std::getline(header, file_size_str, '|') ||
+        !std::getline(header, layout.root)) {
+        return false;
+    }
+
+    try {
+        layout.piece_size = std::stoull(piece_size_str);
+        layout.file_size = std::stoull(file_size_str);
+    } catch (const std::exception&) {
+        return false;
+    }
+
+    layout.piece_hashes.clear();
+    while (std::getline(iss, line)) {
+        if (!line.empty()) {
+            layout.piece_hashes.push_back(line);
+        }
+    }
+
+    return true;
+}
+
+std::string MerkleTree::toHex(const unsigned char* digest, size_t length) {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex(length * 2, '0');
+    for (size_t i = 0; i < length; ++i) {
+        hex[2 * i] = digits[digest[i] >> 4];
+        hex[2 * i + 1] = digits[digest[i] & 0x0F];
+    }
+    return hex;
+}
+
+bool MerkleTree::fromHex(const std::string& hex, std::vector<unsigned char>& digest) {
+    if (hex.size() % 2 != 0) {
+        return false;
+    }
+
+    auto nibble = [](char c) -> int {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    };
+
+    digest.resize(hex.size() / 2);
+    for (size_t i = 0; i < digest.size(); ++i) {
+        int high = nibble(hex[2 * i]);
+        int low = nibble(hex[2 * i + 1]);
+        if (high < 0 || low < 0) {
+            return false;
+        }
+        digest[i] = static_cast<unsigned char>((high << 4) | low);
+    }
+    return true;
+}
+
+std::string MerkleTree::hashData(const uint8_t* data, size_t length) {
+    return Sha256::hashHex(data, length);
+}
+
+std::string MerkleTree::computeRoot(const std::vector<std::string>& leaf_hashes) {
+    if (leaf_hashes.empty()) {
+        return hashData(nullptr, 0);
+    }
+
+    std::vector<std::vector<unsigned char>> level;
+    level.reserve(leaf_hashes.size());
+    for (const auto& hex : leaf_hashes) {
+        std::vector<unsigned char> digest;
+        if (!fromHex(hex, digest) || digest.size() != Sha256::DIGEST_LENGTH) {
+            return "";  // Never matches a real root
+        }
+        level.push_back(std::move(digest));
+    }
+
+    while (level.size() > 1) {
+        std::vector<std::vector<unsigned char>> next;
+        next.reserve((level.size() + 1) / 2);
+
+        for (size_t i = 0; i + 1 < level.size(); i += 2) {
+            unsigned char pair[2 * Sha256::DIGEST_LENGTH];
+            std::memcpy(pair, level[i].data(), Sha256::DIGEST_LENGTH);
+            std::memcpy(pair + Sha256::DIGEST_LENGTH, level[i + 1].data(), Sha256::DIGEST_LENGTH);
+
+            std::vector<unsigned char> parent(Sha256::DIGEST_LENGTH);
+            Sha256::digest(pair, sizeof(pair), parent.data());
+            next.push_back(std::move(parent));
+        }
+        if (level.size() % 2 == 1) {
+            next.push_back(std::move(level.back()));
+        }
+
+        level.swap(next);
+    }
+
+    return toHex(level[0].data(), level[0].size());
+}
+
+PieceHasher::PieceHasher(size_t size)
+    : piece_size(size), total_size(0), piece_fill(0) {
+}
+
+void PieceHasher::update(const uint8_t* data, size_t length) {
+    while (length > 0) {
+        size_t take = std::min(length, piece_size - piece_fill);
+        piece_ctx.update(data, take);
+
+        piece_fill += take;
+        total_size += take;
+        data += take;
+        length -= take;
+
+        if (piece_fill == piece_size) {
+            finishPiece();
+        }
+    }
+}
+
+void PieceHasher::finishPiece() {
+    piece_hashes.push_back(piece_ctx.finishHex());  // Resets the context
+    piece_fill = 0;
+}
+
+std::shared_ptr<const PieceLayout> PieceHasher::finish() {
+    if (piece_fill > 0) {
+        finishPiece();  // Short last piece
+    }
+
+    auto layout = std::make_shared<PieceLayout>();
+    layout->piece_size = piece_size;
+    layout->file_size = total_size;
+    layout->piece_hashes = std::move(piece_hashes);
+    layout->root = MerkleTree::computeRoot(layout->piece_hashes);
+    return layout;
+}
@@ -9,49 +9,65 @@ Peer::Peer(const std::string& id, const std::string& ip, int p)
 
 void Peer::addFile(const FileInfo& file) {
     std::lock_guard<std::mutex> lock(files_mutex);
-    
-    // Remove if already exists
-    auto it = std::find_if(shared_files.begin(), shared_files.end(),
-        [&file](const FileInfo& f) { return f.filename == file.filename; });
-    
-    if (it != shared_files.end()) {
-        *it = file;  // Update existing
-    } else {
-        shared_files.push_back(file);  // Add new
-    }
+    shared_files.upsertByName(file);  // Replaces an existing entry with the same name
 }
 
 void Peer::removeFile(const std::string& filename) {
     std::lock_guard<std::mutex> lock(files_mutex);
-    shared_files.erase(
-        std::remove_if(shared_files.begin(), shared_files.end(),
-            [&filename](const FileInfo& f) { return f.filename == filename; }),
-        shared_files.end()
-    );
+    shared_files.removeByName(filename);
+}
+
+void Peer::setFiles(const std::vector<FileInfo>& files) {
+    // Build the new index outside the lock, then swap it in
+    FileIndex index;
+    for (const auto& file : files) {
+        index.upsertByName(file);
+    }
+    
+    std::lock_guard<std::mutex> lock(files_mutex);
+    shared_files = std::move(index);
 }
 
 std::vector<FileInfo> Peer::getFiles() const {
     std::lock_guard<std::mutex> lock(files_mutex);
-    return shared_files;
+    return shared_files.entries();
+}
+
+size_t Peer::getFileCount() const {
+    std::lock_guard<std::mutex> lock(files_mutex);
+    return shared_files.size();
 }
 
 bool Peer::hasFile(const std::string& filename) const {
     std::lock_guard<std::mutex> lock(files_mutex);
-    return std::find_if(shared_files.begin(), shared_files.end(),
-        [&filename](const FileInfo& f) { return f.filename == filename; }) != shared_files.end();
+    return shared_files.findByName(filename) != nullptr;
+}
+
+bool Peer::hasFileWithHash(const std::string& hash) const {
+    std::lock_guard<std::mutex> lock(files_mutex);
+    return shared_files.findByHash(hash) != nullptr;
 }
 
 FileInfo Peer::getFileInfo(const std::string& filename) const {
     std::lock_guard<std::mutex> lock(files_mutex);
-    auto it = std::find_if(shared_files.begin(), shared_files.end(),
-        [&filename](const FileInfo& f) { return f.filename == filename; });
+    const FileInfo* file = shared_files.findByName(filename);
     
-    if (it != shared_files.end()) {
-        return *it;
+    if (file) {
+        return *file;
     }
     throw std::runtime_error("File not found: " + filename);
 }
 
+FileInfo Peer::getFileInfoByHash(const std::string& hash) const {
+    std::lock_guard<std::mutex> lock(files_mutex);
+    const FileInfo* file = shared_files.findByHash(hash);
+    
+    if (file) {
+        return *file;
+    }
+    throw std::runtime_error("No file with hash: " + hash);
+}
+
 void Peer::setActive(bool active) {
     is_active.store(active);
     if (active) {
@@ -74,7 +90,7 @@ std::string Peer::serialize() const {
     std::lock_guard<std::mutex> lock(files_mutex);
     oss << "|" << shared_files.size();
     
-    for (const auto& file : shared_files) {
+    for (const auto& file : shared_files.entries()) {
         oss << "|" << file.filename << "|" << file.size << "|" << file.hash;
     }
     
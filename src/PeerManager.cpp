@@ -1,8 +1,45 @@
 #include "PeerManager.h"
 #include "Client.h"
+#include "ConnectionPool.h"
 #include <algorithm>
+#include <limits>
+#include <tuple>
 
-PeerManager::PeerManager() : running(false) {}
+double PeerStats::smooth(double average, double sample, bool first) {
+    return first ? sample : average + ALPHA * (sample - average);
+}
+
+void PeerStats::addTransfer(size_t bytes, std::chrono::microseconds busy, size_t requests, size_t failures) {
+    if (bytes >= MIN_THROUGHPUT_BYTES && busy.count() > 0) {
+        throughput = smooth(throughput, bytes * 1e6 / busy.count(), throughput == 0.0);
+    }
+    if (requests > 0) {
+        failure_rate = smooth(failure_rate, static_cast<double>(failures) / requests, samples == 0);
+    }
+    ++samples;
+}
+
+void PeerStats::addRtt(std::chrono::microseconds rtt) {
+    rtt_ms = smooth(rtt_ms, rtt.count() / 1000.0, rtt_ms == 0.0);
+    failure_rate = smooth(failure_rate, 0.0, samples == 0);
+    ++samples;
+}
+
+void PeerStats::addFailure() {
+    failure_rate = smooth(failure_rate, 1.0, samples == 0);
+    ++samples;
+}
+
+double PeerStats::pieceCost() const {
+    if (throughput <= 0.0) {
+        return std::numeric_limits<double>::infinity();
+    }
+    // One round trip to ask, then the piece at the usual rate, as often as it takes
+    double seconds = rtt_ms / 1000.0 + PIECE_SIZE / throughput;
+    return seconds / std::max(1.0 - failure_rate, MIN_SUCCESS_RATE);
+}
+
+PeerManager::PeerManager() : running(false), probe_rng(std::random_device{}()) {}
 
 PeerManager::~PeerManager() {
     stop();
@@ -13,18 +50,16 @@ void PeerManager::start() {
     
     running.store(true);
     heartbeat_thread = std::thread(&PeerManager::heartbeatLoop, this);
-    
-    // Connect to bootstrap nodes after a short delay
-    std::thread([this]() {
-        std::this_thread::sleep_for(std::chrono::seconds(2));
-        connectToBootstrapNodes();
-    }).detach();
 }
 
 void PeerManager::stop() {
     if (!running.load()) return;
     
-    running.store(false);
+    {
+        std::lock_guard<std::mutex> lock(heartbeat_mutex);
+        running.store(false);
+    }
+    heartbeat_cv.notify_all();
     
     if (heartbeat_thread.joinable()) {
         heartbeat_thread.join();
@@ -87,10 +122,10 @@ void PeerManager::addBootstrapNode(const std::string& address, int port) {
 void PeerManager::connectToBootstrapNodes() {
     for (const auto& [address, port] : bootstrap_nodes) {
         try {
-            Client bootstrap_client;
-            if (bootstrap_client.connect(address, port)) {
+            auto bootstrap_client = ConnectionPool::shared().acquire(address, port);
+            if (bootstrap_client) {
                 // Request peer list from bootstrap node
-                auto peer_list = bootstrap_client.requestPeerList();
+                auto peer_list = bootstrap_client->requestPeerList();
                 
                 for (const auto& peer_data : peer_list) {
                     try {
@@ -100,8 +135,6 @@ void PeerManager::connectToBootstrapNodes() {
                         std::cerr << "Failed to deserialize peer: " << e.what() << std::endl;
                     }
                 }
-                
-                bootstrap_client.disconnect();
             }
         } catch (const std::exception& e) {
             std::cerr << "Failed to connect to bootstrap node " << address << ":" << port 
@@ -123,34 +156,142 @@ std::vector<std::shared_ptr<Peer>> PeerManager::findPeersWithFile(const std::str
     return result;
 }
 
+std::vector<std::shared_ptr<Peer>> PeerManager::findPeersWithHash(const std::string& hash) const {
+    std::shared_lock<std::shared_mutex> lock(peers_mutex);
+    std::vector<std::shared_ptr<Peer>> result;
+    
+    for (const auto& pair : peers) {
+        if (pair.second->isActive() && pair.second->hasFileWithHash(hash)) {
+            result.push_back(pair.second);
+        }
+    }
+    
+    return result;
+}
+
+std::string PeerManager::findHashForFile(const std::string& filename) const {
+    std::shared_lock<std::shared_mutex> lock(peers_mutex);
+    
+    // Peers may disagree on what a name refers to; go with the most common content
+    std::unordered_map<std::string, size_t> votes;
+    for (const auto& pair : peers) {
+        if (pair.second->isActive() && pair.second->hasFile(filename)) {
+            try {
+                ++votes[pair.second->getFileInfo(filename).hash];
+            } catch (const std::exception&) {
+                // Dropped between the check and the lookup
+            }
+        }
+    }
+    
+    std::string best;
+    size_t best_votes = 0;
+    for (const auto& [hash, count] : votes) {
+        if (count > best_votes) {
+            best = hash;
+            best_votes = count;
+        }
+    }
+    return best;
+}
+
 void PeerManager::updatePeerFileList(const std::string& peer_id, const std::vector<FileInfo>& files) {
     std::shared_lock<std::shared_mutex> lock(peers_mutex);
     auto it = peers.find(peer_id);
     if (it != peers.end()) {
-        // Clear existing files and add new ones
+        // Replace the whole list in one pass
         auto peer = it->second;
-        auto existing_files = peer->getFiles();
-        
-        // Remove all existing files
-        for (const auto& file : existing_files) {
-            peer->removeFile(file.filename);
+        peer->setFiles(files);
+        peer->updateLastSeen();
+    }
+}
+
+std::vector<std::shared_ptr<Peer>> PeerManager::selectSources(const std::vector<std::shared_ptr<Peer>>& candidates,
+                                                              size_t max_sources) {
+    struct Ranked {
+        std::shared_ptr<Peer> peer;
+        PeerStats stats;
+    };
+    std::vector<Ranked> measured;
+    std::vector<Ranked> unmeasured;
+    
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    for (const auto& peer : candidates) {
+        if (!peer->isActive()) {
+            continue;
         }
-        
-        // Add new files
-        for (const auto& file : files) {
-            peer->addFile(file);
+        auto it = stats.find(peer->getAddress());
+        Ranked ranked{peer, it != stats.end() ? it->second : PeerStats()};
+        (ranked.stats.isMeasured() ? measured : unmeasured).push_back(std::move(ranked));
+    }
+    
+    std::stable_sort(measured.begin(), measured.end(), [](const Ranked& a, const Ranked& b) {
+        return a.stats.pieceCost() < b.stats.pieceCost();
+    });
+    // Never downloaded from: the healthiest and closest by heartbeat first
+    std::stable_sort(unmeasured.begin(), unmeasured.end(), [](const Ranked& a, const Ranked& b) {
+        if (a.stats.getFailureRate() != b.stats.getFailureRate()) {
+            return a.stats.getFailureRate() < b.stats.getFailureRate();
         }
-        
-        peer->updateLastSeen();
+        return a.stats.getRttMs() < b.stats.getRttMs();
+    });
+    
+    std::vector<std::shared_ptr<Peer>> result;
+    result.reserve(measured.size() + unmeasured.size());
+    for (auto* group : {&measured, &unmeasured}) {
+        for (auto& ranked : *group) {
+            result.push_back(std::move(ranked.peer));
+        }
+    }
+    
+    if (max_sources > 0 && result.size() > max_sources) {
+        std::uniform_real_distribution<double> chance(0.0, 1.0);
+        if (chance(probe_rng) < PROBE_CHANCE) {
+            // The first unmeasured peer left out, or else any peer left out
+            size_t probe = measured.size() >= max_sources && measured.size() < result.size()
+                ? measured.size()
+                : std::uniform_int_distribution<size_t>(max_sources, result.size() - 1)(probe_rng);
+            std::swap(result[max_sources - 1], result[probe]);
+        }
+        result.resize(max_sources);
     }
+    return result;
+}
+
+void PeerManager::recordTransfer(const SourceReport& report) {
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    auto& peer_stats = stats[report.address + ":" + std::to_string(report.port)];
+    peer_stats.addTransfer(report.bytes, report.busy, report.pieces + report.failures, report.failures);
+    if (report.rtt.count() > 0) {
+        peer_stats.addRtt(report.rtt);
+    }
+}
+
+PeerStats PeerManager::getPeerStats(const std::string& address) const {
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    auto it = stats.find(address);
+    return it != stats.end() ? it->second : PeerStats();
 }
 
 void PeerManager::heartbeatLoop() {
+    // Bootstrap nodes after a short delay, on this thread so stop() waits for it
+    {
+        std::unique_lock<std::mutex> lock(heartbeat_mutex);
+        if (heartbeat_cv.wait_for(lock, std::chrono::seconds(BOOTSTRAP_DELAY_SECONDS),
+                                  [this]() { return !running.load(); })) {
+            return;
+        }
+    }
+    connectToBootstrapNodes();
+    
     while (running.load()) {
         removeStalePeers();
         broadcastPeerDiscovery();
+        ConnectionPool::shared().evictIdle();
         
-        std::this_thread::sleep_for(std::chrono::seconds(30));
+        std::unique_lock<std::mutex> lock(heartbeat_mutex);
+        heartbeat_cv.wait_for(lock, std::chrono::seconds(HEARTBEAT_INTERVAL_SECONDS),
+                              [this]() { return !running.load(); });
     }
 }
 
@@ -164,6 +305,7 @@ void PeerManager::removeStalePeers() {
         auto time_since_seen = now - it->second->getLastSeen();
         if (time_since_seen > stale_threshold) {
             std::cout << "Removing stale peer: " << it->first << std::endl;
+            ConnectionPool::shared().closePeer(it->second->getIpAddress(), it->second->getPort());
             it = peers.erase(it);
         } else {
             ++it;
@@ -171,23 +313,68 @@ void PeerManager::removeStalePeers() {
     }
 }
 
-void PeerManager::broadcastPeerDiscovery() {
+size_t PeerManager::broadcastPeerDiscovery() {
     auto active_peers = getActivePeers();
     
-    for (auto& peer : active_peers) {
-        try {
-            Client client;
-            if (client.connect(peer->getIpAddress(), peer->getPort())) {
-                client.sendPing();
-                client.disconnect();
-                peer->updateLastSeen();
+    // Answers arrive on the event thread and are applied here
+    struct Round {
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::vector<std::tuple<size_t, bool, std::chrono::microseconds>> answers;
+        size_t in_flight = 0;
+    };
+    auto round = std::make_shared<Round>();
+    
+    size_t alive_count = 0;
+    auto apply = [&](size_t index, bool alive, std::chrono::microseconds rtt) {
+        auto& peer = active_peers[index];
+        {
+            std::lock_guard<std::mutex> lock(stats_mutex);
+            if (alive) {
+                stats[peer->getAddress()].addRtt(rtt);
             } else {
-                peer->setActive(false);
+                stats[peer->getAddress()].addFailure();
             }
-        } catch (const std::exception& e) {
+        }
+        if (alive) {
+            peer->updateLastSeen();
+            ++alive_count;
+        } else {
+            // Pooled connections to it are as dead
+            ConnectionPool::shared().closePeer(peer->getIpAddress(), peer->getPort());
             peer->setActive(false);
         }
+    };
+    
+    size_t next = 0;
+    size_t settled = 0;
+    std::unique_lock<std::mutex> lock(round->mutex);
+    while (settled < active_peers.size()) {
+        // Each connection is kept for the next round while the peer leaves it open
+        while (next < active_peers.size() && round->in_flight < MAX_PINGS_IN_FLIGHT) {
+            size_t index = next++;
+            ++round->in_flight;
+            AsyncClient::shared().ping(active_peers[index]->getIpAddress(), active_peers[index]->getPort(),
+                                       [round, index](bool alive, std::chrono::microseconds rtt) {
+                std::lock_guard<std::mutex> lock(round->mutex);
+                --round->in_flight;
+                round->answers.emplace_back(index, alive, rtt);
+                round->cv.notify_one();
+            });
+        }
+        
+        round->cv.wait_for(lock, std::chrono::milliseconds(AsyncClient::TICK_MS),
+                           [&]() { return !round->answers.empty(); });
+        auto answers = std::move(round->answers);
+        round->answers.clear();
+        lock.unlock();
+        for (const auto& [index, alive, rtt] : answers) {
+            apply(index, alive, rtt);
+        }
+        settled += answers.size();
+        lock.lock();
     }
+    return alive_count;
 }
 
 size_t PeerManager::getActivePeerCount() const {
@@ -1,5 +1,6 @@
 #include "Protocol.h"
 #include <cstring>
+#include <sstream>
 
 // CRC32 lookup table
 static const uint32_t crc32_table[256] = {
@@ -246,6 +247,38 @@ bool Protocol::parseFileRequest(const std::vector<uint8_t>& payload, std::string
     return true;
 }
 
+std::vector<uint8_t> Protocol::serializeRangeRequest(const std::string& key, size_t offset, size_t length) {
+    std::vector<uint8_t> payload(key.begin(), key.end());
+    if (offset > 0 || length > 0) {
+        std::string range = std::to_string(offset) + '\0' + std::to_string(length);
+        payload.push_back('\0');
+        payload.insert(payload.end(), range.begin(), range.end());
+    }
+    return payload;
+}
+
+bool Protocol::parseRangeRequest(const std::vector<uint8_t>& payload, std::string& key, size_t& offset, size_t& length) {
+    std::string request(payload.begin(), payload.end());
+    key = request.substr(0, request.find('\0'));
+    offset = 0;
+    length = 0;
+    
+    if (key.size() < request.size()) {
+        std::istringstream range(request.substr(key.size() + 1));
+        std::string offset_str, length_str;
+        std::getline(range, offset_str, '\0');
+        std::getline(range, length_str, '\0');
+        try {
+            offset = std::stoull(offset_str);
+            length = std::stoull(length_str);
+        } catch (const std::exception&) {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
 bool Protocol::parseFileChunk(const std::vector<uint8_t>& payload, std::vector<uint8_t>& chunk_data, size_t& offset) {
     size_t pos = 0;
     uint32_t offset32, chunk_size;
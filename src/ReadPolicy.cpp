@@ -0,0 +1,85 @@
+#include "ReadPolicy.h"
+#include <algorithm>
+
+ReadPolicy::ReadPolicy(size_t threshold) : streaming_threshold(threshold) {
+}
+
+FileAccess::Mode ReadPolicy::accessMode(size_t file_size) const {
+    return isStreaming(file_size) ? FileAccess::Mode::PREAD : FileAccess::Mode::AUTO;
+}
+
+ReadStats ReadPolicy::getStats() const {
+    ReadStats stats;
+    stats.bytes_read = bytes_read.load();
+    stats.cache_hit_bytes = cache_hit_bytes.load();
+    stats.cache_miss_bytes = cache_miss_bytes.load();
+    stats.dropped_bytes = dropped_bytes.load();
+    stats.streaming_requests = streaming_requests.load();
+    stats.cached_requests = cached_requests.load();
+    return stats;
+}
+
+void ReadPolicy::resetStats() {
+    bytes_read.store(0);
+    cache_hit_bytes.store(0);
+    cache_miss_bytes.store(0);
+    dropped_bytes.store(0);
+    streaming_requests.store(0);
+    cached_requests.store(0);
+}
+
+ReadPolicy::Stream::Stream(ReadPolicy& p, const FileAccess& f, size_t offset, size_t length)
+    : file(f), policy(p), streaming(p.isStreaming(f.size())),
+      end(length > 0 ? std::min(f.size(), offset + length) : f.size()),
+      drop_from(offset), read_to(offset), sampled_to(offset) {
+    if (streaming) {
+        ++policy.streaming_requests;
+        posix_fadvise(file.getFd(), offset, end > offset ? end - offset : 0, POSIX_FADV_SEQUENTIAL);
+    } else {
+        ++policy.cached_requests;
+    }
+}
+
+ReadPolicy::Stream::~Stream() {
+    // Whatever is left behind the cursor goes too
+    if (streaming && read_to > drop_from) {
+        file.dropCache(drop_from, read_to - drop_from);
+        policy.dropped_bytes += read_to - drop_from;
+    }
+}
+
+void ReadPolicy::Stream::sampleResidency(size_t offset) {
+    // One mincore per block rather than per read keeps sampling cheap
+    size_t length = std::min(FileAccess::READ_BLOCK_SIZE, end - offset);
+    size_t resident = file.residentBytes(offset, length);
+
+    policy.cache_hit_bytes += resident;
+    policy.cache_miss_bytes += length - resident;
+    sampled_to = offset + length;
+
+    // Read ahead of the next block while this one is sent
+    file.willNeed(sampled_to, FileAccess::READ_BLOCK_SIZE);
+}
+
+size_t ReadPolicy::Stream::read(size_t offset, size_t length, uint8_t* buffer) {
+    if (offset >= end) {
+        return 0;
+    }
+    length = std::min(length, end - offset);
+
+    if (offset >= sampled_to) {
+        sampleResidency(offset);
+    }
+
+    size_t n = file.read(offset, length, buffer);
+    policy.bytes_read += n;
+    read_to = std::max(read_to, offset + n);
+
+    if (streaming && read_to - drop_from >= DROP_BEHIND_WINDOW) {
+        file.dropCache(drop_from, read_to - drop_from);
+        policy.dropped_bytes += read_to - drop_from;
+        drop_from = read_to;
+    }
+
+    return n;
+}
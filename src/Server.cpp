@@ -159,9 +159,29 @@ void Server::processMessage(int client_socket, const std::vector<uint8_t>& messa
             break;
         }
         
-        case MessageType::FILE_REQUEST: {
+        case MessageType::FILE_REQUEST:
+        case MessageType::FILE_BY_HASH_REQUEST: {
+            // "key" or "key\0offset\0length" for a byte range; key is a filename or content hash
+            std::string key;
+            size_t offset = 0, length = 0;
+            if (!Protocol::parseRangeRequest(payload, key, offset, length)) {
+                std::string error = "Malformed range request";
+                sendMessage(client_socket, MessageType::ERROR_MESSAGE,
+                            std::vector<uint8_t>(error.begin(), error.end()));
+                break;
+            }
+            
+            if (type == MessageType::FILE_BY_HASH_REQUEST) {
+                handleFileByHashRequest(client_socket, key, offset, length);
+            } else {
+                handleFileRequest(client_socket, key, offset, length);
+            }
+            break;
+        }
+        
+        case MessageType::PIECE_HASHES_REQUEST: {
             std::string filename(payload.begin(), payload.end());
-            handleFileRequest(client_socket, filename);
+            handlePieceHashesRequest(client_socket, filename);
             break;
         }
         
@@ -185,11 +205,11 @@ void Server::handlePeerListRequest(int client_socket) {
 }
 
 void Server::handleFileListRequest(int client_socket, const std::string& peer_id) {
-    auto files = file_manager->getFileList();
+    auto snapshot = file_manager->getSnapshot();
     std::ostringstream oss;
     
-    for (const auto& file : files) {
-        oss << file.filename << "|" << file.size << "|" << file.hash << "\n";
+    for (const auto& file : snapshot->files.entries()) {
+        oss << file.filename << "|" << file.size << "|" << file.hash << "|" << file.merkle_root << "\n";
     }
     
     std::string file_data = oss.str();
@@ -197,27 +217,84 @@ void Server::handleFileListRequest(int client_socket, const std::string& peer_id
     sendMessage(client_socket, MessageType::FILE_LIST_RESPONSE, payload);
 }
 
-void Server::handleFileRequest(int client_socket, const std::string& filename) {
+void Server::handleFileRequest(int client_socket, const std::string& filename,
+                               size_t start, size_t length) {
     try {
-        auto file_info = file_manager->getFileInfo(filename);
-        std::ifstream file(file_info.filepath, std::ios::binary);
+        auto file = file_manager->openFile(filename);
+        streamFile(client_socket, *file, start, length);
+    } catch (const std::exception& e) {
+        std::vector<uint8_t> error_msg(e.what(), e.what() + strlen(e.what()));
+        sendMessage(client_socket, MessageType::ERROR_MESSAGE, error_msg);
+    }
+}
+
+void Server::handleFileByHashRequest(int client_socket, const std::string& hash,
+                                     size_t start, size_t length) {
+    try {
+        // Serves whichever local copy holds the content, whatever it is called
+        auto file = file_manager->openFileByHash(hash);
+        streamFile(client_socket, *file, start, length);
+    } catch (const std::exception& e) {
+        std::vector<uint8_t> error_msg(e.what(), e.what() + strlen(e.what()));
+        sendMessage(client_socket, MessageType::ERROR_MESSAGE, error_msg);
+    }
+}
+
+void Server::streamFile(int client_socket, const FileAccess& file, size_t start, size_t length) {
+    // Zero length means "to the end of the file"
+    size_t end = file.size();
+    if (length > 0 && start + length < end) {
+        end = start + length;
+    }
+    
+    // Serve from the shared chunk cache; misses go through the read policy,
+    // which prefetches ahead and drops streamed files from the page cache
+    ChunkCache& cache = file_manager->getChunkCache();
+    size_t first_chunk = start / ChunkCache::CHUNK_SIZE;
+    size_t stream_start = first_chunk * ChunkCache::CHUNK_SIZE;
+    ReadPolicy::Stream stream(file_manager->getReadPolicy(), file, stream_start, end - stream_start);
+    
+    std::vector<uint8_t> buffer;
+    buffer.reserve(BUFFER_SIZE);
+    for (size_t offset = start; offset < end; ) {
+        size_t index = offset / ChunkCache::CHUNK_SIZE;
+        size_t chunk_start = index * ChunkCache::CHUNK_SIZE;
         
-        if (!file.is_open()) {
-            std::vector<uint8_t> error_msg(filename.begin(), filename.end());
-            sendMessage(client_socket, MessageType::ERROR_MESSAGE, error_msg);
-            return;
+        auto chunk = cache.getChunk({file.identity(), index}, [&](std::vector<uint8_t>& data) {
+            data.resize(std::min(ChunkCache::CHUNK_SIZE, file.size() - chunk_start));
+            data.resize(stream.read(chunk_start, data.size(), data.data()));
+        }, !stream.isStreaming());
+        
+        size_t chunk_end = std::min(chunk_start + chunk->size(), end);
+        if (chunk_end <= offset) {
+            break;  // Truncated underneath us
         }
         
-        // Send file in chunks
-        std::vector<uint8_t> buffer(BUFFER_SIZE);
-        while (file.read(reinterpret_cast<char*>(buffer.data()), BUFFER_SIZE) || file.gcount() > 0) {
-            buffer.resize(file.gcount());
+        for (; offset < chunk_end; ) {
+            size_t length = std::min<size_t>(BUFFER_SIZE, chunk_end - offset);
+            const uint8_t* data = chunk->data() + (offset - chunk_start);
+            buffer.assign(data, data + length);
             sendMessage(client_socket, MessageType::FILE_CHUNK, buffer);
-            buffer.resize(BUFFER_SIZE);
+            offset += length;
+        }
+    }
+    
+    // Send completion signal
+    sendMessage(client_socket, MessageType::FILE_COMPLETE, {});
+}
+
+void Server::handlePieceHashesRequest(int client_socket, const std::string& filename) {
+    try {
+        // Accepts a content hash as well as a filename
+        auto file_info = file_manager->hasFile(filename) ? file_manager->getFileInfo(filename)
+                                                         : file_manager->getFileInfoByHash(filename);
+        if (!file_info.pieces) {
+            throw std::runtime_error("No piece hashes for: " + filename);
         }
         
-        // Send completion signal
-        sendMessage(client_socket, MessageType::FILE_COMPLETE, {});
+        std::string layout = file_info.pieces->serialize();
+        sendMessage(client_socket, MessageType::PIECE_HASHES_RESPONSE,
+                    std::vector<uint8_t>(layout.begin(), layout.end()));
         
     } catch (const std::exception& e) {
         std::vector<uint8_t> error_msg(e.what(), e.what() + strlen(e.what()));
@@ -274,6 +351,9 @@ std::vector<uint8_t> Server::receiveMessage(int socket) {
 
 void Server::setSharedDirectory(const std::string& directory) {
     file_manager->setSharedDirectory(directory);
+    if (!file_manager->startWatching()) {
+        std::cerr << "Warning: file watching unavailable, use 'share' to pick up new files" << std::endl;
+    }
 }
 
 void Server::addBootstrapPeer(const std::string& address, int port) {
@@ -0,0 +1,603 @@
+#include "SwarmDownloader.h"
+#include <cmath>
+
+PiecePicker::PiecePicker(size_t piece_count)
+    : states(piece_count, State::MISSING), availability(piece_count, 0), requesters(piece_count),
+      requested_at(piece_count), cursor(0), order_dirty(true), done_count(0), requested_count(0) {}
+
+size_t PiecePicker::addSource(std::vector<bool> pieces) {
+    std::lock_guard<std::mutex> lock(picker_mutex);
+    size_t source = have.size();
+    for (size_t piece = 0; piece < states.size(); ++piece) {
+        if (pieces.empty() || (piece < pieces.size() && pieces[piece])) {
+            ++availability[piece];
+        }
+    }
+    have.push_back(std::move(pieces));
+    source_active.push_back(true);
+    order_dirty = true;
+    return source;
+}
+
+void PiecePicker::removeSource(size_t source) {
+    std::lock_guard<std::mutex> lock(picker_mutex);
+    if (source >= source_active.size() || !source_active[source]) {
+        return;
+    }
+
+    for (size_t piece = 0; piece < states.size(); ++piece) {
+        if (sourceHasLocked(source, piece)) {
+            --availability[piece];
+        }
+        if (states[piece] == State::REQUESTED) {
+            auto& sources = requesters[piece];
+            sources.erase(std::remove(sources.begin(), sources.end(), source), sources.end());
+            if (sources.empty()) {
+                toMissingLocked(piece);
+            }
+        }
+    }
+    source_active[source] = false;
+    order_dirty = true;
+}
+
+bool PiecePicker::sourceHasLocked(size_t source, size_t piece) const {
+    const auto& pieces = have[source];
+    return pieces.empty() || (piece < pieces.size() && pieces[piece]);
+}
+
+void PiecePicker::toMissingLocked(size_t piece) {
+    states[piece] = State::MISSING;
+    requesters[piece].clear();
+    --requested_count;
+    if (!order_dirty) {
+        cursor = std::min(cursor, rank[piece]);
+    }
+}
+
+void PiecePicker::markDone(size_t piece) {
+    std::lock_guard<std::mutex> lock(picker_mutex);
+    if (piece >= states.size() || states[piece] == State::DONE) {
+        return;
+    }
+    if (states[piece] != State::MISSING) {
+        --requested_count;
+    }
+    states[piece] = State::DONE;
+    ++done_count;
+}
+
+void PiecePicker::rebuildOrderLocked() {
+    order.resize(states.size());
+    for (size_t piece = 0; piece < order.size(); ++piece) {
+        order[piece] = piece;
+    }
+    std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+        return availability[a] < availability[b];
+    });
+
+    rank.resize(order.size());
+    for (size_t position = 0; position < order.size(); ++position) {
+        rank[order[position]] = position;
+    }
+    cursor = 0;
+    order_dirty = false;
+}
+
+size_t PiecePicker::pick(size_t source) {
+    std::lock_guard<std::mutex> lock(picker_mutex);
+    if (source >= source_active.size() || !source_active[source]) {
+        return NONE;
+    }
+    if (order_dirty) {
+        rebuildOrderLocked();
+    }
+
+    // Requested and done pieces pile up at the front; skip them once for everybody
+    while (cursor < order.size() && states[order[cursor]] != State::MISSING) {
+        ++cursor;
+    }
+
+    for (size_t position = cursor; position < order.size(); ++position) {
+        size_t piece = order[position];
+        if (states[piece] == State::MISSING && sourceHasLocked(source, piece)) {
+            states[piece] = State::REQUESTED;
+            requesters[piece].assign(1, source);
+            requested_at[piece] = std::chrono::steady_clock::now();
+            ++requested_count;
+            return piece;
+        }
+    }
+    return NONE;
+}
+
+size_t PiecePicker::pickDuplicate(size_t source) {
+    std::lock_guard<std::mutex> lock(picker_mutex);
+    if (source >= source_active.size() || !source_active[source]) {
+        return NONE;
+    }
+
+    size_t best = NONE;
+    for (size_t piece = 0; piece < states.size(); ++piece) {
+        const auto& sources = requesters[piece];
+        if (states[piece] != State::REQUESTED || sources.size() >= MAX_REQUESTERS ||
+            !sourceHasLocked(source, piece) ||
+            std::find(sources.begin(), sources.end(), source) != sources.end()) {
+            continue;
+        }
+        if (best == NONE || sources.size() < requesters[best].size() ||
+            (sources.size() == requesters[best].size() && requested_at[piece] < requested_at[best])) {
+            best = piece;
+        }
+    }
+
+    if (best != NONE) {
+        requesters[best].push_back(source);
+    }
+    return best;
+}
+
+bool PiecePicker::arrived(size_t piece) {
+    std::lock_guard<std::mutex> lock(picker_mutex);
+    if (piece >= states.size() || states[piece] == State::ARRIVED || states[piece] == State::DONE) {
+        return false;
+    }
+
+    // Also from a source dropped meanwhile: the data is no worse for it
+    if (states[piece] == State::MISSING) {
+        ++requested_count;
+    }
+    states[piece] = State::ARRIVED;
+    requesters[piece].clear();
+    return true;
+}
+
+void PiecePicker::complete(size_t piece) {
+    std::lock_guard<std::mutex> lock(picker_mutex);
+    if (piece >= states.size() || states[piece] == State::DONE) {
+        return;
+    }
+    if (states[piece] != State::MISSING) {
+        --requested_count;
+    }
+    states[piece] = State::DONE;
+    requesters[piece].clear();
+    ++done_count;
+}
+
+size_t PiecePicker::release(size_t piece) {
+    std::lock_guard<std::mutex> lock(picker_mutex);
+    if (piece >= states.size() || (states[piece] != State::REQUESTED && states[piece] != State::ARRIVED)) {
+        return NONE;
+    }
+
+    size_t first = requesters[piece].empty() ? NONE : requesters[piece].front();
+    toMissingLocked(piece);
+    return first;
+}
+
+void PiecePicker::release(size_t piece, size_t source) {
+    std::lock_guard<std::mutex> lock(picker_mutex);
+    if (piece >= states.size() || states[piece] != State::REQUESTED) {
+        return;
+    }
+
+    auto& sources = requesters[piece];
+    sources.erase(std::remove(sources.begin(), sources.end(), source), sources.end());
+    if (sources.empty()) {
+        toMissingLocked(piece);
+    }
+}
+
+bool PiecePicker::isDone() const {
+    std::lock_guard<std::mutex> lock(picker_mutex);
+    return done_count == states.size();
+}
+
+size_t PiecePicker::remaining() const {
+    std::lock_guard<std::mutex> lock(picker_mutex);
+    return states.size() - done_count;
+}
+
+size_t PiecePicker::inFlight() const {
+    std::lock_guard<std::mutex> lock(picker_mutex);
+    return requested_count;
+}
+
+void RequestWindow::addRttSample(std::chrono::microseconds rtt) {
+    auto now = std::chrono::steady_clock::now();
+    round_trips.push_back({now, rtt});
+
+    // A window that stays full gets no fresh samples; the last one stands until then
+    while (round_trips.size() > 1 && now - round_trips.front().taken > std::chrono::seconds(RTT_WINDOW_SECONDS)) {
+        round_trips.pop_front();
+    }
+}
+
+void RequestWindow::addDeliverySample(size_t bytes, std::chrono::microseconds elapsed) {
+    rates.push_back(static_cast<double>(bytes) / std::max<int64_t>(elapsed.count(), 1));
+    if (rates.size() > RATE_SAMPLES) {
+        rates.pop_front();
+    }
+}
+
+double RequestWindow::bandwidth() const {
+    double best = 0.0;
+    for (double rate : rates) {
+        best = std::max(best, rate);
+    }
+    return best * 1e6;
+}
+
+std::chrono::microseconds RequestWindow::rtt() const {
+    if (round_trips.empty()) {
+        return std::chrono::microseconds(0);
+    }
+    auto lowest = round_trips.front().rtt;
+    for (const auto& sample : round_trips) {
+        lowest = std::min(lowest, sample.rtt);
+    }
+    return lowest;
+}
+
+size_t RequestWindow::limit(size_t request_bytes) const {
+    if (rates.empty() || round_trips.empty() || request_bytes == 0) {
+        return MIN_REQUESTS;
+    }
+
+    // The product in flight, plus the one being delivered
+    double in_flight_bytes = bandwidth() / 1e6 * rtt().count() * GAIN;
+    size_t requests = static_cast<size_t>(std::ceil(in_flight_bytes / request_bytes)) + 1;
+    return std::clamp(requests, MIN_REQUESTS, MAX_REQUESTS);
+}
+
+SwarmDownloader::SwarmDownloader(MessageType type, const std::string& content_key,
+                                 std::shared_ptr<const PieceLayout> piece_layout, DownloadWriter& output,
+                                 DownloadVerifier& piece_verifier, std::shared_ptr<DownloadProgress> download_progress)
+    : request_type(type), key(content_key), layout(std::move(piece_layout)), writer(output),
+      verifier(piece_verifier), progress(std::move(download_progress)), picker(layout->pieceCount()),
+      delivered_by(layout->pieceCount(), SIZE_MAX), events(std::make_shared<Events>()) {
+    // Pieces resumed from disk are never asked for
+    for (size_t index = 0; index < layout->pieceCount(); ++index) {
+        if (writer.isPieceComplete(index)) {
+            picker.markDone(index);
+        }
+    }
+    verifier.setPieceCallback([this](size_t index, bool valid) { onPieceChecked(index, valid); });
+}
+
+SwarmDownloader::~SwarmDownloader() {
+    verifier.setPieceCallback(nullptr);
+}
+
+void SwarmDownloader::addSource(const std::string& address, int port) {
+    auto source = std::make_unique<Source>();
+    source->address = address;
+    source->port = port;
+    source->picker_id = picker.addSource();  // Peers share whole files
+    source->stripes.reserve(MAX_STRIPES);
+    source->stripes.emplace_back();
+    sources.push_back(std::move(source));
+}
+
+bool SwarmDownloader::run(size_t checkpoint_interval, const Checkpoint& checkpoint) {
+    auto started = std::chrono::steady_clock::now();
+
+    active_sources.store(sources.size());
+    for (auto& source : sources) {
+        source->active.store(true);
+    }
+
+    auto updateProgress = [&]() {
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        std::lock_guard<std::mutex> lock(progress_mutex);
+        if (seconds > 0) {
+            progress->speed_mbps = (bytes_received.load() / 1024.0 / 1024.0) / seconds;
+        }
+        progress->active_sources = active_sources.load();
+    };
+
+    size_t last_checkpoint = picker.remaining();
+    while (!picker.isDone()) {
+        if (control && control->isStopping()) {
+            break;
+        }
+
+        // Every stripe of every source tops its window up, as far as the budget goes
+        bool throttled = false;
+        for (auto& source : sources) {
+            if (!source->active.load()) {
+                continue;
+            }
+            if (source->failures.load() >= MAX_SOURCE_FAILURES) {
+                retire(*source, "too many failed pieces");
+                continue;
+            }
+
+            bool exhausted = false;
+            for (size_t stripe = 0; stripe < source->stripe_count && !exhausted && !throttled; ++stripe) {
+                Stripe& lane = source->stripes[stripe];
+                size_t limit = lane.window.limit(layout->piece_size);
+                while (lane.in_flight < limit) {
+                    if (control && !control->hasBudget()) {
+                        throttled = true;
+                        break;
+                    }
+                    size_t index = picker.pick(source->picker_id);
+                    if (index == PiecePicker::NONE && endgame_enabled && picker.remaining() <= ENDGAME_PIECES) {
+                        index = picker.pickDuplicate(source->picker_id);
+                        if (index != PiecePicker::NONE) {
+                            ++duplicate_requests;
+                        }
+                    }
+                    if (index == PiecePicker::NONE) {
+                        if (source->in_flight == 0 && picker.inFlight() == 0 && !picker.isDone()) {
+                            retire(*source, "holds none of the missing pieces");
+                        }
+                        // Otherwise everything left is in flight; it comes back here if that source fails
+                        exhausted = true;
+                        break;
+                    }
+                    if (control) {
+                        control->consume(layout->pieceLength(index));
+                    }
+                    requestPiece(*source, stripe, index);
+                }
+            }
+        }
+        if (active_sources.load() == 0) {
+            break;
+        }
+
+        std::deque<Fetched> batch;
+        {
+            std::unique_lock<std::mutex> lock(events->mutex);
+            events->cv.wait_for(lock, std::chrono::milliseconds(throttled ? THROTTLE_WAIT_MS : PROGRESS_INTERVAL_MS),
+                                [this]() { return !events->fetched.empty() || events->pieces_changed; });
+            batch.swap(events->fetched);
+            events->pieces_changed = false;
+        }
+        for (auto& done : batch) {
+            onFetched(done);
+        }
+
+        size_t remaining = picker.remaining();
+        if (remaining <= ENDGAME_PIECES && tail_started == std::chrono::steady_clock::time_point()) {
+            tail_started = std::chrono::steady_clock::now();
+        }
+        if (checkpoint && checkpoint_interval > 0 && last_checkpoint - remaining >= checkpoint_interval) {
+            checkpoint();
+            last_checkpoint = remaining;
+        }
+        updateProgress();
+    }
+
+    if (picker.isDone() && tail_started != std::chrono::steady_clock::time_point()) {
+        tail_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tail_started).count();
+    }
+
+    // Whatever is still out is no use now; it lands in events, unread
+    for (const auto& piece : piece_requests) {
+        for (const auto& request : piece.second) {
+            AsyncClient::shared().cancel(request.second);
+        }
+    }
+    piece_requests.clear();
+
+    // Pieces still in the verifier settle before the result is read
+    verifier.drain();
+    updateProgress();
+    return picker.isDone();
+}
+
+void SwarmDownloader::requestPiece(Source& source, size_t stripe, size_t index) {
+    Stripe& lane = source.stripes[stripe];
+    bool idle = lane.in_flight == 0;
+    ++lane.in_flight;
+    ++source.in_flight;
+
+    Source* requester = &source;
+    auto issued = std::chrono::steady_clock::now();
+    uint64_t id = AsyncClient::shared().fetchRange(source.address, source.port, request_type, key,
+        layout->pieceOffset(index), layout->pieceLength(index), nullptr,
+        [events = events, requester, stripe, index, issued, idle](AsyncClient::RangeResult result) {
+            {
+                std::lock_guard<std::mutex> lock(events->mutex);
+                events->fetched.push_back({requester, stripe, index, issued, idle, std::move(result)});
+            }
+            events->cv.notify_one();
+        }, stripe);
+    piece_requests[index].emplace_back(&source, id);
+}
+
+void SwarmDownloader::onFetched(Fetched& done) {
+    Source& source = *done.source;
+    Stripe& lane = source.stripes[done.stripe];
+    AsyncClient::RangeResult& result = done.result;
+    --lane.in_flight;
+    --source.in_flight;
+
+    // A source's requests for one piece come back in the order they went out
+    auto requests = piece_requests.find(done.index);
+    if (requests != piece_requests.end()) {
+        auto& ids = requests->second;
+        auto mine = std::find_if(ids.begin(), ids.end(),
+                                 [&](const auto& request) { return request.first == &source; });
+        if (mine != ids.end()) {
+            ids.erase(mine);
+        }
+        if (ids.empty()) {
+            piece_requests.erase(requests);
+        }
+    }
+
+    if (result.cancelled) {
+        wasted_bytes += result.bytes;
+        return;
+    }
+    if (!result.ok) {
+        // A retired source's pieces are already back with the picker
+        if (!source.active.load()) {
+            return;
+        }
+        picker.release(done.index, source.picker_id);
+
+        // One dropped connection fails everything pipelined on it; that counts once
+        if (done.issued > source.last_failure) {
+            ++source.failures;
+            source.last_failure = result.finished;
+        }
+        return;
+    }
+
+    // Pipelined responses queue behind each other; each is timed from when the
+    // connection got to it
+    auto delivery_started = std::max(done.issued, lane.last_finished);
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(result.finished - delivery_started);
+    lane.last_finished = std::max(lane.last_finished, result.finished);
+
+    size_t size = result.data.size();
+    if (done.idle_at_issue) {
+        lane.window.addRttSample(
+            std::chrono::duration_cast<std::chrono::microseconds>(result.first_byte - done.issued));
+    }
+    lane.window.addDeliverySample(size, elapsed);
+
+    // Stripes deliver side by side; the source is busy for the time any of them is
+    auto busy_from = std::max(done.issued, source.last_finished);
+    if (result.finished > busy_from) {
+        source.busy_us += std::chrono::duration_cast<std::chrono::microseconds>(result.finished - busy_from).count();
+    }
+    source.last_finished = std::max(source.last_finished, result.finished);
+    source.bytes += size;
+    bytes_received += size;
+    adjustStripes(source, size, result.finished);
+
+    // Another copy got here first
+    if (!picker.arrived(done.index)) {
+        wasted_bytes += size;
+        BufferPool::shared().release(std::move(result.data));
+        return;
+    }
+    ++source.pieces;
+
+    // The first copy wins; the others stop
+    requests = piece_requests.find(done.index);
+    if (requests != piece_requests.end()) {
+        for (const auto& request : requests->second) {
+            AsyncClient::shared().cancel(request.second);
+            ++cancelled_requests;
+        }
+    }
+    delivered_by[done.index] = source.picker_id;
+    {
+        std::lock_guard<std::mutex> lock(progress_mutex);
+        progress->downloaded_size += size;
+    }
+
+    // Checked and written on the verifier's thread, completed through onPieceChecked
+    verifier.push(layout->pieceOffset(done.index), std::move(result.data));
+
+    if (source.active.load() && isSlow(source)) {
+        retire(source, "too slow");
+    }
+}
+
+void SwarmDownloader::adjustStripes(Source& source, size_t bytes, std::chrono::steady_clock::time_point finished) {
+    if (!striping_enabled || source.stripes_settled || !source.active.load()) {
+        return;
+    }
+
+    // The first response only starts the clock; it carries the connection setup
+    if (source.probe_started == std::chrono::steady_clock::time_point()) {
+        source.probe_started = finished;
+        return;
+    }
+    source.probe_bytes += bytes;
+    if (++source.probe_pieces < STRIPE_PROBE_PIECES * source.stripe_count) {
+        return;
+    }
+
+    double seconds = std::chrono::duration<double>(finished - source.probe_started).count();
+    double rate = seconds > 0 ? source.probe_bytes / seconds : 0.0;
+    if (source.stripe_count > 1 && rate < source.rate_before * STRIPE_GAIN) {
+        // The streams were not what held it back; the last one goes idle
+        --source.stripe_count;
+        source.stripes_settled = true;
+        return;
+    }
+    if (source.stripe_count == MAX_STRIPES) {
+        source.stripes_settled = true;
+        return;
+    }
+
+    source.rate_before = rate;
+    if (source.stripes.size() == source.stripe_count) {
+        source.stripes.emplace_back();
+    }
+    ++source.stripe_count;
+    source.probe_bytes = 0;
+    source.probe_pieces = 0;
+    source.probe_started = finished;
+}
+
+SourceReport SwarmDownloader::getSourceReport(size_t index) const {
+    const Source& source = *sources[index];
+
+    // Lowest round trip any of its connections measured
+    std::chrono::microseconds rtt(0);
+    for (const auto& stripe : source.stripes) {
+        auto measured = stripe.window.rtt();
+        if (measured.count() > 0 && (rtt.count() == 0 || measured < rtt)) {
+            rtt = measured;
+        }
+    }
+    return {source.address, source.port, source.bytes.load(), std::chrono::microseconds(source.busy_us.load()),
+            rtt, source.pieces.load(), static_cast<size_t>(source.failures.load())};
+}
+
+static double sourceRate(size_t bytes, uint64_t busy_us) {
+    return busy_us == 0 ? 0.0 : static_cast<double>(bytes) / busy_us;
+}
+
+bool SwarmDownloader::isSlow(const Source& source) const {
+    if (source.pieces.load() < MIN_PIECES_FOR_RATE || active_sources.load() < 2) {
+        return false;
+    }
+
+    double best = 0.0;
+    for (const auto& other : sources) {
+        if (other->active.load() && other->pieces.load() >= MIN_PIECES_FOR_RATE) {
+            best = std::max(best, sourceRate(other->bytes.load(), other->busy_us.load()));
+        }
+    }
+    return sourceRate(source.bytes.load(), source.busy_us.load()) * SLOW_SOURCE_FACTOR < best;
+}
+
+void SwarmDownloader::retire(Source& source, const std::string& reason) {
+    std::cerr << "Dropping source " << source.address << ":" << source.port
+              << " for " << key << ": " << reason << std::endl;
+    if (source.active.exchange(false)) {
+        --active_sources;
+    }
+    picker.removeSource(source.picker_id);  // Its requested pieces go back to the others
+}
+
+void SwarmDownloader::onPieceChecked(size_t index, bool valid) {
+    if (valid) {
+        picker.complete(index);
+    } else {
+        // Bad data counts against the source that sent it
+        picker.release(index);
+        size_t owner = delivered_by[index];
+        if (owner < sources.size()) {
+            ++sources[owner]->failures;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(events->mutex);
+        events->pieces_changed = true;
+    }
+    events->cv.notify_one();
+}
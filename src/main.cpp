@@ -16,6 +16,11 @@ int main(int argc, char* argv[]) {
     // Parse command line arguments
     int port = DEFAULT_PORT;
     std::string share_dir = "./shared/";
+    size_t stream_threshold_mb = ReadPolicy::DEFAULT_STREAMING_THRESHOLD / (1024 * 1024);
+    size_t chunk_cache_mb = ChunkCache::DEFAULT_BUDGET / (1024 * 1024);
+    size_t max_downloads = DownloadScheduler::DEFAULT_MAX_ACTIVE;
+    double download_limit_mb = 0.0;
+    int connect_timeout_ms = AsyncClient::CONNECT_TIMEOUT_MS;
     
     for (int i = 1; i < argc; i++) {
         std::string arg = argv[i];
@@ -27,11 +32,40 @@ int main(int argc, char* argv[]) {
             if (i + 1 < argc) {
                 share_dir = argv[++i];
             }
+        } else if (arg == "--stream-threshold") {
+            if (i + 1 < argc) {
+                stream_threshold_mb = std::strtoull(argv[++i], nullptr, 10);
+            }
+        } else if (arg == "--chunk-cache") {
+            if (i + 1 < argc) {
+                chunk_cache_mb = std::strtoull(argv[++i], nullptr, 10);
+            }
+        } else if (arg == "--max-downloads") {
+            if (i + 1 < argc) {
+                max_downloads = std::strtoull(argv[++i], nullptr, 10);
+            }
+        } else if (arg == "--download-limit") {
+            if (i + 1 < argc) {
+                download_limit_mb = std::strtod(argv[++i], nullptr);
+            }
+        } else if (arg == "--connect-timeout") {
+            if (i + 1 < argc) {
+                connect_timeout_ms = std::atoi(argv[++i]);
+            }
         } else if (arg == "-h" || arg == "--help") {
             std::cout << "Usage: " << argv[0] << " [OPTIONS]\n"
                       << "Options:\n"
                       << "  -p, --port PORT       Set listen port (default: " << DEFAULT_PORT << ")\n"
                       << "  -d, --directory DIR   Set shared directory (default: ./shared/)\n"
+                      << "  --stream-threshold MB Stream files this large past the page cache (default: "
+                      << stream_threshold_mb << ")\n"
+                      << "  --chunk-cache MB      Memory for hot upload chunks (default: "
+                      << chunk_cache_mb << ")\n"
+                      << "  --max-downloads N     Downloads running at once, the rest queue (default: "
+                      << max_downloads << ")\n"
+                      << "  --download-limit MB/s Bandwidth shared by running downloads (default: unlimited)\n"
+                      << "  --connect-timeout MS  Before an unanswered peer counts as down (default: "
+                      << connect_timeout_ms << ")\n"
                       << "  -h, --help           Show this help message\n";
             return 0;
         }
@@ -44,6 +78,11 @@ int main(int argc, char* argv[]) {
     try {
         CLI cli(port, share_dir);
         g_cli = &cli;
+        cli.setStreamingThreshold(stream_threshold_mb * 1024 * 1024);
+        cli.setChunkCacheBudget(chunk_cache_mb * 1024 * 1024);
+        cli.setMaxActiveDownloads(max_downloads);
+        cli.setDownloadLimit(download_limit_mb * 1024 * 1024);
+        cli.setConnectTimeout(std::chrono::milliseconds(connect_timeout_ms));
         
         if (!cli.initialize()) {
             std::cerr << "Failed to initialize P2P node\n";
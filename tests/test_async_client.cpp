@@ -0,0 +1,260 @@
+#include <gtest/gtest.h>
+#include "AsyncClient.h"
+#include "Client.h"
+#include "HighPerformanceServer.h"
+#include <random>
+
+class AsyncClientTest : public ::testing::Test {
+protected:
+    // One server for the suite; stopping it takes a while
+    static void SetUpTestSuite() {
+        std::filesystem::create_directories(test_dir);
+
+        std::mt19937 gen(42);
+        std::uniform_int_distribution<> dis(0, 255);
+        content.resize(3 * 1024 * 1024 + 123);
+        for (auto& byte : content) {
+            byte = static_cast<uint8_t>(dis(gen));
+        }
+        std::ofstream file(test_dir + "data.bin", std::ios::binary);
+        file.write(reinterpret_cast<const char*>(content.data()), content.size());
+        file.close();
+
+        server = new HighPerformanceServer(port);
+        server->setSharedDirectory(test_dir);
+        ASSERT_TRUE(server->start());
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    static void TearDownTestSuite() {
+        server->stop();
+        delete server;
+        std::filesystem::remove_all(test_dir);
+    }
+
+    static inline const std::string test_dir = "./async_client_test/";
+    static inline const int port = 10100;
+    static inline std::vector<uint8_t> content;
+    static inline HighPerformanceServer* server = nullptr;
+};
+
+TEST_F(AsyncClientTest, ManyRequestsFromOneThread) {
+    AsyncClient& engine = AsyncClient::shared();
+
+    // All pipelined on one connection, answered in order
+    std::vector<std::future<AsyncClient::Message>> pings;
+    std::vector<std::future<AsyncClient::RangeResult>> ranges;
+    for (int i = 0; i < 200; ++i) {
+        pings.push_back(engine.request("127.0.0.1", port, MessageType::PING, {}));
+    }
+    const size_t piece = 100 * 1000;
+    for (size_t offset = 0; offset < content.size(); offset += piece) {
+        size_t length = std::min(piece, content.size() - offset);
+        ranges.push_back(engine.fetchRange("127.0.0.1", port, MessageType::FILE_REQUEST, "data.bin", offset, length));
+    }
+
+    for (auto& ping : pings) {
+        auto response = ping.get();
+        ASSERT_FALSE(response.empty());
+        EXPECT_EQ(response[0], static_cast<uint8_t>(MessageType::PONG));
+    }
+
+    std::vector<uint8_t> received;
+    for (auto& range : ranges) {
+        auto result = range.get();
+        ASSERT_TRUE(result.ok) << result.error;
+        received.insert(received.end(), result.data.begin(), result.data.end());
+    }
+    EXPECT_EQ(received, content);
+}
+
+TEST_F(AsyncClientTest, StreamsChunksAndReportsFailures) {
+    AsyncClient& engine = AsyncClient::shared();
+
+    // Chunks arrive with their file offsets
+    std::vector<uint8_t> received(content.size());
+    std::promise<AsyncClient::RangeResult> done;
+    engine.fetchRange("127.0.0.1", port, MessageType::FILE_REQUEST, "data.bin", 0, content.size(),
+        [&](size_t offset, const uint8_t* data, size_t length) {
+            std::copy(data, data + length, received.begin() + offset);
+        },
+        [&](AsyncClient::RangeResult result) { done.set_value(std::move(result)); });
+    auto result = done.get_future().get();
+    EXPECT_TRUE(result.ok);
+    EXPECT_EQ(result.bytes, content.size());
+    EXPECT_EQ(received, content);
+
+    // The server's error comes back as the result
+    auto missing = engine.fetchRange("127.0.0.1", port, MessageType::FILE_REQUEST, "missing.bin", 0, 10).get();
+    EXPECT_FALSE(missing.ok);
+    EXPECT_FALSE(missing.error.empty());
+
+    // Nobody listening: the future fails instead of hanging
+    auto refused = engine.request("127.0.0.1", 1, MessageType::PING, {});
+    EXPECT_THROW(refused.get(), std::runtime_error);
+}
+
+TEST_F(AsyncClientTest, CancelKeepsTheConnectionInStep) {
+    AsyncClient& engine = AsyncClient::shared();
+
+    // One range being sent, one queued behind it; both dropped
+    std::promise<AsyncClient::RangeResult> first_done, second_done;
+    uint64_t first = engine.fetchRange("127.0.0.1", port, MessageType::FILE_REQUEST, "data.bin", 0, content.size(),
+        nullptr, [&](AsyncClient::RangeResult result) { first_done.set_value(std::move(result)); });
+    uint64_t second = engine.fetchRange("127.0.0.1", port, MessageType::FILE_REQUEST, "data.bin", 0, content.size(),
+        nullptr, [&](AsyncClient::RangeResult result) { second_done.set_value(std::move(result)); });
+    auto after = engine.fetchRange("127.0.0.1", port, MessageType::FILE_REQUEST, "data.bin", 1000, 5000);
+    engine.cancel(second);
+    engine.cancel(first);
+
+    auto first_result = first_done.get_future().get();
+    auto second_result = second_done.get_future().get();
+    EXPECT_TRUE(first_result.cancelled || first_result.bytes == content.size());  // Unless already sent
+    EXPECT_TRUE(second_result.cancelled);
+    EXPECT_TRUE(second_result.data.empty());
+
+    // Whatever was cut short, the request behind them gets its own bytes
+    auto result = after.get();
+    ASSERT_TRUE(result.ok) << result.error;
+    EXPECT_TRUE(std::equal(result.data.begin(), result.data.end(), content.begin() + 1000));
+}
+
+TEST_F(AsyncClientTest, BlockingClientOnTheEventLoop) {
+    Client client;
+    ASSERT_TRUE(client.connect("127.0.0.1", port));
+    EXPECT_TRUE(client.ping());
+    EXPECT_TRUE(client.isHealthy());
+
+    std::vector<uint8_t> data;
+    ASSERT_TRUE(client.downloadRange("data.bin", 1000, 500000, data));
+    EXPECT_TRUE(std::equal(data.begin(), data.end(), content.begin() + 1000));
+    EXPECT_EQ(data.size(), 500000u);
+
+    client.disconnect();
+    EXPECT_FALSE(client.isConnected());
+}
+
+TEST_F(AsyncClientTest, DownloadsReuseReceiveBuffers) {
+    Client client;
+    ASSERT_TRUE(client.connect("127.0.0.1", port));
+    BufferPool& pool = BufferPool::shared();
+    const std::string destination = "./async_client_download.bin";
+    
+    ASSERT_TRUE(client.downloadFile("data.bin", destination));
+    size_t allocations = pool.getAllocations();
+    size_t reuses = pool.getReuses();
+    
+    // The chunks of the second download land in the buffers of the first
+    ASSERT_TRUE(client.downloadFile("data.bin", destination));
+    size_t chunks = content.size() / HighPerformanceServer::CHUNK_MESSAGE_SIZE;
+    EXPECT_GE(pool.getReuses() - reuses, chunks);
+    EXPECT_LT(pool.getAllocations() - allocations, chunks / 4);
+    
+    std::ifstream in(destination, std::ios::binary);
+    std::vector<uint8_t> received((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    EXPECT_EQ(received, content);
+    std::filesystem::remove(destination);
+}
+
+TEST_F(AsyncClientTest, StreamsToOnePeerGetTheirOwnConnections) {
+    AsyncClient& engine = AsyncClient::shared();
+    size_t connections_before = server->getActiveConnectionCount();
+
+    // A quarter of the file on each of four streams at once
+    const size_t stripes = 4;
+    const size_t share = (content.size() + stripes - 1) / stripes;
+    std::vector<std::promise<AsyncClient::RangeResult>> done(stripes);
+    for (size_t stream = 0; stream < stripes; ++stream) {
+        size_t offset = stream * share;
+        engine.fetchRange("127.0.0.1", port, MessageType::FILE_REQUEST, "data.bin", offset,
+                          std::min(share, content.size() - offset), nullptr,
+                          [&done, stream](AsyncClient::RangeResult result) { done[stream].set_value(std::move(result)); },
+                          stream);
+    }
+
+    std::vector<uint8_t> received;
+    for (auto& stripe : done) {
+        auto result = stripe.get_future().get();
+        ASSERT_TRUE(result.ok) << result.error;
+        received.insert(received.end(), result.data.begin(), result.data.end());
+    }
+    EXPECT_EQ(received, content);
+
+    // Stream 0 may already have been open from the tests before
+    EXPECT_GE(server->getActiveConnectionCount(), connections_before + stripes - 1);
+}
+
+// A listener whose backlog is already full: connects to it go unanswered,
+// as to a peer that has gone away
+class SilentPeer {
+public:
+    SilentPeer() {
+        listener = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(listener, (struct sockaddr*)&addr, sizeof(addr));
+        listen(listener, 0);
+        socklen_t length = sizeof(addr);
+        getsockname(listener, (struct sockaddr*)&addr, &length);
+        port = ntohs(addr.sin_port);
+
+        filler = socket(AF_INET, SOCK_STREAM, 0);
+        ::connect(filler, (struct sockaddr*)&addr, sizeof(addr));
+    }
+
+    ~SilentPeer() {
+        close(filler);
+        close(listener);
+    }
+
+    int port;
+
+private:
+    int listener;
+    int filler;
+};
+
+TEST_F(AsyncClientTest, RaceKeepsTheFirstToAnswer) {
+    AsyncClient& engine = AsyncClient::shared();
+    SilentPeer silent;
+    SilentPeer also_silent;
+
+    // A connect of its own gives up when told to
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_EQ(engine.connect("127.0.0.1", silent.port, std::chrono::milliseconds(200)).get(), nullptr);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    EXPECT_GE(elapsed, std::chrono::milliseconds(150));
+    EXPECT_LT(elapsed, std::chrono::milliseconds(2000));
+
+    // One wanted: the live server wins without waiting on the others
+    std::vector<std::pair<std::string, int>> peers = {
+        {"127.0.0.1", silent.port}, {"127.0.0.1", 1}, {"127.0.0.1", port}, {"127.0.0.1", also_silent.port}};
+    start = std::chrono::steady_clock::now();
+    auto winners = engine.race(peers, 1, std::chrono::milliseconds(3000)).get();
+    EXPECT_EQ(winners, std::vector<size_t>{2});
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(1000));
+
+    // More wanted than can answer: after the first, the rest get a short grace, not the timeout
+    start = std::chrono::steady_clock::now();
+    winners = engine.race(peers, 3, std::chrono::milliseconds(5000)).get();
+    elapsed = std::chrono::steady_clock::now() - start;
+    EXPECT_EQ(winners, std::vector<size_t>{2});
+    EXPECT_GE(elapsed, std::chrono::milliseconds(AsyncClient::RACE_GRACE_MS - 50));
+    EXPECT_LT(elapsed, std::chrono::milliseconds(2000));
+
+    // None answering: the timeout it was given
+    start = std::chrono::steady_clock::now();
+    winners = engine.race({peers[0], peers[3]}, 1, std::chrono::milliseconds(300)).get();
+    elapsed = std::chrono::steady_clock::now() - start;
+    EXPECT_TRUE(winners.empty());
+    EXPECT_GE(elapsed, std::chrono::milliseconds(250));
+    EXPECT_LT(elapsed, std::chrono::milliseconds(2000));
+
+    // The winner's connection is the one requests then use
+    auto pong = engine.request("127.0.0.1", port, MessageType::PING, {}).get();
+    ASSERT_FALSE(pong.empty());
+    EXPECT_EQ(pong[0], static_cast<uint8_t>(MessageType::PONG));
+
+    EXPECT_TRUE(engine.race({}, 2).get().empty());
+}
@@ -0,0 +1,129 @@
+#include <gtest/gtest.h>
+#include "ChunkCache.h"
+#include <atomic>
+#include <thread>
+
+class ChunkCacheTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        cache = std::make_unique<ChunkCache>(ChunkCache::SHARD_COUNT * 4 * 1024);
+    }
+    
+    void TearDown() override {
+        cache.reset();
+    }
+    
+    ChunkCache::Key key(size_t index, int64_t version = 1) {
+        ChunkCache::Key k;
+        k.file.dev = 1;
+        k.file.ino = 42;
+        k.file.size = 1 << 20;
+        k.file.mtime_ns = version;
+        k.index = index;
+        return k;
+    }
+    
+    ChunkCache::Loader loader(size_t size, std::atomic<int>& loads) {
+        return [size, &loads](std::vector<uint8_t>& data) {
+            ++loads;
+            data.assign(size, static_cast<uint8_t>(loads.load()));
+        };
+    }
+    
+    std::unique_ptr<ChunkCache> cache;
+};
+
+TEST_F(ChunkCacheTest, HitsAndMisses) {
+    std::atomic<int> loads{0};
+    
+    auto first = cache->getChunk(key(0), loader(1024, loads));
+    auto second = cache->getChunk(key(0), loader(1024, loads));
+    EXPECT_EQ(loads.load(), 1);
+    EXPECT_EQ(first, second);
+    EXPECT_EQ(first->size(), 1024);
+    
+    // A new version of the file is a different key
+    cache->getChunk(key(0, 2), loader(1024, loads));
+    EXPECT_EQ(loads.load(), 2);
+    
+    ChunkCacheStats stats = cache->getStats();
+    EXPECT_EQ(stats.hits, 1);
+    EXPECT_EQ(stats.misses, 2);
+    EXPECT_EQ(stats.entries, 2);
+    EXPECT_EQ(stats.bytes_cached, 2048);
+}
+
+TEST_F(ChunkCacheTest, StaysWithinBudget) {
+    std::atomic<int> loads{0};
+    
+    for (size_t i = 0; i < 1000; ++i) {
+        cache->getChunk(key(i), loader(1024, loads));
+    }
+    
+    ChunkCacheStats stats = cache->getStats();
+    EXPECT_LE(stats.bytes_cached, cache->getBudget());
+    EXPECT_GT(stats.evictions, 0);
+    
+    // Shrinking the budget evicts right away
+    cache->setBudget(ChunkCache::SHARD_COUNT * 1024);
+    EXPECT_LE(cache->getStats().bytes_cached, ChunkCache::SHARD_COUNT * 1024);
+}
+
+TEST_F(ChunkCacheTest, SingleFlight) {
+    std::atomic<int> loads{0};
+    std::atomic<bool> release{false};
+    
+    auto slow_loader = [&](std::vector<uint8_t>& data) {
+        ++loads;
+        while (!release.load()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        data.assign(512, 7);
+    };
+    
+    std::vector<std::thread> threads;
+    std::vector<ChunkCache::Chunk> results(8);
+    for (size_t i = 0; i < results.size(); ++i) {
+        threads.emplace_back([&, i]() { results[i] = cache->getChunk(key(3), slow_loader); });
+    }
+    
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    release.store(true);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    
+    // One disk read, everyone got the same chunk
+    EXPECT_EQ(loads.load(), 1);
+    for (const auto& chunk : results) {
+        EXPECT_EQ(chunk, results[0]);
+    }
+    ChunkCacheStats stats = cache->getStats();
+    EXPECT_EQ(stats.misses, 1);
+    EXPECT_EQ(stats.coalesced + stats.hits, results.size() - 1);
+}
+
+TEST_F(ChunkCacheTest, LoaderFailurePropagates) {
+    auto failing = [](std::vector<uint8_t>&) { throw std::runtime_error("disk error"); };
+    EXPECT_THROW(cache->getChunk(key(5), failing), std::runtime_error);
+    
+    // The failed load isn't remembered
+    std::atomic<int> loads{0};
+    EXPECT_EQ(cache->getChunk(key(5), loader(64, loads))->size(), 64);
+}
+
+TEST_F(ChunkCacheTest, StreamingChunksNeedSecondMiss) {
+    std::atomic<int> loads{0};
+    
+    // First miss is served but not cached
+    cache->getChunk(key(9), loader(256, loads), false);
+    EXPECT_EQ(cache->getStats().entries, 0);
+    EXPECT_EQ(cache->getStats().bypassed, 1);
+    
+    // Missed again while still remembered: now it's admitted
+    cache->getChunk(key(9), loader(256, loads), false);
+    cache->getChunk(key(9), loader(256, loads), false);
+    EXPECT_EQ(loads.load(), 2);
+    EXPECT_EQ(cache->getStats().entries, 1);
+    EXPECT_EQ(cache->getStats().hits, 1);
+}
@@ -0,0 +1,101 @@
+#include <gtest/gtest.h>
+#include "ConnectionPool.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+class ConnectionPoolTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        // A bare listener: the kernel completes handshakes without accept(),
+        // which is all an idle pooled connection needs
+        listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        ASSERT_GE(listen_fd, 0);
+
+        struct sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = 0;
+        ASSERT_EQ(bind(listen_fd, (struct sockaddr*)&address, sizeof(address)), 0);
+        ASSERT_EQ(listen(listen_fd, 16), 0);
+
+        socklen_t length = sizeof(address);
+        getsockname(listen_fd, (struct sockaddr*)&address, &length);
+        port = ntohs(address.sin_port);
+    }
+
+    void TearDown() override {
+        close(listen_fd);
+    }
+
+    int listen_fd;
+    int port;
+};
+
+TEST_F(ConnectionPoolTest, ReusesParkedConnections) {
+    ConnectionPool pool;
+
+    {
+        auto lease = pool.acquire("127.0.0.1", port);
+        ASSERT_TRUE(lease);
+        EXPECT_TRUE(lease->isConnected());
+    }
+    EXPECT_EQ(pool.getStats().idle, 1);
+
+    for (int i = 0; i < 3; ++i) {
+        auto lease = pool.acquire("127.0.0.1", port);
+        ASSERT_TRUE(lease);
+    }
+
+    auto stats = pool.getStats();
+    EXPECT_EQ(stats.misses, 1);
+    EXPECT_EQ(stats.hits, 3);
+    EXPECT_EQ(stats.idle, 1);
+}
+
+TEST_F(ConnectionPoolTest, DropsConnectionsClosedByPeer) {
+    ConnectionPool pool;
+    pool.acquire("127.0.0.1", port).release();
+
+    // The peer closes its end while ours sits in the pool
+    int accepted = accept(listen_fd, nullptr, nullptr);
+    ASSERT_GE(accepted, 0);
+    close(accepted);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    auto lease = pool.acquire("127.0.0.1", port);
+    ASSERT_TRUE(lease);
+
+    auto stats = pool.getStats();
+    EXPECT_EQ(stats.failed_checks, 1);
+    EXPECT_EQ(stats.hits, 0);
+    EXPECT_EQ(stats.misses, 2);
+}
+
+TEST_F(ConnectionPoolTest, LimitsAndInvalidation) {
+    ConnectionPool pool;
+
+    // Only MAX_IDLE_PER_PEER of these stay parked
+    {
+        std::vector<ConnectionPool::Lease> leases;
+        for (size_t i = 0; i < ConnectionPool::MAX_IDLE_PER_PEER + 2; ++i) {
+            leases.push_back(pool.acquire("127.0.0.1", port));
+            ASSERT_TRUE(leases.back());
+        }
+    }
+    auto stats = pool.getStats();
+    EXPECT_EQ(stats.idle, ConnectionPool::MAX_IDLE_PER_PEER);
+    EXPECT_EQ(stats.evicted, 2);
+
+    // Invalidated, or left through an exception: closed instead of parked
+    pool.clear();
+    pool.acquire("127.0.0.1", port).invalidate();
+    try {
+        auto lease = pool.acquire("127.0.0.1", port);
+        throw std::runtime_error("transfer failed");
+    } catch (const std::runtime_error&) {
+    }
+    EXPECT_EQ(pool.getStats().idle, 0);
+
+    // Nobody listening: an empty lease
+    EXPECT_FALSE(pool.acquire("127.0.0.1", 1));
+}
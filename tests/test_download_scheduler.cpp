@@ -0,0 +1,199 @@
+#include <gtest/gtest.h>
+#include "DownloadScheduler.h"
+#include <atomic>
+#include <thread>
+
+class DownloadSchedulerTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        scheduler = std::make_unique<DownloadScheduler>(2);
+        released = false;
+    }
+    
+    void TearDown() override {
+        release();
+        scheduler.reset();
+    }
+    
+    // Holds until release(), or until the download is told to stop
+    DownloadScheduler::Job blocking(std::atomic<int>* started = nullptr) {
+        return [this, started](DownloadControl& control) {
+            if (started) {
+                ++*started;
+            }
+            std::unique_lock<std::mutex> lock(gate_mutex);
+            while (!released && !control.isStopping()) {
+                gate_cv.wait_for(lock, std::chrono::milliseconds(5));
+            }
+            return !control.isStopping();
+        };
+    }
+    
+    void release() {
+        std::lock_guard<std::mutex> lock(gate_mutex);
+        released = true;
+        gate_cv.notify_all();
+    }
+    
+    bool waitFor(const std::function<bool()>& condition) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (!condition()) {
+            if (std::chrono::steady_clock::now() > deadline) {
+                return false;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+        return true;
+    }
+    
+    bool waitForState(const std::string& name, DownloadState state) {
+        return waitFor([&]() { return scheduler->getState(name) == state; });
+    }
+    
+    std::unique_ptr<DownloadScheduler> scheduler;
+    std::mutex gate_mutex;
+    std::condition_variable gate_cv;
+    bool released;
+};
+
+TEST_F(DownloadSchedulerTest, RunsAtMostMaxActive) {
+    std::atomic<int> started{0};
+    for (int i = 0; i < 5; ++i) {
+        ASSERT_TRUE(scheduler->submit("file" + std::to_string(i), blocking(&started)));
+    }
+    
+    ASSERT_TRUE(waitFor([&]() { return started.load() == 2; }));
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_EQ(started.load(), 2);
+    EXPECT_EQ(scheduler->getRunning(), 2);
+    EXPECT_EQ(scheduler->getQueued(), 3);
+    
+    // The same name can't be queued twice while the first is still there
+    EXPECT_FALSE(scheduler->submit("file0", blocking()));
+    
+    release();
+    scheduler->waitIdle();
+    EXPECT_EQ(started.load(), 5);
+    for (int i = 0; i < 5; ++i) {
+        EXPECT_EQ(scheduler->getState("file" + std::to_string(i)), DownloadState::COMPLETED);
+    }
+    
+    // Finished ones can be downloaded again
+    EXPECT_TRUE(scheduler->submit("file0", blocking()));
+    scheduler->waitIdle();
+}
+
+TEST_F(DownloadSchedulerTest, HigherPriorityStartsFirst) {
+    scheduler->setMaxActive(1);
+    ASSERT_TRUE(scheduler->submit("running", blocking()));
+    ASSERT_TRUE(waitForState("running", DownloadState::RUNNING));
+    
+    std::mutex order_mutex;
+    std::vector<std::string> order;
+    auto recording = [&](const std::string& name) {
+        return [&, name](DownloadControl&) {
+            std::lock_guard<std::mutex> lock(order_mutex);
+            order.push_back(name);
+            return true;
+        };
+    };
+    scheduler->submit("low", recording("low"), DownloadPriority::LOW);
+    scheduler->submit("normal1", recording("normal1"));
+    scheduler->submit("high", recording("high"), DownloadPriority::HIGH);
+    scheduler->submit("normal2", recording("normal2"));
+    // Raised, it goes ahead of the other high one: it was queued first
+    EXPECT_TRUE(scheduler->setPriority("low", DownloadPriority::HIGH));
+    
+    release();
+    scheduler->waitIdle();
+    
+    std::vector<std::string> expected = {"low", "high", "normal1", "normal2"};
+    EXPECT_EQ(order, expected);
+}
+
+TEST_F(DownloadSchedulerTest, PauseResumeAndCancel) {
+    std::atomic<int> runs{0};
+    std::atomic<int> discarded{0};
+    ASSERT_TRUE(scheduler->submit("movie", blocking(&runs)));
+    ASSERT_TRUE(waitForState("movie", DownloadState::RUNNING));
+    
+    // A paused download gives its slot up and starts over when resumed
+    EXPECT_TRUE(scheduler->pause("movie"));
+    ASSERT_TRUE(waitForState("movie", DownloadState::PAUSED));
+    EXPECT_EQ(scheduler->getRunning(), 0);
+    EXPECT_FALSE(scheduler->pause("movie"));
+    
+    EXPECT_TRUE(scheduler->resume("movie"));
+    ASSERT_TRUE(waitFor([&]() { return runs.load() == 2; }));
+    
+    // Running downloads clean up after themselves; others are discarded for them
+    EXPECT_TRUE(scheduler->cancel("movie"));
+    ASSERT_TRUE(waitForState("movie", DownloadState::CANCELLED));
+    
+    scheduler->setMaxActive(1);
+    ASSERT_TRUE(scheduler->submit("first", blocking()));
+    ASSERT_TRUE(scheduler->submit("second", blocking(), DownloadPriority::NORMAL, [&]() { ++discarded; }));
+    ASSERT_TRUE(waitForState("first", DownloadState::RUNNING));
+    EXPECT_TRUE(scheduler->pause("second"));
+    EXPECT_EQ(scheduler->getState("second"), DownloadState::PAUSED);
+    EXPECT_TRUE(scheduler->cancel("second"));
+    EXPECT_EQ(scheduler->getState("second"), DownloadState::CANCELLED);
+    EXPECT_EQ(discarded.load(), 1);
+    EXPECT_FALSE(scheduler->resume("second"));
+    EXPECT_FALSE(scheduler->cancel("unknown"));
+}
+
+TEST_F(DownloadSchedulerTest, RunningDownloadsShareTheLimit) {
+    std::mutex controls_mutex;
+    std::vector<DownloadControl*> controls;
+    auto tracked = [&](DownloadControl& control) {
+        {
+            std::lock_guard<std::mutex> lock(controls_mutex);
+            controls.push_back(&control);
+        }
+        return blocking()(control);
+    };
+    
+    scheduler->setBandwidthLimit(4 * 1024 * 1024);
+    scheduler->submit("a", tracked);
+    ASSERT_TRUE(waitForState("a", DownloadState::RUNNING));
+    {
+        std::lock_guard<std::mutex> lock(controls_mutex);
+        ASSERT_EQ(controls.size(), 1);
+        EXPECT_DOUBLE_EQ(controls[0]->getRate(), 4 * 1024 * 1024);
+    }
+    
+    // A second one halves the first's share
+    scheduler->submit("b", tracked);
+    ASSERT_TRUE(waitForState("b", DownloadState::RUNNING));
+    {
+        std::lock_guard<std::mutex> lock(controls_mutex);
+        ASSERT_EQ(controls.size(), 2);
+        EXPECT_DOUBLE_EQ(controls[0]->getRate(), 2 * 1024 * 1024);
+        EXPECT_DOUBLE_EQ(controls[1]->getRate(), 2 * 1024 * 1024);
+    }
+    
+    // And it goes back once that one stops
+    scheduler->cancel("b");
+    ASSERT_TRUE(waitForState("b", DownloadState::CANCELLED));
+    {
+        std::lock_guard<std::mutex> lock(controls_mutex);
+        EXPECT_DOUBLE_EQ(controls[0]->getRate(), 4 * 1024 * 1024);
+    }
+}
+
+TEST_F(DownloadSchedulerTest, BudgetRefillsAtTheRate) {
+    DownloadControl control;
+    EXPECT_TRUE(control.hasBudget());
+    control.consume(100 * 1024 * 1024);
+    EXPECT_TRUE(control.hasBudget());   // Unlimited
+    
+    // Overdrawn by a whole second's worth, then paid back over that second
+    control.setRate(1024 * 1024);
+    control.consume(1024 * 1024);
+    EXPECT_FALSE(control.hasBudget());
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    EXPECT_FALSE(control.hasBudget());
+    std::this_thread::sleep_for(std::chrono::milliseconds(900));
+    EXPECT_TRUE(control.hasBudget());
+}
@@ -0,0 +1,340 @@
+#include <gtest/gtest.h>
+#include "DownloadWriter.h"
+#include "DownloadJournal.h"
+#include "MerkleTree.h"
+#include "DownloadVerifier.h"
+#include <filesystem>
+#include <fstream>
+#include <thread>
+
+class DownloadWriterTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        test_dir = "./test_downloads/";
+        std::filesystem::create_directories(test_dir);
+        destination = test_dir + "file.bin";
+        
+        // Odd size so the last piece is short
+        content.resize(PIECE_SIZE * 5 + 1234);
+        for (size_t i = 0; i < content.size(); ++i) {
+            content[i] = static_cast<uint8_t>(i * 7 + i / 1000);
+        }
+    }
+    
+    void TearDown() override {
+        std::filesystem::remove_all(test_dir);
+    }
+    
+    std::vector<uint8_t> readFile(const std::string& path) {
+        std::ifstream in(path, std::ios::binary);
+        return std::vector<uint8_t>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    
+    std::string test_dir;
+    std::string destination;
+    std::vector<uint8_t> content;
+};
+
+TEST_F(DownloadWriterTest, OutOfOrderPiecesAndCommit) {
+    DownloadWriter writer(destination, content.size());
+    ASSERT_EQ(writer.pieceCount(), 6);
+    EXPECT_EQ(std::filesystem::file_size(writer.getPartPath()), content.size());
+    EXPECT_FALSE(std::filesystem::exists(destination));
+    
+    // Pieces arrive backwards, each in uneven chunks
+    for (size_t index = writer.pieceCount(); index-- > 0; ) {
+        size_t start = index * PIECE_SIZE;
+        size_t end = std::min(start + PIECE_SIZE, content.size());
+        for (size_t offset = start; offset < end; offset += 10000) {
+            size_t length = std::min<size_t>(10000, end - offset);
+            writer.write(offset, content.data() + offset, length);
+        }
+        writer.flush();
+        EXPECT_TRUE(writer.isPieceComplete(index));
+    }
+    
+    EXPECT_TRUE(writer.isComplete());
+    EXPECT_TRUE(writer.commit());
+    EXPECT_FALSE(std::filesystem::exists(writer.getPartPath()));
+    EXPECT_EQ(readFile(destination), content);
+}
+
+TEST_F(DownloadWriterTest, IncompleteAndInvalidatedPieces) {
+    DownloadWriter writer(destination, content.size());
+    writer.write(0, std::vector<uint8_t>(content.begin(), content.begin() + PIECE_SIZE * 2));
+    writer.write(PIECE_SIZE * 3, content.data() + PIECE_SIZE * 3, content.size() - PIECE_SIZE * 3);
+    
+    // Piece 2 never arrived
+    EXPECT_FALSE(writer.commit());
+    EXPECT_EQ(writer.completedPieces(), 5);
+    EXPECT_EQ(writer.getBitmap()[0], 0x3b);
+    
+    // A piece that failed verification has to be written again
+    writer.invalidatePiece(1);
+    EXPECT_FALSE(writer.isPieceComplete(1));
+    writer.writePiece(1, content.data() + PIECE_SIZE, PIECE_SIZE);
+    writer.writePiece(2, content.data() + PIECE_SIZE * 2, PIECE_SIZE);
+    
+    EXPECT_TRUE(writer.commit());
+    EXPECT_EQ(readFile(destination), content);
+}
+
+TEST_F(DownloadWriterTest, ConcurrentWriters) {
+    DownloadWriter writer(destination, content.size());
+    
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < 3; ++t) {
+        threads.emplace_back([&, t]() {
+            for (size_t index = t; index < writer.pieceCount(); index += 3) {
+                size_t start = index * PIECE_SIZE;
+                size_t length = std::min<size_t>(PIECE_SIZE, content.size() - start);
+                writer.write(start, content.data() + start, length);
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    
+    EXPECT_TRUE(writer.commit());
+    EXPECT_EQ(readFile(destination), content);
+}
+
+TEST_F(DownloadWriterTest, DiscardAndUnknownSize) {
+    {
+        DownloadWriter writer(destination, content.size());
+        writer.write(0, content.data(), 100);
+        writer.discard();
+        EXPECT_FALSE(std::filesystem::exists(writer.getPartPath()));
+    }
+    EXPECT_FALSE(std::filesystem::exists(destination));
+    
+    // Without a size the writer just appends and commits whatever it got
+    DownloadWriter writer(destination, 0);
+    EXPECT_EQ(writer.pieceCount(), 0);
+    writer.write(0, content.data(), 5000);
+    writer.write(5000, content.data() + 5000, 5000);
+    EXPECT_TRUE(writer.commit());
+    EXPECT_EQ(readFile(destination), std::vector<uint8_t>(content.begin(), content.begin() + 10000));
+}
+
+TEST_F(DownloadWriterTest, NothingWrittenPastTheEnd) {
+    size_t last = content.size() / PIECE_SIZE;
+    {
+        DownloadWriter writer(destination, content.size());
+        writer.writePiece(0, content.data(), PIECE_SIZE);
+        
+        // A peer sending too much for the last piece, and then some
+        std::vector<uint8_t> tail(content.begin() + last * PIECE_SIZE, content.end());
+        tail.resize(tail.size() + 1000, 0xff);
+        writer.write(last * PIECE_SIZE, tail.data(), tail.size());
+        writer.write(content.size() + 5000, content.data(), 100);
+        writer.flush();
+        EXPECT_TRUE(writer.isPieceComplete(last));
+        EXPECT_EQ(std::filesystem::file_size(writer.getPartPath()), content.size());
+    }
+    
+    // So a resume still finds the part file it left, pieces and all
+    DownloadWriter writer(destination, content.size());
+    std::vector<uint8_t> piece;
+    ASSERT_TRUE(writer.readPiece(0, piece));
+    EXPECT_TRUE(std::equal(piece.begin(), piece.end(), content.begin()));
+    writer.discard();
+}
+
+TEST_F(DownloadWriterTest, JournalRoundTrip) {
+    DownloadJournal journal;
+    journal.destination_path = destination;
+    journal.key = "some file|with odd name.bin";
+    journal.by_hash = false;
+    journal.merkle_root = std::string(64, 'a');
+    journal.file_size = content.size();
+    journal.piece_size = PIECE_SIZE;
+    journal.addSource("127.0.0.1", 8888);
+    journal.addSource("10.0.0.2", 9000);
+    journal.addSource("127.0.0.1", 8888);
+    journal.bitmap = {0x3b};
+    ASSERT_TRUE(journal.save());
+    
+    DownloadJournal loaded;
+    ASSERT_TRUE(DownloadJournal::load(destination, loaded));
+    EXPECT_EQ(loaded.key, journal.key);
+    EXPECT_EQ(loaded.merkle_root, journal.merkle_root);
+    EXPECT_EQ(loaded.file_size, journal.file_size);
+    EXPECT_EQ(loaded.piece_size, journal.piece_size);
+    EXPECT_EQ(loaded.sources, std::vector<std::string>({"127.0.0.1:8888", "10.0.0.2:9000"}));
+    EXPECT_TRUE(loaded.hasPiece(0));
+    EXPECT_FALSE(loaded.hasPiece(2));
+    EXPECT_FALSE(loaded.hasPiece(100));
+    
+    auto pending = DownloadJournal::findAll(test_dir);
+    ASSERT_EQ(pending.size(), 1);
+    EXPECT_EQ(pending[0].destination_path, destination);
+    
+    // Garbage is ignored rather than trusted
+    std::ofstream(DownloadJournal::pathFor(destination)) << "not a journal";
+    EXPECT_FALSE(DownloadJournal::load(destination, loaded));
+    
+    DownloadJournal::remove(destination);
+    EXPECT_TRUE(DownloadJournal::findAll(test_dir).empty());
+}
+
+TEST_F(DownloadWriterTest, ResumeVerifiesPiecesOnDisk) {
+    PieceHasher hasher;
+    hasher.update(content.data(), content.size());
+    auto layout = hasher.finish();
+    
+    // First run gets three pieces in, one of them corrupted on disk afterwards
+    {
+        DownloadWriter writer(destination, content.size());
+        writer.write(0, content.data(), PIECE_SIZE * 3);
+        writer.flush();
+        
+        DownloadJournal journal;
+        journal.destination_path = destination;
+        journal.merkle_root = layout->root;
+        journal.file_size = layout->file_size;
+        journal.piece_size = layout->piece_size;
+        journal.bitmap = writer.getBitmap();
+        ASSERT_TRUE(journal.save());
+    }
+    {
+        std::fstream part(destination + DownloadWriter::PART_SUFFIX, std::ios::in | std::ios::out | std::ios::binary);
+        part.seekp(PIECE_SIZE + 10);
+        part.put('X');
+    }
+    
+    // Second run keeps the part file and re-checks what the journal claims
+    DownloadJournal journal;
+    ASSERT_TRUE(DownloadJournal::load(destination, journal));
+    DownloadWriter writer(destination, content.size());
+    std::vector<uint8_t> data;
+    for (size_t index = 0; index < layout->pieceCount(); ++index) {
+        if (journal.hasPiece(index) && writer.readPiece(index, data) &&
+            layout->verifyPiece(index, data.data(), data.size())) {
+            writer.markPieceComplete(index);
+        }
+    }
+    EXPECT_TRUE(writer.isPieceComplete(0));
+    EXPECT_FALSE(writer.isPieceComplete(1));
+    EXPECT_TRUE(writer.isPieceComplete(2));
+    EXPECT_EQ(writer.completedPieces(), 2);
+    
+    for (size_t index = 0; index < layout->pieceCount(); ++index) {
+        if (!writer.isPieceComplete(index)) {
+            writer.invalidatePiece(index);
+            writer.write(layout->pieceOffset(index), content.data() + layout->pieceOffset(index),
+                         layout->pieceLength(index));
+        }
+    }
+    EXPECT_TRUE(writer.commit());
+    EXPECT_EQ(readFile(destination), content);
+}
+
+TEST_F(DownloadWriterTest, VerifiesWhileReceiving) {
+    PieceHasher hasher;
+    hasher.update(content.data(), content.size());
+    auto layout = hasher.finish();
+    
+    // In order: piece hashes and the whole-file hash come for free
+    {
+        DownloadWriter writer(destination, content.size());
+        DownloadVerifier verifier(writer, layout);
+        for (size_t offset = 0; offset < content.size(); offset += 65536) {
+            size_t length = std::min<size_t>(65536, content.size() - offset);
+            verifier.push(offset, std::vector<uint8_t>(content.begin() + offset, content.begin() + offset + length));
+        }
+        
+        EXPECT_EQ(verifier.fileHash(), Sha256::hashHex(content.data(), content.size()));
+        EXPECT_EQ(verifier.getVerifiedPieces(), layout->pieceCount());
+        EXPECT_EQ(verifier.getBadPieces(), 0);
+        EXPECT_TRUE(writer.commit());
+        EXPECT_EQ(readFile(destination), content);
+    }
+    
+    // Out of order, with one corrupted block: only that piece goes back to missing
+    DownloadWriter writer(destination, content.size());
+    DownloadVerifier verifier(writer, layout);
+    std::vector<size_t> offsets;
+    for (size_t offset = 0; offset < content.size(); offset += 32768) {
+        offsets.push_back(offset);
+    }
+    std::reverse(offsets.begin(), offsets.end());
+    for (size_t offset : offsets) {
+        size_t length = std::min<size_t>(32768, content.size() - offset);
+        std::vector<uint8_t> block(content.begin() + offset, content.begin() + offset + length);
+        if (offset == PIECE_SIZE * 2 + 32768) {
+            block[5] ^= 0xff;
+        }
+        verifier.push(offset, std::move(block));
+    }
+    
+    EXPECT_EQ(verifier.fileHash(), "");
+    EXPECT_EQ(verifier.getBadPieces(), 1);
+    EXPECT_EQ(verifier.getVerifiedPieces(), layout->pieceCount() - 1);
+    EXPECT_FALSE(writer.isPieceComplete(2));
+    EXPECT_EQ(writer.completedPieces(), layout->pieceCount() - 1);
+    
+    // Sent again from its start, the piece verifies and completes
+    size_t start = layout->pieceOffset(2);
+    verifier.push(start, std::vector<uint8_t>(content.begin() + start, content.begin() + start + PIECE_SIZE));
+    verifier.drain();
+    EXPECT_EQ(verifier.getVerifiedPieces(), layout->pieceCount());
+    EXPECT_TRUE(writer.commit());
+    EXPECT_EQ(readFile(destination), content);
+}
+
+TEST_F(DownloadWriterTest, ReceivedFramesGoToDiskAsTheyAre) {
+    PieceHasher hasher;
+    hasher.update(content.data(), content.size());
+    auto layout = hasher.finish();
+    BufferPool& pool = BufferPool::shared();
+    
+    // Chunks still in their frames: a type byte, then the payload
+    DownloadWriter writer(destination, content.size());
+    DownloadVerifier verifier(writer, layout);
+    size_t frames = 0;
+    for (size_t offset = 0; offset < content.size(); offset += 65536, ++frames) {
+        size_t length = std::min<size_t>(65536, content.size() - offset);
+        auto frame = pool.acquire(length + 1);
+        frame[0] = static_cast<uint8_t>(MessageType::FILE_CHUNK);
+        std::copy(content.begin() + offset, content.begin() + offset + length, frame.begin() + 1);
+        verifier.push(offset, std::move(frame), 1);
+    }
+    
+    EXPECT_EQ(verifier.fileHash(), Sha256::hashHex(content.data(), content.size()));
+    EXPECT_EQ(verifier.getVerifiedPieces(), layout->pieceCount());
+    EXPECT_TRUE(writer.commit());
+    EXPECT_EQ(readFile(destination), content);
+    
+    // Written out, every buffer is back for the next download
+    EXPECT_GE(pool.getPooled(), frames);
+    size_t allocations = pool.getAllocations();
+    for (size_t i = 0; i < frames; ++i) {
+        pool.release(pool.acquire(BufferPool::MIN_CAPACITY));
+    }
+    EXPECT_EQ(pool.getAllocations(), allocations);
+}
+
+TEST_F(DownloadWriterTest, PooledBuffersFitTheirSize) {
+    // Swarm downloads alternate frame bodies and whole pieces through one pool
+    BufferPool pool;
+    const size_t frame_size = 64 * 1024 + 1;
+    auto first_piece = pool.acquire(PIECE_SIZE);
+    auto first_frame = pool.acquire(frame_size);
+    pool.release(std::move(first_piece));
+    pool.release(std::move(first_frame));
+    EXPECT_EQ(pool.getAllocations(), 2);
+    
+    for (int i = 0; i < 10; ++i) {
+        auto frame = pool.acquire(frame_size);
+        auto piece = pool.acquire(PIECE_SIZE);
+        EXPECT_EQ(frame.size(), frame_size);
+        EXPECT_EQ(piece.size(), PIECE_SIZE);
+        pool.release(std::move(frame));
+        pool.release(std::move(piece));
+    }
+    EXPECT_EQ(pool.getAllocations(), 2);
+    EXPECT_EQ(pool.getReuses(), 20);
+    EXPECT_EQ(pool.getPooled(), 2);
+}
@@ -2,6 +2,7 @@
 #include "FileManager.h"
 #include <filesystem>
 #include <fstream>
+#include <set>
 
 class FileManagerTest : public ::testing::Test {
 protected:
@@ -98,4 +99,333 @@ TEST_F(FileManagerTest, FileSizes) {
     
     // Test file size utility
     EXPECT_EQ(file_manager->getFileSize(test1_info.filepath), test1_info.size);
-}
\ No newline at end of file
+}
+
+TEST_F(FileManagerTest, IncrementalWatching) {
+    file_manager->refreshFileList();
+    ASSERT_TRUE(file_manager->startWatching());
+    
+    auto waitFor = [this](const std::string& filename, bool present) {
+        for (int i = 0; i < 50; ++i) {
+            if (file_manager->hasFile(filename) == present) {
+                return true;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        return false;
+    };
+    
+    // New file written outside the FileManager
+    {
+        std::ofstream file(test_dir + "created.txt");
+        file << "Created while watching";
+    }
+    EXPECT_TRUE(waitFor("created.txt", true));
+    
+    // Rename is a remove plus a create
+    std::filesystem::rename(test_dir + "created.txt", test_dir + "renamed.txt");
+    EXPECT_TRUE(waitFor("renamed.txt", true));
+    EXPECT_TRUE(waitFor("created.txt", false));
+    
+    // Files in new subdirectories are picked up
+    std::filesystem::create_directories(test_dir + "sub");
+    {
+        std::ofstream file(test_dir + "sub/nested.txt");
+        file << "Nested file";
+    }
+    EXPECT_TRUE(waitFor("nested.txt", true));
+    
+    // Deletions drop the entry
+    std::filesystem::remove_all(test_dir + "sub");
+    EXPECT_TRUE(waitFor("nested.txt", false));
+    
+    file_manager->stopWatching();
+    EXPECT_FALSE(file_manager->isWatching());
+}
+
+TEST_F(FileManagerTest, SnapshotIsolation) {
+    file_manager->refreshFileList();
+    auto before = file_manager->getSnapshot();
+    size_t before_count = before->files.size();
+    
+    {
+        std::ofstream file(test_dir + "late.txt");
+        file << "Added after the snapshot was taken";
+    }
+    file_manager->updateFile(test_dir + "late.txt");
+    
+    // Old view is untouched, new view sees the file under a newer version
+    auto after = file_manager->getSnapshot();
+    EXPECT_EQ(before->files.size(), before_count);
+    EXPECT_EQ(before->files.findByName("late.txt"), nullptr);
+    EXPECT_NE(after->files.findByName("late.txt"), nullptr);
+    EXPECT_GT(after->version, before->version);
+    
+    // Unchanged files don't publish a new snapshot
+    file_manager->updateFile(test_dir + "late.txt");
+    EXPECT_EQ(file_manager->getSnapshot()->version, after->version);
+    
+    file_manager->removeFile(test_dir + "late.txt");
+    EXPECT_FALSE(file_manager->hasFile("late.txt"));
+    EXPECT_NE(after->files.findByName("late.txt"), nullptr);
+}
+
+TEST_F(FileManagerTest, FileAccessModes) {
+    std::string path = test_dir + "binary.bin";
+    std::ifstream reference(path, std::ios::binary);
+    std::vector<uint8_t> expected((std::istreambuf_iterator<char>(reference)),
+                                  std::istreambuf_iterator<char>());
+    
+    for (auto mode : {FileAccess::Mode::MMAP, FileAccess::Mode::PREAD}) {
+        FileAccess file(path, mode);
+        EXPECT_EQ(file.mode(), mode);
+        EXPECT_EQ(file.size(), expected.size());
+        
+        // Ranged reads, including one running past the end
+        std::vector<uint8_t> buffer(600);
+        EXPECT_EQ(file.read(100, 200, buffer.data()), 200);
+        EXPECT_TRUE(std::equal(buffer.begin(), buffer.begin() + 200, expected.begin() + 100));
+        EXPECT_EQ(file.read(900, 600, buffer.data()), 100);
+        EXPECT_EQ(file.read(2000, 10, buffer.data()), 0);
+        
+        // Whole-file scan sees every byte once
+        std::vector<uint8_t> scanned;
+        file.forEachBlock([&scanned](const uint8_t* data, size_t length) {
+            scanned.insert(scanned.end(), data, data + length);
+        });
+        EXPECT_EQ(scanned, expected);
+    }
+    
+    // Small files stay on pread in AUTO mode
+    FileAccess small(path);
+    EXPECT_EQ(small.mode(), FileAccess::Mode::PREAD);
+    
+    EXPECT_THROW(FileAccess(test_dir + "missing.bin"), std::runtime_error);
+}
+
+TEST_F(FileManagerTest, TruncatedWhileMapped) {
+    std::string path = test_dir + "shrinking.bin";
+    std::vector<uint8_t> content(3 * FileAccess::READ_BLOCK_SIZE);
+    for (size_t i = 0; i < content.size(); ++i) {
+        content[i] = static_cast<uint8_t>(i * 7);
+    }
+    {
+        std::ofstream file(path, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(content.data()), content.size());
+    }
+    
+    FileAccess file(path, FileAccess::Mode::MMAP);
+    ASSERT_EQ(file.mode(), FileAccess::Mode::MMAP);
+    
+    // Cut to half a block while mapped: touching the lost pages would be SIGBUS
+    const size_t kept = FileAccess::READ_BLOCK_SIZE / 2;
+    std::filesystem::resize_file(path, kept);
+    
+    std::vector<uint8_t> buffer(FileAccess::READ_BLOCK_SIZE);
+    EXPECT_EQ(file.read(0, buffer.size(), buffer.data()), kept);
+    EXPECT_EQ(file.read(2 * FileAccess::READ_BLOCK_SIZE, buffer.size(), buffer.data()), 0);
+    
+    std::vector<uint8_t> scanned;
+    file.forEachBlock([&scanned](const uint8_t* data, size_t length) {
+        scanned.insert(scanned.end(), data, data + length);
+    });
+    EXPECT_EQ(scanned, std::vector<uint8_t>(content.begin(), content.begin() + kept));
+}
+
+TEST_F(FileManagerTest, PieceHashes) {
+    // Two full pieces and a short tail
+    std::string path = test_dir + "pieces.bin";
+    std::vector<uint8_t> content(2 * PIECE_SIZE + 1000);
+    for (size_t i = 0; i < content.size(); ++i) {
+        content[i] = static_cast<uint8_t>(i * 31 + i / 4099);
+    }
+    std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(content.data()), content.size());
+    
+    file_manager->setSharedDirectory(test_dir);
+    ASSERT_TRUE(file_manager->hasFile("pieces.bin"));
+    FileInfo info = file_manager->getFileInfo("pieces.bin");
+    ASSERT_NE(info.pieces, nullptr);
+    
+    const PieceLayout& layout = *info.pieces;
+    EXPECT_EQ(layout.pieceCount(), 3);
+    EXPECT_EQ(layout.pieceLength(2), 1000);
+    EXPECT_EQ(layout.root, info.merkle_root);
+    EXPECT_TRUE(layout.isConsistent());
+    
+    // Each piece verifies on its own, a flipped byte doesn't
+    EXPECT_TRUE(layout.verifyPiece(1, content.data() + PIECE_SIZE, PIECE_SIZE));
+    EXPECT_TRUE(layout.verifyPiece(2, content.data() + 2 * PIECE_SIZE, 1000));
+    content[PIECE_SIZE + 5] ^= 0xFF;
+    EXPECT_FALSE(layout.verifyPiece(1, content.data() + PIECE_SIZE, PIECE_SIZE));
+    EXPECT_FALSE(layout.verifyPiece(2, content.data() + 2 * PIECE_SIZE, 999));
+    
+    // Wire round trip, and a tampered hash no longer matches the root
+    PieceLayout parsed;
+    ASSERT_TRUE(PieceLayout::deserialize(layout.serialize(), parsed));
+    EXPECT_EQ(parsed.piece_hashes, layout.piece_hashes);
+    EXPECT_TRUE(parsed.isConsistent());
+    parsed.piece_hashes[0][0] = parsed.piece_hashes[0][0] == '0' ? '1' : '0';
+    EXPECT_FALSE(parsed.isConsistent());
+}
+
+TEST_F(FileManagerTest, ContentDeduplication) {
+    // Same content as test1.txt under another name, in a subdirectory, and as a hard link
+    std::filesystem::create_directories(test_dir + "sub");
+    std::filesystem::copy_file(test_dir + "test1.txt", test_dir + "sub/renamed.txt");
+    std::filesystem::create_hard_link(test_dir + "test2.txt", test_dir + "linked.txt");
+    file_manager->refreshFileList();
+    
+    EXPECT_EQ(file_manager->getFileCount(), 5);
+    EXPECT_EQ(file_manager->getUniqueFiles().size(), 3);
+    
+    FileInfo original = file_manager->getFileInfo("test1.txt");
+    auto copies = file_manager->getFilesByHash(original.hash);
+    ASSERT_EQ(copies.size(), 2);
+    
+    // Identical content shares one piece layout
+    EXPECT_EQ(copies[0].pieces, copies[1].pieces);
+    EXPECT_EQ(file_manager->getFileInfo("renamed.txt").hash, original.hash);
+    EXPECT_EQ(file_manager->getFileInfo("linked.txt").hash, file_manager->getFileInfo("test2.txt").hash);
+    
+    // Served by hash regardless of name, even after one copy goes away
+    std::filesystem::remove(test_dir + "test1.txt");
+    auto file = file_manager->openFileByHash(original.hash);
+    EXPECT_EQ(file->size(), original.size);
+    EXPECT_THROW(file_manager->openFileByHash("missing"), std::runtime_error);
+    
+    // A rehash of an unchanged inode comes from the cache and stays consistent
+    file_manager->updateFile(test_dir + "sub/renamed.txt");
+    EXPECT_EQ(file_manager->getFileInfo("renamed.txt").hash, original.hash);
+}
+
+TEST_F(FileManagerTest, StreamingReadPolicy) {
+    std::string path = test_dir + "large.bin";
+    std::vector<uint8_t> content(3 * 1024 * 1024 + 123);
+    for (size_t i = 0; i < content.size(); ++i) {
+        content[i] = static_cast<uint8_t>(i * 7 + i / 1000);
+    }
+    std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(content.data()), content.size());
+    
+    ReadPolicy policy(1024 * 1024);
+    EXPECT_TRUE(policy.isStreaming(content.size()));
+    EXPECT_FALSE(policy.isStreaming(1000));
+    EXPECT_EQ(policy.accessMode(content.size()), FileAccess::Mode::PREAD);
+    
+    // Large file streams through with drop-behind, every byte accounted for
+    FileAccess large(path, policy.accessMode(content.size()));
+    std::vector<uint8_t> received;
+    {
+        ReadPolicy::Stream stream(policy, large, 0, 0);
+        EXPECT_TRUE(stream.isStreaming());
+        std::vector<uint8_t> buffer(8192);
+        for (size_t offset = 0; ; ) {
+            size_t n = stream.read(offset, buffer.size(), buffer.data());
+            if (n == 0) break;
+            received.insert(received.end(), buffer.begin(), buffer.begin() + n);
+            offset += n;
+        }
+    }
+    EXPECT_EQ(received, content);
+    
+    // Small file read as a range stays cached
+    FileAccess small(test_dir + "binary.bin", policy.accessMode(1000));
+    std::vector<uint8_t> buffer(100);
+    {
+        ReadPolicy::Stream stream(policy, small, 100, 100);
+        EXPECT_FALSE(stream.isStreaming());
+        EXPECT_EQ(stream.read(100, 500, buffer.data()), 100);
+        EXPECT_EQ(stream.read(200, 10, buffer.data()), 0);
+    }
+    EXPECT_EQ(small.residentBytes(0, 1000), 1000);
+    
+    ReadStats stats = policy.getStats();
+    EXPECT_EQ(stats.streaming_requests, 1);
+    EXPECT_EQ(stats.cached_requests, 1);
+    EXPECT_EQ(stats.bytes_read, content.size() + 100);
+    EXPECT_EQ(stats.cache_hit_bytes + stats.cache_miss_bytes, content.size() + 100);
+    EXPECT_EQ(stats.dropped_bytes, content.size());
+    EXPECT_GE(stats.hitRate(), 0.0);
+    EXPECT_LE(stats.hitRate(), 1.0);
+}
+
+TEST_F(FileManagerTest, OpenFileCache) {
+    FdCache cache(2);
+    std::string path = test_dir + "test1.txt";
+    
+    // Repeated opens of an unchanged file share one handle
+    auto first = cache.open(path);
+    auto second = cache.open(path);
+    EXPECT_EQ(first, second);
+    EXPECT_EQ(cache.getStats().hits, 1);
+    EXPECT_EQ(cache.getStats().misses, 1);
+    
+    // A rewrite is noticed by stat and gets a fresh handle
+    std::ofstream(path) << "rewritten with different length";
+    auto third = cache.open(path);
+    EXPECT_NE(third, first);
+    EXPECT_EQ(third->size(), std::string("rewritten with different length").size());
+    EXPECT_EQ(cache.getStats().stale, 1);
+    
+    // Bounded: the least recently used handle goes, but stays usable by its holder
+    cache.open(test_dir + "test2.txt");
+    cache.open(test_dir + "binary.bin");
+    EXPECT_EQ(cache.getStats().open, 2);
+    EXPECT_EQ(cache.getStats().evictions, 1);
+    uint8_t byte;
+    EXPECT_EQ(third->read(0, 1, &byte), 1);
+    
+    cache.invalidateUnder(test_dir);
+    EXPECT_EQ(cache.getStats().open, 0);
+    EXPECT_THROW(cache.open(test_dir + "missing.txt"), std::runtime_error);
+    
+    // FileManager serves repeated requests from the same handle
+    file_manager->refreshFileList();
+    auto a = file_manager->openFile("binary.bin");
+    auto b = file_manager->openFile("binary.bin");
+    EXPECT_EQ(a, b);
+}
+
+TEST_F(FileManagerTest, ParallelDirectoryScan) {
+    // Nested tree with a hidden file, a symlinked file and a symlinked directory
+    std::filesystem::create_directories(test_dir + "a/b/c");
+    std::filesystem::create_directories(test_dir + "d");
+    for (int i = 0; i < 50; ++i) {
+        std::ofstream(test_dir + "a/b/c/deep" + std::to_string(i) + ".txt") << "deep " << i;
+        std::ofstream(test_dir + "d/wide" + std::to_string(i) + ".txt") << "wide " << i;
+    }
+    std::ofstream(test_dir + "a/.hidden") << "hidden";
+    std::filesystem::create_symlink(std::filesystem::absolute(test_dir + "test1.txt"), test_dir + "a/alias.txt");
+    std::filesystem::create_directory_symlink(std::filesystem::absolute(test_dir + "d"), test_dir + "loop");
+    
+    DirectoryScanner scanner(4);
+    auto entries = scanner.scanAll(test_dir, [](const std::string& name) { return name.front() != '.'; });
+    
+    std::set<std::string> paths;
+    for (const auto& entry : entries) {
+        paths.insert(entry.path);
+        EXPECT_EQ(entry.st.st_size, std::filesystem::file_size(entry.path));
+    }
+    EXPECT_EQ(paths.size(), entries.size());
+    EXPECT_EQ(entries.size(), 3 + 100 + 1);
+    EXPECT_TRUE(paths.count(test_dir + "a/b/c/deep7.txt"));
+    EXPECT_TRUE(paths.count(test_dir + "a/alias.txt"));
+    EXPECT_FALSE(paths.count(test_dir + "a/.hidden"));
+    EXPECT_FALSE(paths.count(test_dir + "loop/wide0.txt"));
+    EXPECT_EQ(scanner.getDirectoriesScanned(), 5);
+    
+    // A one-slot queue still delivers everything
+    BoundedQueue<ScanEntry> queue(1);
+    std::thread walker([&]() { scanner.scan(test_dir, queue); });
+    size_t received = 0;
+    ScanEntry entry;
+    while (queue.pop(entry)) {
+        ++received;
+    }
+    walker.join();
+    EXPECT_EQ(received, entries.size() + 1);
+    
+    // The file manager picks up the same set through the scanner
+    file_manager->refreshFileList();
+    EXPECT_EQ(file_manager->getFileCount(), entries.size());
+    EXPECT_EQ(file_manager->getFileInfo("alias.txt").hash, file_manager->getFileInfo("test1.txt").hash);
+}
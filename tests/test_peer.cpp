@@ -1,5 +1,6 @@
 #include <gtest/gtest.h>
 #include "Peer.h"
+#include "PeerManager.h"
 #include <thread>
 #include <chrono>
 
@@ -123,3 +124,106 @@ TEST_F(PeerTest, ThreadSafety) {
     auto files = peer->getFiles();
     EXPECT_EQ(files.size(), num_threads * files_per_thread);
 }
+
+
+TEST_F(PeerTest, HashLookupAndBulkUpdate) {
+    peer->addFile(FileInfo("a.txt", "", 10, "hash_a", 0));
+    peer->addFile(FileInfo("b.txt", "", 20, "hash_b", 0));
+    
+    EXPECT_TRUE(peer->hasFileWithHash("hash_a"));
+    EXPECT_FALSE(peer->hasFileWithHash("hash_c"));
+    
+    // Re-adding a name replaces the entry and its hash
+    peer->addFile(FileInfo("a.txt", "", 30, "hash_c", 0));
+    EXPECT_FALSE(peer->hasFileWithHash("hash_a"));
+    EXPECT_TRUE(peer->hasFileWithHash("hash_c"));
+    EXPECT_EQ(peer->getFileInfo("a.txt").size, 30);
+    EXPECT_EQ(peer->getFileCount(), 2);
+    
+    // Removing from the middle keeps the remaining entries reachable
+    peer->addFile(FileInfo("c.txt", "", 40, "hash_d", 0));
+    peer->removeFile("a.txt");
+    EXPECT_TRUE(peer->hasFile("b.txt"));
+    EXPECT_TRUE(peer->hasFile("c.txt"));
+    EXPECT_EQ(peer->getFileInfo("c.txt").hash, "hash_d");
+    EXPECT_TRUE(peer->hasFileWithHash("hash_d"));
+    
+    // Bulk replacement drops everything not in the new list
+    std::vector<FileInfo> files;
+    for (int i = 0; i < 100; ++i) {
+        files.emplace_back("bulk_" + std::to_string(i), "", i, "bulk_hash_" + std::to_string(i), 0);
+    }
+    peer->setFiles(files);
+    
+    EXPECT_EQ(peer->getFileCount(), 100);
+    EXPECT_FALSE(peer->hasFile("b.txt"));
+    EXPECT_TRUE(peer->hasFile("bulk_42"));
+    EXPECT_TRUE(peer->hasFileWithHash("bulk_hash_99"));
+    
+    // Content lookups find a file whatever it is called
+    EXPECT_EQ(peer->getFileInfoByHash("bulk_hash_7").filename, "bulk_7");
+    EXPECT_THROW(peer->getFileInfoByHash("hash_a"), std::runtime_error);
+}
+
+TEST_F(PeerTest, SmoothedSourceStatistics) {
+    using std::chrono::microseconds;
+    PeerStats stats;
+    EXPECT_FALSE(stats.isMeasured());
+    
+    // The first sample stands, later ones move the average by ALPHA
+    stats.addTransfer(1000000, microseconds(1000000), 4, 0);
+    EXPECT_TRUE(stats.isMeasured());
+    EXPECT_DOUBLE_EQ(stats.getThroughput(), 1000000.0);
+    stats.addTransfer(1000000, microseconds(500000), 4, 0);
+    EXPECT_DOUBLE_EQ(stats.getThroughput(), 1300000.0);
+    
+    // Too small to time the link; only the outcome counts
+    stats.addTransfer(100, microseconds(1000000), 1, 1);
+    EXPECT_DOUBLE_EQ(stats.getThroughput(), 1300000.0);
+    EXPECT_DOUBLE_EQ(stats.getFailureRate(), PeerStats::ALPHA);
+    
+    // A heartbeat answered is a success, one missed a failure
+    stats.addRtt(microseconds(2000));
+    EXPECT_DOUBLE_EQ(stats.getRttMs(), 2.0);
+    EXPECT_LT(stats.getFailureRate(), PeerStats::ALPHA);
+    stats.addFailure();
+    EXPECT_GT(stats.getFailureRate(), PeerStats::ALPHA);
+}
+
+TEST_F(PeerTest, SourceSelectionPrefersFastHealthyPeers) {
+    PeerManager manager;
+    std::vector<std::shared_ptr<Peer>> candidates;
+    for (int port = 9001; port <= 9005; ++port) {
+        candidates.push_back(std::make_shared<Peer>("peer-" + std::to_string(port), "127.0.0.1", port));
+    }
+    candidates[4]->setActive(false);
+    
+    // 9001 slow, 9002 fast but failing half its requests, 9003 fast, 9004 never used
+    auto report = [&](int port, size_t bytes_per_second, size_t failures) {
+        manager.recordTransfer({"127.0.0.1", port, bytes_per_second, std::chrono::microseconds(1000000),
+                                std::chrono::microseconds(1000), 10 - failures, failures});
+    };
+    report(9001, 10 * 1024 * 1024, 0);
+    report(9002, 100 * 1024 * 1024, 5);
+    report(9003, 100 * 1024 * 1024, 0);
+    
+    auto ranked = manager.selectSources(candidates, candidates.size());
+    ASSERT_EQ(ranked.size(), 4);
+    EXPECT_EQ(ranked[0]->getPort(), 9003);
+    EXPECT_EQ(ranked[1]->getPort(), 9002);
+    EXPECT_EQ(ranked[2]->getPort(), 9001);
+    EXPECT_EQ(ranked[3]->getPort(), 9004);
+    EXPECT_GT(manager.getPeerStats("127.0.0.1:9001").getRttMs(), 0.0);
+    
+    // With room for two, the second place now and then goes to the unmeasured peer
+    int probes = 0;
+    for (int i = 0; i < 1000; ++i) {
+        auto picked = manager.selectSources(candidates, 2);
+        ASSERT_EQ(picked.size(), 2);
+        EXPECT_EQ(picked[0]->getPort(), 9003);
+        EXPECT_NE(picked[1]->getPort(), 9001);
+        probes += picked[1]->getPort() == 9004;
+    }
+    EXPECT_GT(probes, 30);
+    EXPECT_LT(probes, 250);
+}
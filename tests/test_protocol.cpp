@@ -88,6 +88,31 @@ TEST_F(ProtocolTest, FileRequestMessages) {
     EXPECT_EQ(parsed_length, length);
 }
 
+TEST_F(ProtocolTest, RangeRequests) {
+    std::string key;
+    size_t offset = 1, length = 1;
+    
+    // The whole file is just the key
+    auto whole = Protocol::serializeRangeRequest("test.txt");
+    EXPECT_EQ(std::string(whole.begin(), whole.end()), "test.txt");
+    EXPECT_TRUE(Protocol::parseRangeRequest(whole, key, offset, length));
+    EXPECT_EQ(key, "test.txt");
+    EXPECT_EQ(offset, 0);
+    EXPECT_EQ(length, 0);
+    
+    // Offsets past 4GB survive the round trip
+    size_t big = 5ULL * 1024 * 1024 * 1024;
+    auto range = Protocol::serializeRangeRequest("abc123", big, 262144);
+    EXPECT_TRUE(Protocol::parseRangeRequest(range, key, offset, length));
+    EXPECT_EQ(key, "abc123");
+    EXPECT_EQ(offset, big);
+    EXPECT_EQ(length, 262144);
+    
+    std::string garbage = std::string("test.txt") + '\0' + "x" + '\0' + "y";
+    EXPECT_FALSE(Protocol::parseRangeRequest(std::vector<uint8_t>(garbage.begin(), garbage.end()),
+                                             key, offset, length));
+}
+
 TEST_F(ProtocolTest, ErrorMessages) {
     ErrorCode error_code = ErrorCode::FILE_NOT_FOUND;
     std::string error_msg = "File not found on this peer";
@@ -0,0 +1,112 @@
+#include <gtest/gtest.h>
+#include "SwarmDownloader.h"
+
+// The picker and window are pure bookkeeping; nothing here touches the network
+class SwarmDownloaderTest : public ::testing::Test {
+};
+
+TEST_F(SwarmDownloaderTest, RarestFirstPicking) {
+    PiecePicker picker(6);
+    picker.markDone(0);
+    
+    // Pieces 1-3 are on both sources, 4 and 5 only on the first: those are rarest
+    size_t full = picker.addSource();
+    size_t partial = picker.addSource({false, true, true, true, false, false});
+    
+    EXPECT_EQ(picker.pick(full), 4);
+    EXPECT_EQ(picker.pick(partial), 1);
+    EXPECT_EQ(picker.pick(full), 5);
+    EXPECT_EQ(picker.pick(partial), 2);  // Equally rare ones in file order
+    EXPECT_EQ(picker.inFlight(), 4);
+    
+    // A failed piece goes back for whoever asks next
+    EXPECT_EQ(picker.release(1), partial);
+    EXPECT_EQ(picker.pick(full), 1);
+    
+    // Losing a source hands its requested pieces back to the others
+    picker.removeSource(partial);
+    EXPECT_EQ(picker.pick(partial), PiecePicker::NONE);
+    EXPECT_EQ(picker.pick(full), 2);
+    EXPECT_EQ(picker.pick(full), 3);
+    EXPECT_EQ(picker.pick(full), PiecePicker::NONE);
+    
+    for (size_t piece = 1; piece < 6; ++piece) {
+        EXPECT_FALSE(picker.isDone());
+        picker.complete(piece);
+    }
+    EXPECT_TRUE(picker.isDone());
+    EXPECT_EQ(picker.remaining(), 0);
+    EXPECT_EQ(picker.inFlight(), 0);
+}
+
+TEST_F(SwarmDownloaderTest, EndgameDuplicatePicking) {
+    PiecePicker picker(3);
+    size_t a = picker.addSource();
+    size_t b = picker.addSource();
+    size_t c = picker.addSource();
+    size_t d = picker.addSource();
+    
+    EXPECT_EQ(picker.pick(a), 0);
+    EXPECT_EQ(picker.pick(b), 1);
+    EXPECT_EQ(picker.pick(c), 2);
+    EXPECT_EQ(picker.pick(d), PiecePicker::NONE);
+    
+    // Least duplicated first, then the one waiting longest; never a source's own
+    EXPECT_EQ(picker.pickDuplicate(d), 0);
+    EXPECT_EQ(picker.pickDuplicate(d), 1);
+    EXPECT_EQ(picker.pickDuplicate(a), 2);
+    EXPECT_EQ(picker.pickDuplicate(b), 0);
+    EXPECT_EQ(picker.pickDuplicate(c), 1);
+    
+    // Every piece is at MAX_REQUESTERS or already the source's
+    EXPECT_EQ(picker.pickDuplicate(a), PiecePicker::NONE);
+    EXPECT_EQ(picker.inFlight(), 3);
+    
+    // One copy failing leaves the others; the first arrival wins
+    picker.release(0, a);
+    EXPECT_TRUE(picker.arrived(0));
+    EXPECT_FALSE(picker.arrived(0));
+    EXPECT_EQ(picker.pickDuplicate(a), PiecePicker::NONE);
+    
+    // With every copy failed the piece is missing again
+    picker.release(2, c);
+    picker.release(2, a);
+    EXPECT_EQ(picker.inFlight(), 2);
+    EXPECT_EQ(picker.pick(b), 2);
+    
+    for (size_t piece = 0; piece < 3; ++piece) {
+        picker.complete(piece);
+    }
+    EXPECT_FALSE(picker.arrived(1));
+    EXPECT_TRUE(picker.isDone());
+    EXPECT_EQ(picker.inFlight(), 0);
+}
+
+TEST_F(SwarmDownloaderTest, RequestWindowCoversBandwidthDelay) {
+    using std::chrono::microseconds;
+    RequestWindow window;
+    
+    // Nothing measured yet
+    EXPECT_EQ(window.limit(PIECE_SIZE), RequestWindow::MIN_REQUESTS);
+    
+    // 100 MB/s with a 10ms round trip: 1MB in flight, 1.5MB with headroom,
+    // six pieces plus the one being delivered
+    window.addDeliverySample(PIECE_SIZE, microseconds(PIECE_SIZE / 100));
+    window.addRttSample(microseconds(20000));
+    window.addRttSample(microseconds(10000));
+    EXPECT_EQ(window.rtt(), microseconds(10000));
+    EXPECT_EQ(window.limit(PIECE_SIZE), 7);
+    
+    // The best recent rate counts; a slow sample doesn't shrink the window
+    window.addDeliverySample(PIECE_SIZE, microseconds(PIECE_SIZE));
+    EXPECT_EQ(window.limit(PIECE_SIZE), 7);
+    
+    // A long fat link is capped, a short one keeps the minimum
+    window.addRttSample(microseconds(1));
+    EXPECT_EQ(window.limit(PIECE_SIZE), RequestWindow::MIN_REQUESTS);
+    
+    RequestWindow distant;
+    distant.addDeliverySample(PIECE_SIZE, microseconds(PIECE_SIZE / 100));
+    distant.addRttSample(microseconds(1000000));
+    EXPECT_EQ(distant.limit(PIECE_SIZE), RequestWindow::MAX_REQUESTS);
+}